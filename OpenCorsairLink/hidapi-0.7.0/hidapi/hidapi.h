@@ -39,11 +39,22 @@
 
 #define HID_API_EXPORT_CALL HID_API_EXPORT HID_API_CALL /**< API export and call macro*/
 
+#define HID_EVENTS_THREAD   0 /**< Event mode: a thread per device */
+#define HID_EVENTS_SHARED   1 /**< Event mode: one thread for all devices */
+#define HID_EVENTS_EXTERNAL 2 /**< Event mode: the application's poll loop */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 		struct hid_device_;
 		typedef struct hid_device_ hid_device; /**< opaque hidapi structure */
+		struct hid_reactor_;
+		typedef struct hid_reactor_ hid_reactor; /**< opaque reactor structure */
+
+		/** Called by hid_reactor_run() with each report read from a
+		    device, or with data NULL and length 0 once the device
+		    is gone (it is then no longer watched). */
+		typedef void (HID_API_CALL *hid_report_callback)(hid_device *device, const unsigned char *data, size_t length, void *user_data);
 
 		/** hidapi info structure */
 		struct hid_device_info {
@@ -78,6 +89,29 @@ extern "C" {
 			struct hid_device_info *next;
 		};
 
+		/** File descriptor to watch, see hid_get_pollfds() */
+		struct hid_pollfd {
+			/** The file descriptor */
+			int fd;
+			/** poll() events to wait for on it */
+			short events;
+		};
+
+		/** Input report queue counters, see hid_get_input_stats() */
+		struct hid_input_stats {
+			/** Input reports received from the device */
+			unsigned long received;
+			/** Reports discarded unread because the queue
+			    was full (the reader fell behind) */
+			unsigned long dropped;
+			/** Reports waiting to be read right now */
+			unsigned int queued;
+			/** Most reports ever waiting at once */
+			unsigned int max_queued;
+			/** Reports the queue can hold */
+			unsigned int capacity;
+		};
+
 
 		/** @brief Initialize the HIDAPI library.
 
@@ -108,6 +142,73 @@ extern "C" {
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_exit(void);
 
+		/** @brief Set how many input transfers each device keeps queued.
+
+			Devices opened after this call keep count interrupt IN
+			transfers queued on their input endpoint, so the next
+			report always has a transfer waiting for it. The
+			default is 4. Only the libusb backend queues its own
+			transfers.
+
+			@ingroup API
+			@param count Transfers per device, 1 to 8.
+
+			@returns
+				This function returns 0 on success and -1 on error
+				or if the backend does not queue transfers itself.
+		*/
+		int HID_API_EXPORT_CALL hid_set_input_transfers(int count);
+
+		/** @brief Set how events are handled for devices opened from now on.
+
+			Each device opened with HID_EVENTS_THREAD (the default)
+			gets its own thread to receive input reports. With
+			HID_EVENTS_SHARED one thread serves every device opened
+			that way. With HID_EVENTS_EXTERNAL there is no thread:
+			the application watches the descriptors from
+			hid_get_pollfds() in its own poll loop and calls
+			hid_handle_events() when one is ready. Until it does,
+			no input reports arrive and hid_read() waits. Only the
+			libusb backend supports this.
+
+			@ingroup API
+			@param mode HID_EVENTS_THREAD, HID_EVENTS_SHARED or
+				HID_EVENTS_EXTERNAL.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_set_event_mode(int mode);
+
+		/** @brief Get the file descriptors to watch for HID events.
+
+			The set changes as devices are opened and closed, so
+			fetch it again after either.
+
+			@ingroup API
+			@param fds Array to put the descriptors in.
+			@param max The number of elements in fds.
+
+			@returns
+				This function returns the number of descriptors,
+				which may be more than max, and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_get_pollfds(struct hid_pollfd *fds, int max);
+
+		/** @brief Handle pending HID events.
+
+			Receives input reports and completes transfers for
+			every open device, waiting up to the given time if
+			there is nothing to do yet.
+
+			@ingroup API
+			@param milliseconds Longest time to wait, 0 to not wait.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_handle_events(int milliseconds);
+
 		/** @brief Enumerate the HID Devices.
 
 			This function returns a linked list of all the HID devices
@@ -200,6 +301,48 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_write(hid_device *device, const unsigned char *data, size_t length);
 
+		/** @brief Start writing an Output report to a HID device.
+
+			Queues the report on the interrupt OUT endpoint and
+			returns without waiting for it to be sent. Up to 8
+			writes can be in flight per device. Every token
+			returned must be collected with hid_write_wait(),
+			which frees its slot. A device with no OUT endpoint,
+			or any device under the hidraw backend, is written
+			before this returns, like hid_write(); its token
+			still takes one of the 8 slots until collected.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data The data to send, including the report number
+				as the first byte, as for hid_write(). At most one
+				packet of the OUT endpoint.
+			@param length The length in bytes of the data to send.
+			@param milliseconds How long the device may take to
+				accept the report, 0 or -1 for no limit.
+
+			@returns
+				This function returns a token for hid_write_wait()
+				or -1 on error or if all 8 slots are in use.
+		*/
+		int HID_API_EXPORT_CALL hid_write_async(hid_device *device, const unsigned char *data, size_t length, int milliseconds);
+
+		/** @brief Wait for a write started with hid_write_async().
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param token A token returned from hid_write_async().
+			@param milliseconds Timeout in milliseconds, 0 to only
+				check or -1 to wait until the write is done.
+
+			@returns
+				This function returns the number of bytes written,
+				counting the report number as for hid_write(), 0 if
+				the write is still in flight (the token is still
+				valid) and -1 on error or if the token is unknown.
+		*/
+		int HID_API_EXPORT_CALL hid_write_wait(hid_device *device, int token, int milliseconds);
+
 		/** @brief Read an Input report from a HID device with timeout.
 
 			Input reports are returned
@@ -239,6 +382,37 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *device, unsigned char *data, size_t length);
 
+		/** @brief Read an Input report without copying it.
+
+			Like hid_read_timeout(), but instead of copying the
+			report into a buffer of the caller's, points data at
+			the library's own copy of it. The report stays valid
+			until hid_read_release(), the next hid_read_borrow() or
+			hid_close() on the device, and while it is held the
+			library has one report less of room to queue input in.
+			Only one report per device can be borrowed at a time.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data Set to the report, including the report
+				number if the device uses numbered reports.
+			@param milliseconds timeout in milliseconds, 0 to only
+				check or -1 for blocking wait.
+
+			@returns
+				This function returns the number of bytes in the
+				report, 0 if none came in time (data is not set)
+				and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_read_borrow(hid_device *device, const unsigned char **data, int milliseconds);
+
+		/** @brief Give back a report from hid_read_borrow().
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+		*/
+		void HID_API_EXPORT_CALL hid_read_release(hid_device *device);
+
 		/** @brief Set the device handle to be non-blocking.
 
 			In non-blocking mode calls to hid_read() will return
@@ -364,6 +538,106 @@ extern "C" {
 		*/
 		int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *device, int string_index, wchar_t *string, size_t maxlen);
 
+		/** @brief Get the input report queue counters of a HID device.
+
+			Input reports are queued from the time the device is
+			opened until they are read with hid_read(). When the
+			queue is full the oldest report is dropped, so a
+			growing dropped count means the reader is not keeping
+			up with the device.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param stats The structure to fill in.
+
+			@returns
+				This function returns 0 on success and -1 on error
+				or if the backend does not keep these counters.
+		*/
+		int HID_API_EXPORT_CALL hid_get_input_stats(hid_device *device, struct hid_input_stats *stats);
+
+		/** @brief Create a reactor to wait on many devices at once.
+
+			Devices added to a reactor are all watched by one epoll
+			instance, so a single call to hid_reactor_run() waits
+			until any of them has a report. Only the hidraw backend
+			supports this.
+
+			@ingroup API
+
+			@returns
+				This function returns a pointer to the new reactor
+				or NULL on failure.
+		*/
+		HID_API_EXPORT hid_reactor * HID_API_CALL hid_reactor_new(void);
+
+		/** @brief Watch a device with a reactor.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new().
+			@param device A device handle returned from hid_open().
+			@param callback Called with each report the device sends.
+			@param user_data Passed to callback as is.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_reactor_add(hid_reactor *reactor, hid_device *device, hid_report_callback callback, void *user_data);
+
+		/** @brief Stop watching a device.
+
+			May be called from a callback. Remove a device before
+			closing it.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new().
+			@param device A device added with hid_reactor_add().
+
+			@returns
+				This function returns 0 on success and -1 if the
+				device was not being watched.
+		*/
+		int HID_API_EXPORT_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *device);
+
+		/** @brief Wait for reports and call back with them.
+
+			Waits until at least one watched device has a report or
+			the timeout expires, then reads one report from each
+			ready device and passes it to that device's callback.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new().
+			@param milliseconds Timeout in milliseconds, 0 to not
+				wait or -1 to wait forever.
+
+			@returns
+				This function returns the number of reports passed
+				to callbacks, 0 on timeout and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds);
+
+		/** @brief Get the reactor's file descriptor.
+
+			It becomes readable when hid_reactor_run() has work to
+			do, so a reactor can be nested in another poll loop.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new().
+
+			@returns
+				This function returns the file descriptor.
+		*/
+		int HID_API_EXPORT_CALL hid_reactor_get_fd(hid_reactor *reactor);
+
+		/** @brief Free a reactor.
+
+			The devices it watched are not closed.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new().
+		*/
+		void HID_API_EXPORT_CALL hid_reactor_free(hid_reactor *reactor);
+
 		/** @brief Get a string describing the last error which occurred.
 
 			@ingroup API
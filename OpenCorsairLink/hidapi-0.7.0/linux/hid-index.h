@@ -0,0 +1,313 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Device index shared by the two Linux backends.
+
+ The index keeps the result of one walk of every HID device on the
+ bus, hashed by VID/PID, so that hid_enumerate() and hid_open() can
+ answer from memory. A udev monitor, created before the first scan,
+ keeps it current: a device that goes away is dropped from the index,
+ and a device that arrives makes the next query scan the bus again.
+ Without udev every query scans, as before.
+
+ Reading a device's strings can mean opening it, as it does for the
+ libusb backend. Such a backend leaves the strings out of its scan
+ and gives the index a strings function instead, which is called the
+ first time a query returns the device: a query for one VID/PID only
+ opens the devices that have it.
+
+ This file is included by hid.c and hid-libusb.c. Each fills in the
+ first five fields of its index statically: the udev subsystem and
+ devtype to watch, and its own scan and match functions. hid-libusb.c
+ fills in a sixth, its strings function.
+********************************************************/
+
+#define HID_INDEX_BUCKETS 64 /* Must be a power of two */
+
+/* One device in a hash bucket. The hid_device_info itself is on the
+   devices list of the index, in scan order. */
+struct hid_index_node {
+	struct hid_device_info *info;
+	int strings_read; /* boolean, index->strings() has been called */
+	struct hid_index_node *next;
+};
+
+/* Scan the bus for every HID device. */
+typedef struct hid_device_info *(*hid_index_scan_fn)(void);
+
+/* Whether info belongs to the udev device being removed. */
+typedef int (*hid_index_match_fn)(struct hid_device_info *info, struct udev_device *udev_dev);
+
+/* Fill in the strings of a device the scan left them out of. */
+typedef void (*hid_index_strings_fn)(struct hid_device_info *info);
+
+struct hid_index {
+	pthread_mutex_t lock;
+	const char *subsystem;
+	const char *devtype;
+	hid_index_scan_fn scan;
+	hid_index_match_fn match;
+	hid_index_strings_fn strings; /* NULL if the scan reads them */
+
+	int started; /* The monitor has been set up, if it could be */
+	int valid; /* The devices list matches the bus */
+	struct udev *udev;
+	struct udev_monitor *monitor;
+	struct hid_device_info *devices;
+	struct hid_index_node *bucket[HID_INDEX_BUCKETS];
+};
+
+static unsigned int hid_index_hash(unsigned short vendor_id, unsigned short product_id)
+{
+	return ((vendor_id * 31u) ^ product_id) & (HID_INDEX_BUCKETS - 1);
+}
+
+static void hid_index_clear(struct hid_index *index)
+{
+	struct hid_index_node *node, *next;
+	int i;
+
+	for (i = 0; i < HID_INDEX_BUCKETS; i++) {
+		for (node = index->bucket[i]; node; node = next) {
+			next = node->next;
+			free(node);
+		}
+		index->bucket[i] = NULL;
+	}
+	hid_free_enumeration(index->devices);
+	index->devices = NULL;
+	index->valid = 0;
+}
+
+/* Take over the devices list of a new scan and hash it. */
+static void hid_index_fill(struct hid_index *index, struct hid_device_info *devices)
+{
+	struct hid_device_info *cur;
+	struct hid_index_node *node, **tail;
+
+	index->devices = devices;
+	for (cur = devices; cur; cur = cur->next) {
+		node = malloc(sizeof(*node));
+		if (!node) {
+			/* Leave the index invalid, so the next query scans
+			   again. */
+			return;
+		}
+		node->info = cur;
+		node->strings_read = 0;
+		node->next = NULL;
+
+		/* Append, so each bucket stays in scan order. */
+		tail = &index->bucket[hid_index_hash(cur->vendor_id, cur->product_id)];
+		while (*tail)
+			tail = &(*tail)->next;
+		*tail = node;
+	}
+	index->valid = 1;
+}
+
+/* Drop every device that index->match() says belongs to udev_dev. */
+static void hid_index_remove(struct hid_index *index, struct udev_device *udev_dev)
+{
+	struct hid_device_info **cur, *info;
+	struct hid_index_node **node, *gone;
+
+	cur = &index->devices;
+	while (*cur) {
+		info = *cur;
+		if (!index->match(info, udev_dev)) {
+			cur = &info->next;
+			continue;
+		}
+
+		node = &index->bucket[hid_index_hash(info->vendor_id, info->product_id)];
+		while (*node && (*node)->info != info)
+			node = &(*node)->next;
+		if (*node) {
+			gone = *node;
+			*node = gone->next;
+			free(gone);
+		}
+
+		*cur = info->next;
+		info->next = NULL;
+		hid_free_enumeration(info);
+	}
+}
+
+/* Apply any udev events received since the last query. Called with
+   index->lock held. */
+static void hid_index_poll(struct hid_index *index)
+{
+	struct pollfd fds;
+	struct udev_device *udev_dev;
+	const char *action;
+
+	fds.fd = udev_monitor_get_fd(index->monitor);
+	fds.events = POLLIN;
+	fds.revents = 0;
+	while (poll(&fds, 1, 0) > 0) {
+		udev_dev = udev_monitor_receive_device(index->monitor);
+		if (!udev_dev) {
+			/* An event was lost, so the index can't be trusted */
+			index->valid = 0;
+			break;
+		}
+		action = udev_device_get_action(udev_dev);
+		if (action && strcmp(action, "remove") == 0)
+			hid_index_remove(index, udev_dev);
+		else
+			index->valid = 0;
+		udev_device_unref(udev_dev);
+	}
+}
+
+/* Start watching for devices coming and going. The monitor has to be
+   receiving before the first scan, so that nothing arriving during the
+   scan is missed. Failing is not an error, the index just won't be
+   kept. */
+static void hid_index_monitor(struct hid_index *index)
+{
+	index->udev = udev_new();
+	if (!index->udev)
+		return;
+
+	index->monitor = udev_monitor_new_from_netlink(index->udev, "udev");
+	if (!index->monitor ||
+	    udev_monitor_filter_add_match_subsystem_devtype(index->monitor, index->subsystem, index->devtype) < 0 ||
+	    udev_monitor_enable_receiving(index->monitor) < 0) {
+		if (index->monitor)
+			udev_monitor_unref(index->monitor);
+		index->monitor = NULL;
+		udev_unref(index->udev);
+		index->udev = NULL;
+	}
+}
+
+/* Bring the index up to date, scanning the bus only if it has to.
+   Called with index->lock held. */
+static void hid_index_refresh(struct hid_index *index)
+{
+	if (!index->started) {
+		hid_index_monitor(index);
+		index->started = 1;
+	}
+
+	if (index->monitor)
+		hid_index_poll(index);
+	else
+		index->valid = 0; /* Nothing tells us when the bus changes */
+
+	if (!index->valid) {
+		hid_index_clear(index);
+		hid_index_fill(index, index->scan());
+	}
+}
+
+/* Make sure the strings of node's device are there. Called with
+   index->lock held. */
+static void hid_index_strings(struct hid_index *index, struct hid_index_node *node)
+{
+	if (index->strings && !node->strings_read) {
+		index->strings(node->info);
+		/* Once only, even if the device wouldn't give them */
+		node->strings_read = 1;
+	}
+}
+
+/* The hash node of an indexed device */
+static struct hid_index_node *hid_index_node_of(struct hid_index *index, const struct hid_device_info *info)
+{
+	struct hid_index_node *node;
+
+	node = index->bucket[hid_index_hash(info->vendor_id, info->product_id)];
+	while (node && node->info != info)
+		node = node->next;
+	return node;
+}
+
+static struct hid_device_info *hid_index_copy(const struct hid_device_info *info)
+{
+	struct hid_device_info *copy = malloc(sizeof(*copy));
+	if (!copy)
+		return NULL;
+
+	*copy = *info;
+	copy->next = NULL;
+	copy->path = info->path? strdup(info->path): NULL;
+	copy->serial_number = info->serial_number? wcsdup(info->serial_number): NULL;
+	copy->manufacturer_string = info->manufacturer_string? wcsdup(info->manufacturer_string): NULL;
+	copy->product_string = info->product_string? wcsdup(info->product_string): NULL;
+
+	return copy;
+}
+
+/* Copies of the indexed devices matching vendor_id and product_id, or
+   all of them if both are 0, in scan order. */
+static struct hid_device_info *hid_index_enumerate(struct hid_index *index, unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root = NULL, **tail = &root;
+	struct hid_device_info *cur;
+	struct hid_index_node *node;
+
+	if (vendor_id == 0x0 && product_id == 0x0) {
+		for (cur = index->devices; cur; cur = cur->next) {
+			node = hid_index_node_of(index, cur);
+			if (node)
+				hid_index_strings(index, node);
+			*tail = hid_index_copy(cur);
+			if (*tail)
+				tail = &(*tail)->next;
+		}
+	}
+	else {
+		node = index->bucket[hid_index_hash(vendor_id, product_id)];
+		for (; node; node = node->next) {
+			cur = node->info;
+			if (cur->vendor_id != vendor_id || cur->product_id != product_id)
+				continue;
+			hid_index_strings(index, node);
+			*tail = hid_index_copy(cur);
+			if (*tail)
+				tail = &(*tail)->next;
+		}
+	}
+
+	return root;
+}
+
+/* The path of the first indexed device with this VID/PID and, if
+   serial_number isn't NULL, serial number, or NULL. Free it after use. */
+static char *hid_index_find(struct hid_index *index, unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	struct hid_index_node *node;
+	struct hid_device_info *cur;
+
+	node = index->bucket[hid_index_hash(vendor_id, product_id)];
+	for (; node; node = node->next) {
+		cur = node->info;
+		if (cur->vendor_id != vendor_id || cur->product_id != product_id)
+			continue;
+		if (serial_number) {
+			hid_index_strings(index, node);
+			if (!cur->serial_number || wcscmp(serial_number, cur->serial_number) != 0)
+				continue;
+		}
+		return cur->path? strdup(cur->path): NULL;
+	}
+
+	return NULL;
+}
+
+static void hid_index_free(struct hid_index *index)
+{
+	hid_index_clear(index);
+	if (index->monitor)
+		udev_monitor_unref(index->monitor);
+	index->monitor = NULL;
+	if (index->udev)
+		udev_unref(index->udev);
+	index->udev = NULL;
+	index->started = 0;
+}
@@ -31,6 +31,7 @@
 #include <ctype.h>
 #include <locale.h>
 #include <errno.h>
+#include <limits.h>
 
 /* Unix */
 #include <unistd.h>
@@ -41,12 +42,19 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <wchar.h>
+#include <poll.h>
+#include <sys/syscall.h>
+
+/* Linux */
+#include <linux/futex.h>
 
 /* GNU / LibUSB */
 #include "libusb.h"
 #include "iconv.h"
+#include <libudev.h>
 
 #include "hidapi.h"
+#include "hid-index.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -66,11 +74,86 @@ Linux/libusb HIDAPI programs are encouraged to use the interface number
 instead to differentiate between interfaces on a composite HID device. */
 /*#define INVASIVE_GET_USAGE*/
 
-/* Linked List of input reports received from the device. */
-struct input_report {
-	uint8_t *data;
-	size_t len;
-	struct input_report *next;
+/* Input reports received from the device are queued in a ring of
+   fixed size slots, allocated once in hid_open_path(). Each slot holds
+   one report of up to input_ep_max_packet_size bytes and starts on its
+   own cache line. head and tail count up forever; the slot index is
+   the count masked by the ring size. head, and the counters only
+   read_callback() writes, have a cache line to themselves, and tail
+   and the rest of what readers write have another.
+
+   The ring takes no lock. read_callback() is its only producer (libusb
+   runs one event handler at a time) and the only writer of head;
+   readers take reports by moving tail on with a compare and swap. When
+   the ring is full, read_callback() drops the oldest report the same
+   way, and a reader which was copying it out sees its compare and swap
+   fail and goes on to the next one.
+
+   A reader only sleeps when the ring is empty. It counts itself in
+   waiters and waits on the wake_seq futex; read_callback() bumps
+   wake_seq and makes the system call only if waiters is non-zero.
+
+   hid_read_borrow() takes a report the same way but leaves it in its
+   slot, noting the slot in borrow_pos before moving tail on. Until
+   hid_read_release() clears borrowing, read_callback() counts that
+   slot as still in use: when the ring is full up to it, the new
+   report is dropped rather than the borrowed one. When read_callback()
+   loses the race for the oldest report to a reader, that reader may
+   have just borrowed it, so read_callback() looks at tail and
+   borrow_pos again before it writes the slot. */
+#define INPUT_RING_SLOTS 32 /* Must be a power of two */
+#define INPUT_RING_ALIGN 64 /* Cache line size */
+
+struct input_ring {
+	/* Set up by alloc_input_ring(), only read after that */
+	uint8_t *data;   /* INPUT_RING_SLOTS slots of stride bytes */
+	size_t *len;     /* Length of the report in each slot */
+	size_t stride;   /* Slot size, a multiple of INPUT_RING_ALIGN */
+
+	/* Written by read_callback(), on a cache line of their own so
+	   that readers moving tail don't keep taking it away */
+	unsigned int head __attribute__((aligned(INPUT_RING_ALIGN))); /* Next slot to fill */
+	unsigned long received; /* Counters, reported by hid_get_input_stats() */
+	unsigned long dropped;
+	unsigned int max_queued;
+
+	/* Written by readers */
+	unsigned int tail __attribute__((aligned(INPUT_RING_ALIGN))); /* Next slot to read */
+	unsigned int wake_seq; /* Futex word, bumped to wake readers */
+	unsigned int waiters; /* Readers blocked on an empty ring */
+	unsigned int borrow_pos; /* Slot count of the borrowed report */
+	int borrowing; /* boolean, a report is borrowed */
+};
+
+/* Interrupt IN transfers kept queued on the input endpoint. With more
+   than one, the next transfer is already waiting on the endpoint while
+   read_callback() handles the last one, so a report is never held off
+   for a bInterval because nothing was queued to receive it. */
+#define INPUT_TRANSFERS_DEFAULT 4
+#define INPUT_TRANSFERS_MAX 8
+
+/* Interrupt OUT transfers for hid_write_async(), allocated once when a
+   device with an OUT endpoint is opened. A slot is in use from
+   hid_write_async() until hid_write_wait() has collected its result.
+   A device without one still uses the slots, with no transfer, to keep
+   the results of its control endpoint writes. */
+#define OUTPUT_TRANSFERS 8
+
+struct output_slot {
+	hid_device *dev;
+	struct libusb_transfer *transfer;
+	int token;  /* 0 while the slot is free */
+	int done;   /* boolean */
+	int result; /* Bytes written or -1, once done */
+	int skipped_report_id; /* boolean */
+};
+
+/* A string descriptor of an open device, converted once and kept until
+   hid_close(). */
+struct usb_string {
+	int index;
+	wchar_t *str;
+	struct usb_string *next;
 };
 
 
@@ -82,6 +165,7 @@ struct hid_device_ {
 	int input_endpoint;
 	int output_endpoint;
 	int input_ep_max_packet_size;
+	int output_ep_max_packet_size;
 
 	/* The interface number of the HID */	
 	int interface;
@@ -90,42 +174,215 @@ struct hid_device_ {
 	int manufacturer_index;
 	int product_index;
 	int serial_index;
+
+	/* Language the strings are read in, and the strings read so far.
+	   strings is protected by mutex. */
+	uint16_t string_lang;
+	struct usb_string *strings;
 	
 	/* Whether blocking reads are used */
 	int blocking; /* boolean */
+
+	/* How events are handled for this device, HID_EVENTS_* */
+	int event_mode;
 	
 	/* Read thread objects */
 	pthread_t thread;
-	pthread_mutex_t mutex; /* Protects input_reports */
+	pthread_mutex_t mutex; /* Protects the transfer counts and output_slots */
 	pthread_cond_t condition;
 	pthread_barrier_t barrier; /* Ensures correct startup sequence */
 	int shutdown_thread;
-	struct libusb_transfer *transfer;
 
-	/* List of received input reports. */
-	struct input_report *input_reports;
+	/* Interrupt IN transfers and one block holding all their buffers,
+	   allocated in hid_open_path(). */
+	struct libusb_transfer *transfers[INPUT_TRANSFERS_MAX];
+	int num_transfers;
+	int active_transfers; /* Submitted and not yet finished for good */
+	unsigned char *transfer_buf;
+
+	/* Interrupt OUT transfers for hid_write_async(), and one block
+	   holding all their buffers. Protected by mutex. */
+	struct output_slot output_slots[OUTPUT_TRANSFERS];
+	int num_output_slots;
+	int active_writes; /* Submitted and not yet completed */
+	int next_token;
+	unsigned char *output_buf;
+
+	/* Ring of received input reports. */
+	struct input_ring input_reports;
 };
 
 static int initialized = 0;
+static int input_transfers = INPUT_TRANSFERS_DEFAULT;
+
+/* How devices opened from now on have their events handled, and the
+   event thread shared by all HID_EVENTS_SHARED devices. event_lock
+   protects the thread and its user count. */
+static int event_mode = HID_EVENTS_THREAD;
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t event_thread;
+static int event_users = 0;
+static int event_thread_stop = 0;
+
+/* UTF-16 to wchar_t converter for string descriptors, opened on first
+   use and kept until hid_exit(). string_lock serialises its use. */
+static iconv_t string_iconv = (iconv_t)-1;
+static pthread_mutex_t string_lock = PTHREAD_MUTEX_INITIALIZER;
 
 uint16_t get_usb_code_for_current_locale(void);
-static int return_data(hid_device *dev, unsigned char *data, size_t length);
+static int return_data(hid_device *dev, unsigned char *data, size_t length, const unsigned char **borrowed);
+
+/* Allocate the input report ring for reports of up to max_len bytes. */
+static int alloc_input_ring(struct input_ring *ring, size_t max_len)
+{
+	void *data;
+
+	ring->stride = (max_len + INPUT_RING_ALIGN - 1) & ~(size_t)(INPUT_RING_ALIGN - 1);
+	if (ring->stride == 0)
+		ring->stride = INPUT_RING_ALIGN;
+	if (posix_memalign(&data, INPUT_RING_ALIGN, ring->stride * INPUT_RING_SLOTS) != 0)
+		return -1;
+	ring->data = data;
+	ring->len = calloc(INPUT_RING_SLOTS, sizeof(size_t));
+	if (!ring->len) {
+		free(ring->data);
+		ring->data = NULL;
+		return -1;
+	}
+	ring->head = ring->tail = 0;
+	return 0;
+}
+
+/* Number of reports waiting in the ring */
+static unsigned int input_ring_count(const struct input_ring *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static void futex_wake_all(unsigned int *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, NULL, NULL, 0);
+}
+
+/* Sleep while *addr is val, until deadline on CLOCK_MONOTONIC or for
+   ever if it is NULL. Returns -1 with errno set as futex(2) does. */
+static int futex_wait_until(unsigned int *addr, unsigned int val, const struct timespec *deadline)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+		val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/* Wake any readers blocked in hid_read_timeout(), after a report was
+   queued or input stopped. The fence orders that store against the
+   load of waiters, as hid_read_timeout() orders its increment of
+   waiters against its look at the ring. */
+static void wake_readers(struct input_ring *ring)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->waiters, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&ring->wake_seq, 1, __ATOMIC_SEQ_CST);
+		futex_wake_all(&ring->wake_seq);
+	}
+}
+
+static void read_callback(struct libusb_transfer *transfer);
+
+/* Allocate the interrupt IN transfers and their buffers, one slot of
+   the input ring in size each. */
+static int alloc_input_transfers(hid_device *dev)
+{
+	void *buf;
+	size_t stride = dev->input_reports.stride;
+	int i;
+
+	if (posix_memalign(&buf, INPUT_RING_ALIGN, stride * input_transfers) != 0)
+		return -1;
+	dev->transfer_buf = buf;
+	for (i = 0; i < input_transfers; i++) {
+		dev->transfers[i] = libusb_alloc_transfer(0);
+		if (!dev->transfers[i])
+			return -1;
+		libusb_fill_interrupt_transfer(dev->transfers[i],
+			dev->device_handle,
+			dev->input_endpoint,
+			dev->transfer_buf + i * stride,
+			dev->input_ep_max_packet_size,
+			read_callback,
+			dev,
+			5000/*timeout*/);
+		dev->num_transfers++;
+	}
+	return 0;
+}
+
+static void write_callback(struct libusb_transfer *transfer);
+
+/* Allocate the interrupt OUT transfers for hid_write_async() and their
+   buffers, one output report in size each. */
+static int alloc_output_transfers(hid_device *dev)
+{
+	void *buf;
+	size_t stride;
+	int i;
+
+	stride = (dev->output_ep_max_packet_size + INPUT_RING_ALIGN - 1) & ~(size_t)(INPUT_RING_ALIGN - 1);
+	if (stride == 0)
+		stride = INPUT_RING_ALIGN;
+	if (posix_memalign(&buf, INPUT_RING_ALIGN, stride * OUTPUT_TRANSFERS) != 0)
+		return -1;
+	dev->output_buf = buf;
+	for (i = 0; i < OUTPUT_TRANSFERS; i++) {
+		struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+		if (!transfer)
+			return -1;
+		libusb_fill_interrupt_transfer(transfer,
+			dev->device_handle,
+			dev->output_endpoint,
+			dev->output_buf + i * stride,
+			0,
+			write_callback,
+			&dev->output_slots[i],
+			1000/*timeout millis*/);
+		dev->output_slots[i].dev = dev;
+		dev->output_slots[i].transfer = transfer;
+		dev->num_output_slots++;
+	}
+	return 0;
+}
 
 static hid_device *new_hid_device(void)
 {
-	hid_device *dev = calloc(1, sizeof(hid_device));
+	hid_device *dev;
+
+	/* Aligned for the cache lines of its input ring */
+	if (posix_memalign((void **)&dev, INPUT_RING_ALIGN, sizeof(hid_device)) != 0)
+		return NULL;
+	memset(dev, 0, sizeof(hid_device));
 	dev->device_handle = NULL;
 	dev->input_endpoint = 0;
 	dev->output_endpoint = 0;
 	dev->input_ep_max_packet_size = 0;
+	dev->output_ep_max_packet_size = 0;
 	dev->interface = 0;
 	dev->manufacturer_index = 0;
 	dev->product_index = 0;
 	dev->serial_index = 0;
+	dev->string_lang = 0;
+	dev->strings = NULL;
 	dev->blocking = 1;
+	dev->event_mode = HID_EVENTS_THREAD;
 	dev->shutdown_thread = 0;
-	dev->transfer = NULL;
-	dev->input_reports = NULL;
+	memset(dev->transfers, 0, sizeof(dev->transfers));
+	dev->num_transfers = 0;
+	dev->active_transfers = 0;
+	dev->transfer_buf = NULL;
+	memset(dev->output_slots, 0, sizeof(dev->output_slots));
+	dev->num_output_slots = 0;
+	dev->active_writes = 0;
+	dev->next_token = 1;
+	dev->output_buf = NULL;
+	memset(&dev->input_reports, 0, sizeof(dev->input_reports));
 	
 	pthread_mutex_init(&dev->mutex, NULL);
 	pthread_cond_init(&dev->condition, NULL);
@@ -136,11 +393,33 @@ static hid_device *new_hid_device(void)
 
 static void free_hid_device(hid_device *dev)
 {
+	struct usb_string *s, *next;
+	int i;
+
 	/* Clean up the thread objects */
 	pthread_barrier_destroy(&dev->barrier);
 	pthread_cond_destroy(&dev->condition);
 	pthread_mutex_destroy(&dev->mutex);
 
+	/* Free the transfer objects and their buffers */
+	for (i = 0; i < dev->num_transfers; i++)
+		libusb_free_transfer(dev->transfers[i]);
+	free(dev->transfer_buf);
+	for (i = 0; i < dev->num_output_slots; i++)
+		libusb_free_transfer(dev->output_slots[i].transfer);
+	free(dev->output_buf);
+
+	/* Free the input report ring */
+	free(dev->input_reports.data);
+	free(dev->input_reports.len);
+
+	/* Free the strings read from the device */
+	for (s = dev->strings; s; s = next) {
+		next = s->next;
+		free(s->str);
+		free(s);
+	}
+
 	/* Free the device itself */
 	free(dev);
 }
@@ -256,28 +535,13 @@ static int get_usage(uint8_t *report_descriptor, size_t size,
 #endif // INVASIVE_GET_USAGE
 
 
-/* Get the first language the device says it reports. This comes from
-   USB string #0. */
-static uint16_t get_first_language(libusb_device_handle *dev)
-{
-	uint16_t buf[32];
-	int len;
-	
-	/* Get the string from libusb. */
-	len = libusb_get_string_descriptor(dev,
-			0x0, /* String ID */
-			0x0, /* Language */
-			(unsigned char*)buf,
-			sizeof(buf));
-	if (len < 4)
-		return 0x0;
-	
-	return buf[1]; // First two bytes are len and descriptor type.
-}
-
-static int is_language_supported(libusb_device_handle *dev, uint16_t lang)
+/* The language to read dev's strings in: the one for the current
+   locale if dev has it, otherwise the first one it lists. The language
+   table is only fetched once. */
+static uint16_t get_string_language(libusb_device_handle *dev)
 {
 	uint16_t buf[32];
+	uint16_t lang;
 	int len;
 	int i;
 	
@@ -290,22 +554,22 @@ static int is_language_supported(libusb_device_handle *dev, uint16_t lang)
 	if (len < 4)
 		return 0x0;
 	
-	
+	lang = get_usb_code_for_current_locale();
 	len /= 2; /* language IDs are two-bytes each. */
 	/* Start at index 1 because there are two bytes of protocol data. */
 	for (i = 1; i < len; i++) {
 		if (buf[i] == lang)
-			return 1;
+			return lang;
 	}
 
-	return 0;
+	return buf[1]; // First two bytes are len and descriptor type.
 }
 
 
 /* This function returns a newly allocated wide string containing the USB
-   device string numbered by the index. The returned string must be freed
-   by using free(). */
-static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
+   device string numbered by the index, in language lang. The returned
+   string must be freed by using free(). */
+static wchar_t *get_usb_string(libusb_device_handle *dev, uint16_t lang, uint8_t idx)
 {
 	char buf[512];
 	int len;
@@ -313,19 +577,12 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	wchar_t wbuf[256];
 
 	/* iconv variables */
-	iconv_t ic;
 	size_t inbytes;
 	size_t outbytes;
 	size_t res;
 	char *inptr;
 	char *outptr;
 
-	/* Determine which language to use. */
-	uint16_t lang;
-	lang = get_usb_code_for_current_locale();
-	if (!is_language_supported(dev, lang))
-		lang = get_first_language(dev);
-		
 	/* Get the string from libusb. */
 	len = libusb_get_string_descriptor(dev,
 			idx,
@@ -340,10 +597,17 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	if (len+1 < sizeof(buf))
 		buf[len+1] = '\0';
 	
-	/* Initialize iconv. */
-	ic = iconv_open("UTF-32", "UTF-16");
-	if (ic == (iconv_t)-1)
-		return NULL;
+	pthread_mutex_lock(&string_lock);
+
+	/* Initialize iconv, once. */
+	if (string_iconv == (iconv_t)-1) {
+		string_iconv = iconv_open("UTF-32", "UTF-16");
+		if (string_iconv == (iconv_t)-1)
+			goto err;
+	}
+	/* Back to the initial state, so a byte order mark is written
+	   first as with a new handle. */
+	iconv(string_iconv, NULL, NULL, NULL, NULL);
 	
 	/* Convert to UTF-32 (wchar_t on glibc systems).
 	   Skip the first character (2-bytes). */
@@ -351,7 +615,7 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	inbytes = len-2;
 	outptr = (char*) wbuf;
 	outbytes = sizeof(wbuf);
-	res = iconv(ic, &inptr, &inbytes, &outptr, &outbytes);
+	res = iconv(string_iconv, &inptr, &inbytes, &outptr, &outbytes);
 	if (res == (size_t)-1)
 		goto err;
 
@@ -364,11 +628,48 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	str = wcsdup(wbuf+1);
 
 err:
-	iconv_close(ic);
+	pthread_mutex_unlock(&string_lock);
 	
 	return str;
 }
 
+/* String idx of an open device, from the device the first time and
+   from memory after that. The string stays valid until hid_close(). */
+static const wchar_t *get_cached_string(hid_device *dev, int idx)
+{
+	struct usb_string *s;
+	wchar_t *str;
+
+	pthread_mutex_lock(&dev->mutex);
+	for (s = dev->strings; s; s = s->next) {
+		if (s->index == idx)
+			break;
+	}
+	pthread_mutex_unlock(&dev->mutex);
+	if (s)
+		return s->str;
+
+	/* Not under the mutex, this goes out to the device. Should two
+	   threads get here at once the string is just kept twice. */
+	str = get_usb_string(dev->device_handle, dev->string_lang, idx);
+	if (!str)
+		return NULL;
+	s = malloc(sizeof(*s));
+	if (!s) {
+		free(str);
+		return NULL;
+	}
+	s->index = idx;
+	s->str = str;
+
+	pthread_mutex_lock(&dev->mutex);
+	s->next = dev->strings;
+	dev->strings = s;
+	pthread_mutex_unlock(&dev->mutex);
+
+	return s->str;
+}
+
 static char *make_path(libusb_device *dev, int interface_number)
 {
 	char str[64];
@@ -393,21 +694,18 @@ int HID_API_EXPORT hid_init(void)
 	return 0;
 }
 
-int HID_API_EXPORT hid_exit(void)
-{
-	if (initialized) {
-		libusb_exit(NULL);
-		initialized = 0;
-	}
-
-	return 0;
-}
-
-struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* Walk the USB devices on the bus and list each HID interface. Only
+   what libusb has without opening the device is filled in; the index
+   reads the strings later with read_strings(), for the devices a query
+   returns. This is what hid_enumerate() did before the index; it is now
+   only called to fill the index. */
+static struct hid_device_info *scan_bus(unsigned short vendor_id, unsigned short product_id)
 {
 	libusb_device **devs;
 	libusb_device *dev;
+#ifdef INVASIVE_GET_USAGE
 	libusb_device_handle *handle;
+#endif
 	ssize_t num_devs;
 	int i = 0;
 	
@@ -467,23 +765,10 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 							cur_dev->next = NULL;
 							cur_dev->path = make_path(dev, interface_num);
 							
+#ifdef INVASIVE_GET_USAGE
 							res = libusb_open(dev, &handle);
 
 							if (res >= 0) {
-								/* Serial Number */
-								if (desc.iSerialNumber > 0)
-									cur_dev->serial_number =
-										get_usb_string(handle, desc.iSerialNumber);
-
-								/* Manufacturer and Product strings */
-								if (desc.iManufacturer > 0)
-									cur_dev->manufacturer_string =
-										get_usb_string(handle, desc.iManufacturer);
-								if (desc.iProduct > 0)
-									cur_dev->product_string =
-										get_usb_string(handle, desc.iProduct);
-
-#ifdef INVASIVE_GET_USAGE
 							/*
 							This section is removed because it is too
 							invasive on the system. Getting a Usage Page
@@ -540,10 +825,10 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 									if (res < 0)
 										LOG("Couldn't re-attach kernel driver.\n");
 								}
-#endif /*******************/
 
 								libusb_close(handle);
 							}
+#endif /*******************/
 							/* VID/PID */
 							cur_dev->vendor_id = dev_vid;
 							cur_dev->product_id = dev_pid;
@@ -566,6 +851,115 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	return root;
 }
 
+static struct hid_device_info *scan_all(void)
+{
+	return scan_bus(0x0, 0x0);
+}
+
+/* Open the device behind an indexed interface and read its serial
+   number, manufacturer and product strings into info. */
+static void read_strings(struct hid_device_info *info)
+{
+	libusb_device **devs;
+	libusb_device *dev;
+	libusb_device_handle *handle;
+	struct libusb_device_descriptor desc;
+	char prefix[16];
+	uint16_t lang;
+	int i = 0;
+
+	if (!info->path || libusb_get_device_list(NULL, &devs) < 0)
+		return;
+	while ((dev = devs[i++]) != NULL) {
+		/* The "bus:address:" part of the path */
+		snprintf(prefix, sizeof(prefix), "%04x:%04x:",
+			libusb_get_bus_number(dev),
+			libusb_get_device_address(dev));
+		if (strncmp(info->path, prefix, strlen(prefix)) != 0)
+			continue;
+
+		if (libusb_get_device_descriptor(dev, &desc) < 0 ||
+		    (desc.iSerialNumber == 0 && desc.iManufacturer == 0 && desc.iProduct == 0))
+			break;
+		if (libusb_open(dev, &handle) < 0)
+			break;
+
+		/* One language for all three strings */
+		lang = get_string_language(handle);
+
+		/* Serial Number */
+		if (desc.iSerialNumber > 0)
+			info->serial_number = get_usb_string(handle, lang, desc.iSerialNumber);
+
+		/* Manufacturer and Product strings */
+		if (desc.iManufacturer > 0)
+			info->manufacturer_string = get_usb_string(handle, lang, desc.iManufacturer);
+		if (desc.iProduct > 0)
+			info->product_string = get_usb_string(handle, lang, desc.iProduct);
+
+		libusb_close(handle);
+		break;
+	}
+	libusb_free_device_list(devs, 1);
+}
+
+/* A USB device going away takes every interface path on its bus and
+   address with it. */
+static int match_removed(struct hid_device_info *info, struct udev_device *udev_dev)
+{
+	const char *busnum, *devnum;
+	char prefix[16];
+
+	busnum = udev_device_get_property_value(udev_dev, "BUSNUM");
+	devnum = udev_device_get_property_value(udev_dev, "DEVNUM");
+	if (!busnum || !devnum || !info->path)
+		return 0;
+
+	/* The same "bus:address:" that make_path() starts with */
+	snprintf(prefix, sizeof(prefix), "%04x:%04x:",
+		(unsigned int)strtoul(busnum, NULL, 10),
+		(unsigned int)strtoul(devnum, NULL, 10));
+	return strncmp(info->path, prefix, strlen(prefix)) == 0;
+}
+
+static struct hid_index device_index = {
+	PTHREAD_MUTEX_INITIALIZER, "usb", "usb_device", scan_all, match_removed,
+	read_strings,
+};
+
+int HID_API_EXPORT hid_exit(void)
+{
+	pthread_mutex_lock(&device_index.lock);
+	hid_index_free(&device_index);
+	pthread_mutex_unlock(&device_index.lock);
+
+	pthread_mutex_lock(&string_lock);
+	if (string_iconv != (iconv_t)-1) {
+		iconv_close(string_iconv);
+		string_iconv = (iconv_t)-1;
+	}
+	pthread_mutex_unlock(&string_lock);
+
+	if (initialized) {
+		libusb_exit(NULL);
+		initialized = 0;
+	}
+
+	return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root;
+
+	pthread_mutex_lock(&device_index.lock);
+	hid_index_refresh(&device_index);
+	root = hid_index_enumerate(&device_index, vendor_id, product_id);
+	pthread_mutex_unlock(&device_index.lock);
+
+	return root;
+}
+
 void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 {
 	struct hid_device_info *d = devs;
@@ -582,84 +976,116 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 
 hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, wchar_t *serial_number)
 {
-	struct hid_device_info *devs, *cur_dev;
-	const char *path_to_open = NULL;
+	char *path_to_open;
 	hid_device *handle = NULL;
-	
-	devs = hid_enumerate(vendor_id, product_id);
-	cur_dev = devs;
-	while (cur_dev) {
-		if (cur_dev->vendor_id == vendor_id &&
-		    cur_dev->product_id == product_id) {
-			if (serial_number) {
-				if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
-					path_to_open = cur_dev->path;
-					break;
-				}
-			}
-			else {
-				path_to_open = cur_dev->path;
-				break;
-			}
-		}
-		cur_dev = cur_dev->next;
-	}
+
+	/* Look the device up in the index rather than enumerating. */
+	pthread_mutex_lock(&device_index.lock);
+	hid_index_refresh(&device_index);
+	path_to_open = hid_index_find(&device_index, vendor_id, product_id, serial_number);
+	pthread_mutex_unlock(&device_index.lock);
 
 	if (path_to_open) {
 		/* Open the device */
 		handle = hid_open_path(path_to_open);
 	}
 
-	hid_free_enumeration(devs);
+	free(path_to_open);
 	
 	return handle;
 }
 
+/* A transfer is no longer queued. When the last one goes no more
+   reports can arrive, so wake any threads waiting on data (in
+   hid_read_timeout()) or for the transfers to finish (in hid_close()). */
+static void retire_transfer(hid_device *dev)
+{
+	pthread_mutex_lock(&dev->mutex);
+	if (--dev->active_transfers == 0) {
+		dev->shutdown_thread = 1;
+		pthread_cond_broadcast(&dev->condition);
+	}
+	pthread_mutex_unlock(&dev->mutex);
+	wake_readers(&dev->input_reports);
+}
+
 static void read_callback(struct libusb_transfer *transfer)
 {
 	hid_device *dev = transfer->user_data;
 	
 	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
 
-		struct input_report *rpt = malloc(sizeof(*rpt));
-		rpt->data = malloc(transfer->actual_length);
-		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
-		rpt->len = transfer->actual_length;
-		rpt->next = NULL;
-
-		pthread_mutex_lock(&dev->mutex);
+		struct input_ring *ring = &dev->input_reports;
+		unsigned int head, tail, oldest, slot, queued;
+		size_t len = transfer->actual_length;
+		int keep = 1; /* boolean, the report goes in the ring */
+
+		if (len > ring->stride)
+			len = ring->stride;
+
+		head = ring->head;
+		for (;;) {
+			tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+			/* A borrowed report keeps its slot until it is
+			   released. */
+			oldest = tail;
+			if (__atomic_load_n(&ring->borrowing, __ATOMIC_ACQUIRE)) {
+				unsigned int pos = __atomic_load_n(&ring->borrow_pos, __ATOMIC_RELAXED);
+				if ((int)(tail - pos) > 0)
+					oldest = pos;
+			}
 
-		/* Attach the new report object to the end of the list. */
-		if (dev->input_reports == NULL) {
-			/* The list is empty. Put it at the root. */
-			dev->input_reports = rpt;
-			pthread_cond_signal(&dev->condition);
-		}
-		else {
-			/* Find the end of the list and attach. */
-			struct input_report *cur = dev->input_reports;
-			int num_queued = 0;
-			while (cur->next != NULL) {
-				cur = cur->next;
-				num_queued++;
+			if (head - oldest >= INPUT_RING_SLOTS && oldest != tail) {
+				/* Full up to the borrowed report. It can't
+				   be dropped, so this one is. */
+				keep = 0;
+				break;
 			}
-			cur->next = rpt;
-			
-			/* Pop one off if we've reached 30 in the queue. This
+			if (head - tail < INPUT_RING_SLOTS)
+				break;
+
+			/* Drop the oldest report if the ring is full. This
 			   way we don't grow forever if the user never reads
-			   anything from the device. */
-			if (num_queued > 30) {
-				return_data(dev, NULL, 0);
-			}			
+			   anything from the device, and the caller can see
+			   that it fell behind from the dropped count. If a
+			   reader takes the report first, it may have
+			   borrowed it, so look again before writing its
+			   slot. */
+			if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, 0,
+			                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				ring->dropped++;
+				break;
+			}
 		}
-		pthread_mutex_unlock(&dev->mutex);
+
+		ring->received++;
+		if (keep) {
+			/* Copy the report into the next free slot, then
+			   publish it. */
+			slot = head & (INPUT_RING_SLOTS - 1);
+			memcpy(ring->data + slot * ring->stride, transfer->buffer, len);
+			ring->len[slot] = len;
+			__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+			queued = input_ring_count(ring);
+			if (queued > ring->max_queued)
+				ring->max_queued = queued;
+
+			/* Wake a reader if one is waiting on an empty ring. */
+			wake_readers(ring);
+		}
+		else
+			ring->dropped++;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
 		dev->shutdown_thread = 1;
+		retire_transfer(dev);
 		return;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
 		dev->shutdown_thread = 1;
+		retire_transfer(dev);
 		return;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
@@ -669,32 +1095,76 @@ static void read_callback(struct libusb_transfer *transfer)
 		LOG("Unknown transfer code: %d\n", transfer->status);
 	}
 	
-	/* Re-submit the transfer object. */
-	libusb_submit_transfer(transfer);
+	/* Re-submit the transfer object, unless input is stopping. */
+	if (dev->shutdown_thread || libusb_submit_transfer(transfer) < 0)
+		retire_transfer(dev);
+}
+
+/* Queue every transfer object. Further submissions are made from
+   inside read_callback(). A transfer is counted before it is submitted,
+   since with a shared event thread it may complete straight away. */
+static void start_input(hid_device *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->num_transfers; i++) {
+		pthread_mutex_lock(&dev->mutex);
+		dev->active_transfers++;
+		pthread_mutex_unlock(&dev->mutex);
+		if (libusb_submit_transfer(dev->transfers[i]) < 0)
+			retire_transfer(dev);
+	}
+}
+
+/* Cancel any transfers, input and output, that may be pending. This
+   call will fail for transfers which are not pending, but that's OK. */
+static void cancel_transfers(hid_device *dev)
+{
+	int i;
+
+	dev->shutdown_thread = 1;
+	for (i = 0; i < dev->num_transfers; i++)
+		libusb_cancel_transfer(dev->transfers[i]);
+
+	pthread_mutex_lock(&dev->mutex);
+	for (i = 0; i < dev->num_output_slots; i++) {
+		if (dev->output_slots[i].token && !dev->output_slots[i].done)
+			libusb_cancel_transfer(dev->output_slots[i].transfer);
+	}
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+/* Handle events until every transfer of dev has completed. This may
+   run beside another thread handling events; libusb sorts out which
+   of the two actually does. */
+static void drain_transfers(hid_device *dev)
+{
+	struct timeval tv;
+	int res = 0;
+
+	pthread_mutex_lock(&dev->mutex);
+	while ((dev->active_transfers > 0 || dev->active_writes > 0) && res >= 0) {
+		pthread_mutex_unlock(&dev->mutex);
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000;
+		res = libusb_handle_events_timeout(NULL, &tv);
+		pthread_mutex_lock(&dev->mutex);
+	}
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+static void stop_input(hid_device *dev)
+{
+	cancel_transfers(dev);
+	drain_transfers(dev);
 }
 
 
 static void *read_thread(void *param)
 {
 	hid_device *dev = param;
-	unsigned char *buf;
-	const size_t length = dev->input_ep_max_packet_size;
-
-	/* Set up the transfer object. */
-	buf = malloc(length);
-	dev->transfer = libusb_alloc_transfer(0);
-	libusb_fill_interrupt_transfer(dev->transfer,
-		dev->device_handle,
-		dev->input_endpoint,
-		buf,
-		length,
-		read_callback,
-		dev,
-		5000/*timeout*/);
-	
-	/* Make the first submission. Further submissions are made
-	   from inside read_callback() */
-	libusb_submit_transfer(dev->transfer);
+
+	start_input(dev);
 
 	// Notify the main thread that the read thread is up and running.
 	pthread_barrier_wait(&dev->barrier);
@@ -709,12 +1179,8 @@ static void *read_thread(void *param)
 		}
 	}
 	
-	/* Cancel any transfer that may be pending. This call will fail
-	   if no transfers are pending, but that's OK. */
-	if (libusb_cancel_transfer(dev->transfer) == 0) {
-		/* The transfer was cancelled, so wait for its completion. */
-		libusb_handle_events(NULL);
-	}
+	/* Cancel any transfers that may be pending. */
+	stop_input(dev);
 	
 	/* Now that the read thread is stopping, Wake any threads which are
 	   waiting on data (in hid_read_timeout()). Do this under a mutex to
@@ -724,8 +1190,9 @@ static void *read_thread(void *param)
 	pthread_mutex_lock(&dev->mutex);
 	pthread_cond_broadcast(&dev->condition);
 	pthread_mutex_unlock(&dev->mutex);
+	wake_readers(&dev->input_reports);
 
-	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
+	/* The dev->transfers objects and their buffers are cleaned up
 	   in hid_close(). They are not cleaned up here because this thread
 	   could end either due to a disconnect or due to a user
 	   call to hid_close(). In both cases the objects can be safely
@@ -736,12 +1203,69 @@ static void *read_thread(void *param)
 	return NULL;
 }
 
+/* The event thread shared by every HID_EVENTS_SHARED device. */
+static void *shared_event_thread(void *param)
+{
+	struct timeval tv;
+
+	while (!event_thread_stop) {
+		/* Wake up now and then, in case event_thread_stop was set
+		   while there were no events to handle. */
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if (libusb_handle_events_timeout(NULL, &tv) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static void get_shared_event_thread(void)
+{
+	pthread_mutex_lock(&event_lock);
+	if (event_users++ == 0) {
+		event_thread_stop = 0;
+		pthread_create(&event_thread, NULL, shared_event_thread, NULL);
+	}
+	pthread_mutex_unlock(&event_lock);
+}
+
+/* Stop input on dev, and the shared event thread with it if dev was
+   the last device using it. */
+static void put_shared_event_thread(hid_device *dev)
+{
+	int last;
+
+	pthread_mutex_lock(&event_lock);
+	last = (--event_users == 0);
+	if (last) {
+		/* Set the flag first, so the events from cancelling the
+		   transfers wake the thread up to see it. Whatever it
+		   leaves unhandled is handled here. */
+		event_thread_stop = 1;
+		cancel_transfers(dev);
+		pthread_join(event_thread, NULL);
+		drain_transfers(dev);
+	}
+	else {
+		/* The shared thread completes the cancelled transfers. */
+		cancel_transfers(dev);
+		pthread_mutex_lock(&dev->mutex);
+		while (dev->active_transfers > 0 || dev->active_writes > 0)
+			pthread_cond_wait(&dev->condition, &dev->mutex);
+		pthread_mutex_unlock(&dev->mutex);
+	}
+	pthread_mutex_unlock(&event_lock);
+}
+
 
 hid_device * HID_API_EXPORT hid_open_path(const char *path)
 {
 	hid_device *dev = NULL;
 
 	dev = new_hid_device();
+	if (!dev)
+		return NULL;
 
 	libusb_device **devs;
 	libusb_device *usb_dev;
@@ -810,6 +1334,16 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 						dev->product_index      = desc.iProduct;
 						dev->serial_index       = desc.iSerialNumber;
 
+						/* Read the strings now, so asking for them
+						   later doesn't go out to the device. */
+						dev->string_lang = get_string_language(dev->device_handle);
+						if (desc.iManufacturer > 0)
+							get_cached_string(dev, desc.iManufacturer);
+						if (desc.iProduct > 0)
+							get_cached_string(dev, desc.iProduct);
+						if (desc.iSerialNumber > 0)
+							get_cached_string(dev, desc.iSerialNumber);
+
 						/* Store off the interface number */
 						dev->interface = intf_desc->bInterfaceNumber;
 												
@@ -842,13 +1376,38 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 							    is_interrupt && is_output) {
 								/* Use this endpoint for OUTPUT */
 								dev->output_endpoint = ep->bEndpointAddress;
+								dev->output_ep_max_packet_size = ep->wMaxPacketSize;
 							}
 						}
 						
-						pthread_create(&dev->thread, NULL, read_thread, dev);
-						
-						// Wait here for the read thread to be initialized.
-						pthread_barrier_wait(&dev->barrier);
+						/* Allocate the input report ring and the
+						   transfers now that the report size is
+						   known. */
+						if (alloc_input_ring(&dev->input_reports, dev->input_ep_max_packet_size) < 0 ||
+						    alloc_input_transfers(dev) < 0 ||
+						    (dev->output_endpoint && alloc_output_transfers(dev) < 0)) {
+							LOG("can't allocate input reports\n");
+							free(dev_path);
+							libusb_release_interface(dev->device_handle, dev->interface);
+							libusb_close(dev->device_handle);
+							good_open = 0;
+							break;
+						}
+
+						dev->event_mode = event_mode;
+						if (dev->event_mode == HID_EVENTS_THREAD) {
+							pthread_create(&dev->thread, NULL, read_thread, dev);
+
+							// Wait here for the read thread to be initialized.
+							pthread_barrier_wait(&dev->barrier);
+						}
+						else {
+							/* Events are handled by the shared
+							   thread or by the application. */
+							start_input(dev);
+							if (dev->event_mode == HID_EVENTS_SHARED)
+								get_shared_event_thread();
+						}
 						
 					}
 					free(dev_path);
@@ -923,32 +1482,211 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 	}
 }
 
-/* Helper function, to simplify hid_read().
-   This should be called with dev->mutex locked. */
-static int return_data(hid_device *dev, unsigned char *data, size_t length)
+static void write_callback(struct libusb_transfer *transfer)
 {
-	/* Copy the data out of the linked list item (rpt) into the
-	   return buffer (data), and delete the liked list item. */
-	struct input_report *rpt = dev->input_reports;
-	size_t len = (length < rpt->len)? length: rpt->len;
-	if (len > 0)
-		memcpy(data, rpt->data, len);
-	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
-	return len;
+	struct output_slot *slot = transfer->user_data;
+	hid_device *dev = slot->dev;
+
+	pthread_mutex_lock(&dev->mutex);
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+		slot->result = transfer->actual_length + slot->skipped_report_id;
+	else
+		slot->result = -1;
+	slot->done = 1;
+	dev->active_writes--;
+	pthread_cond_broadcast(&dev->condition);
+	pthread_mutex_unlock(&dev->mutex);
 }
 
-static void cleanup_mutex(void *param)
+int HID_API_EXPORT_CALL hid_write_async(hid_device *dev, const unsigned char *data, size_t length, int milliseconds)
 {
-	hid_device *dev = param;
+	struct output_slot *slot = NULL;
+	struct libusb_transfer *transfer;
+	int skipped_report_id = 0;
+	int i, token, res;
+
+	if (data[0] == 0x0) {
+		data++;
+		length--;
+		skipped_report_id = 1;
+	}
+
+	if (dev->num_output_slots > 0 &&
+	    (length > (size_t)dev->output_ep_max_packet_size || dev->shutdown_thread))
+		return -1;
+
+	pthread_mutex_lock(&dev->mutex);
+	for (i = 0; i < OUTPUT_TRANSFERS; i++) {
+		if (dev->output_slots[i].token == 0) {
+			slot = &dev->output_slots[i];
+			break;
+		}
+	}
+	if (!slot) {
+		/* Every slot is waiting for hid_write_wait(). */
+		pthread_mutex_unlock(&dev->mutex);
+		return -1;
+	}
+	/* Tokens are positive, wrap before next_token++ would overflow */
+	token = dev->next_token;
+	dev->next_token = (token == INT_MAX) ? 1 : token + 1;
+	slot->token = token;
+	slot->done = 0;
+	slot->result = -1;
+	slot->skipped_report_id = skipped_report_id;
+
+	if (dev->num_output_slots == 0) {
+		/* No interrupt out endpoint. Write through the control
+		   endpoint now; the slot only keeps the result until
+		   hid_write_wait() collects it. */
+		pthread_mutex_unlock(&dev->mutex);
+		res = hid_write(dev, data - skipped_report_id, length + skipped_report_id);
+		pthread_mutex_lock(&dev->mutex);
+		slot->result = res;
+		slot->done = 1;
+		pthread_cond_broadcast(&dev->condition);
+		pthread_mutex_unlock(&dev->mutex);
+		return token;
+	}
+
+	dev->active_writes++;
 	pthread_mutex_unlock(&dev->mutex);
+
+	transfer = slot->transfer;
+	memcpy(transfer->buffer, data, length);
+	transfer->length = length;
+	transfer->timeout = (milliseconds < 0)? 0: milliseconds;
+	if (libusb_submit_transfer(transfer) < 0) {
+		pthread_mutex_lock(&dev->mutex);
+		slot->token = 0;
+		dev->active_writes--;
+		pthread_mutex_unlock(&dev->mutex);
+		return -1;
+	}
+
+	return token;
 }
 
+int HID_API_EXPORT_CALL hid_write_wait(hid_device *dev, int token, int milliseconds)
+{
+	struct output_slot *slot = NULL;
+	struct timespec ts;
+	struct timeval tv;
+	int i, res = 0, result;
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+	pthread_mutex_lock(&dev->mutex);
+
+	for (i = 0; i < OUTPUT_TRANSFERS; i++) {
+		if (token > 0 && dev->output_slots[i].token == token) {
+			slot = &dev->output_slots[i];
+			break;
+		}
+	}
+	if (!slot) {
+		pthread_mutex_unlock(&dev->mutex);
+		return -1;
+	}
+
+	if (milliseconds > 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += milliseconds / 1000;
+		ts.tv_nsec += (milliseconds % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+	}
+
+	while (!slot->done && milliseconds != 0 && res == 0) {
+		if (dev->event_mode == HID_EVENTS_EXTERNAL) {
+			/* Nobody else is handling events for us. */
+			pthread_mutex_unlock(&dev->mutex);
+			tv.tv_sec = 0;
+			tv.tv_usec = 10000;
+			libusb_handle_events_timeout(NULL, &tv);
+			pthread_mutex_lock(&dev->mutex);
+			if (milliseconds > 0) {
+				struct timespec now;
+				clock_gettime(CLOCK_REALTIME, &now);
+				if (now.tv_sec > ts.tv_sec ||
+				    (now.tv_sec == ts.tv_sec && now.tv_nsec >= ts.tv_nsec))
+					res = ETIMEDOUT;
+			}
+		}
+		else if (milliseconds > 0) {
+			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
+		}
+		else {
+			res = pthread_cond_wait(&dev->condition, &dev->mutex);
+		}
+	}
+
+	if (!slot->done) {
+		/* Still in flight. The token stays valid, wait again. */
+		pthread_mutex_unlock(&dev->mutex);
+		return (res == 0 || res == ETIMEDOUT)? 0: -1;
+	}
+
+	result = slot->result;
+	slot->token = 0;
+	pthread_mutex_unlock(&dev->mutex);
+
+	return result;
+}
+
+/* Helper function, to simplify hid_read(). Copy the oldest report in
+   the ring into the return buffer (data) and free its slot, or, if
+   borrowed isn't NULL, point it at the slot and lend it out. Returns
+   -1 if the ring is empty. */
+static int return_data(hid_device *dev, unsigned char *data, size_t length, const unsigned char **borrowed)
 {
-	int bytes_read = -1;
+	struct input_ring *ring = &dev->input_reports;
+	unsigned int tail, slot;
+	size_t len;
+
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	for (;;) {
+		if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+			/* A claim left by a failed try below would hold
+			   the ring up. */
+			if (borrowed)
+				__atomic_store_n(&ring->borrowing, 0, __ATOMIC_RELEASE);
+			return -1;
+		}
+		slot = tail & (INPUT_RING_SLOTS - 1);
+		if (borrowed) {
+			/* Claim the slot before taking the report, so that
+			   read_callback() sees it once tail has moved on. */
+			__atomic_store_n(&ring->borrow_pos, tail, __ATOMIC_RELAXED);
+			__atomic_store_n(&ring->borrowing, 1, __ATOMIC_RELEASE);
+		}
+		else {
+			len = (length < ring->len[slot])? length: ring->len[slot];
+			if (len > 0)
+				memcpy(data, ring->data + slot * ring->stride, len);
+		}
+
+		/* If read_callback() dropped this report to make room while
+		   it was being copied, the copy may be torn. The compare and
+		   swap fails then, and the next report is taken instead. */
+		if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, 0,
+		                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			if (borrowed) {
+				*borrowed = ring->data + slot * ring->stride;
+				len = ring->len[slot];
+			}
+			return len;
+		}
+	}
+}
+
+/* hid_read_timeout() and hid_read_borrow() */
+static int read_report(hid_device *dev, unsigned char *data, size_t length, const unsigned char **borrowed, int milliseconds)
+{
+	struct input_ring *ring = &dev->input_reports;
+	struct timespec deadline, *until = NULL;
+	unsigned int seq;
+	int bytes_read;
 
 #if 0
 	int transferred;
@@ -957,85 +1695,90 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	return transferred;
 #endif
 
-	pthread_mutex_lock(&dev->mutex);
-	pthread_cleanup_push(&cleanup_mutex, dev);
+	/* There's an input report queued up. Return it. This takes no
+	   lock and makes no system call. */
+	bytes_read = return_data(dev, data, length, borrowed);
+	if (bytes_read >= 0)
+		return bytes_read;
 
-	/* There's an input report queued up. Return it. */
-	if (dev->input_reports) {
-		/* Return the first one */
-		bytes_read = return_data(dev, data, length);
-		goto ret;
-	}
-	
 	if (dev->shutdown_thread) {
 		/* This means the device has been disconnected.
 		   An error code of -1 should be returned. */
-		bytes_read = -1;
-		goto ret;
+		return -1;
 	}
-	
-	if (milliseconds == -1) {
-		/* Blocking */
-		while (!dev->input_reports && !dev->shutdown_thread) {
-			pthread_cond_wait(&dev->condition, &dev->mutex);
-		}
-		if (dev->input_reports) {
-			bytes_read = return_data(dev, data, length);
+
+	if (milliseconds == 0) {
+		/* Purely non-blocking */
+		return 0;
+	}
+
+	if (milliseconds > 0) {
+		/* Non-blocking, but called with timeout. The deadline is
+		   on the monotonic clock, so setting the time of day
+		   doesn't stretch or cut it short. */
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += milliseconds / 1000;
+		deadline.tv_nsec += (milliseconds % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
 		}
+		until = &deadline;
 	}
-	else if (milliseconds > 0) {
-		/* Non-blocking, but called with timeout. */
-		int res;
-		struct timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
-		ts.tv_sec += milliseconds / 1000;
-		ts.tv_nsec += (milliseconds % 1000) * 1000000;
-		if (ts.tv_nsec >= 1000000000L) {
-			ts.tv_sec++;
-			ts.tv_nsec -= 1000000000L;
+
+	/* Sleep until read_callback() queues a report or input stops.
+	   wake_seq is read before looking at the ring, so a wakeup in
+	   between makes the futex wait return straight away. */
+	__atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (;;) {
+		seq = __atomic_load_n(&ring->wake_seq, __ATOMIC_SEQ_CST);
+		bytes_read = return_data(dev, data, length, borrowed);
+		if (bytes_read >= 0)
+			break;
+		if (dev->shutdown_thread) {
+			bytes_read = -1;
+			break;
 		}
-		
-		while (!dev->input_reports && !dev->shutdown_thread) {
-			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
-			if (res == 0) {
-				if (dev->input_reports) {
-					bytes_read = return_data(dev, data, length);
-					break;
-				}
-				
-				/* If we're here, there was a spurious wake up
-				   or the read thread was shutdown. Run the
-				   loop again (ie: don't break). */
-			}
-			else if (res == ETIMEDOUT) {
+		if (futex_wait_until(&ring->wake_seq, seq, until) < 0) {
+			if (errno == ETIMEDOUT) {
 				/* Timed out. */
 				bytes_read = 0;
 				break;
 			}
-			else {
+			if (errno != EAGAIN && errno != EINTR) {
 				/* Error. */
 				bytes_read = -1;
 				break;
 			}
 		}
 	}
-	else {
-		/* Purely non-blocking */
-		bytes_read = 0;
-	}
-
-ret:
-	pthread_mutex_unlock(&dev->mutex);
-	pthread_cleanup_pop(0);
+	__atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
 
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return read_report(dev, data, length, NULL, milliseconds);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
 }
 
+void HID_API_EXPORT_CALL hid_read_release(hid_device *dev)
+{
+	__atomic_store_n(&dev->input_reports.borrowing, 0, __ATOMIC_RELEASE);
+}
+
+int HID_API_EXPORT_CALL hid_read_borrow(hid_device *dev, const unsigned char **data, int milliseconds)
+{
+	hid_read_release(dev);
+	return read_report(dev, NULL, 0, data, milliseconds);
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -1107,19 +1850,26 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 
 void HID_API_EXPORT hid_close(hid_device *dev)
 {
+	int i;
+
 	if (!dev)
 		return;
 	
-	/* Cause read_thread() to stop. */
-	dev->shutdown_thread = 1;
-	libusb_cancel_transfer(dev->transfer);
+	if (dev->event_mode == HID_EVENTS_THREAD) {
+		/* Cause read_thread() to stop. */
+		dev->shutdown_thread = 1;
+		for (i = 0; i < dev->num_transfers; i++)
+			libusb_cancel_transfer(dev->transfers[i]);
 
-	/* Wait for read_thread() to end. */
-	pthread_join(dev->thread, NULL);
-	
-	/* Clean up the Transfer objects allocated in read_thread(). */
-	free(dev->transfer->buffer);
-	libusb_free_transfer(dev->transfer);
+		/* Wait for read_thread() to end. */
+		pthread_join(dev->thread, NULL);
+	}
+	else if (dev->event_mode == HID_EVENTS_SHARED) {
+		put_shared_event_thread(dev);
+	}
+	else {
+		stop_input(dev);
+	}
 	
 	/* release the interface */
 	libusb_release_interface(dev->device_handle, dev->interface);
@@ -1127,16 +1877,111 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	/* Close the handle */
 	libusb_close(dev->device_handle);
 	
-	/* Clear out the queue of received reports. */
-	pthread_mutex_lock(&dev->mutex);
-	while (dev->input_reports) {
-		return_data(dev, NULL, 0);
-	}
-	pthread_mutex_unlock(&dev->mutex);
-	
+	/* The transfer objects and the ring of received reports are
+	   freed with the device. */
 	free_hid_device(dev);
 }
 
+hid_reactor * HID_API_EXPORT hid_reactor_new(void)
+{
+	/* Use hid_set_event_mode(HID_EVENTS_EXTERNAL) with this backend. */
+	return NULL;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_report_callback callback, void *user_data)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_get_fd(hid_reactor *reactor)
+{
+	return -1;
+}
+
+void HID_API_EXPORT_CALL hid_reactor_free(hid_reactor *reactor)
+{
+}
+
+int HID_API_EXPORT_CALL hid_set_input_transfers(int count)
+{
+	if (count < 1 || count > INPUT_TRANSFERS_MAX)
+		return -1;
+
+	input_transfers = count;
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_set_event_mode(int mode)
+{
+	if (mode != HID_EVENTS_THREAD &&
+	    mode != HID_EVENTS_SHARED &&
+	    mode != HID_EVENTS_EXTERNAL)
+		return -1;
+
+	event_mode = mode;
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_pollfds(struct hid_pollfd *fds, int max)
+{
+	const struct libusb_pollfd **pollfds;
+	int i;
+
+	if (!initialized && hid_init() < 0)
+		return -1;
+
+	pollfds = libusb_get_pollfds(NULL);
+	if (!pollfds)
+		return -1;
+
+	for (i = 0; pollfds[i]; i++) {
+		if (i < max) {
+			fds[i].fd = pollfds[i]->fd;
+			fds[i].events = pollfds[i]->events;
+		}
+	}
+	free(pollfds);
+
+	return i;
+}
+
+int HID_API_EXPORT_CALL hid_handle_events(int milliseconds)
+{
+	struct timeval tv;
+
+	tv.tv_sec = milliseconds / 1000;
+	tv.tv_usec = (milliseconds % 1000) * 1000;
+	if (libusb_handle_events_timeout(NULL, &tv) < 0)
+		return -1;
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_input_stats(hid_device *dev, struct hid_input_stats *stats)
+{
+	struct input_ring *ring = &dev->input_reports;
+
+	/* The counters are only written by read_callback(), so this is
+	   a snapshot, not necessarily a consistent one. */
+	stats->received = __atomic_load_n(&ring->received, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	stats->queued = input_ring_count(ring);
+	stats->max_queued = __atomic_load_n(&ring->max_queued, __ATOMIC_RELAXED);
+	stats->capacity = INPUT_RING_SLOTS;
+
+	return 0;
+}
+
 
 int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
 {
@@ -1155,13 +2000,12 @@ int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *s
 
 int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
 {
-	wchar_t *str;
+	const wchar_t *str;
 
-	str = get_usb_string(dev->device_handle, string_index);
+	str = get_cached_string(dev, string_index);
 	if (str) {
 		wcsncpy(string, str, maxlen);
 		string[maxlen-1] = L'\0';
-		free(str);
 		return 0;
 	}
 	else
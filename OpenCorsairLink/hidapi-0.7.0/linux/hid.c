@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <locale.h>
 #include <errno.h>
+#include <limits.h>
 
 /* Unix */
 #include <unistd.h>
@@ -36,6 +37,8 @@
 #include <sys/utsname.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <pthread.h>
 
 /* Linux */
 #include <linux/hidraw.h>
@@ -43,6 +46,7 @@
 #include <libudev.h>
 
 #include "hidapi.h"
+#include "hid-index.h"
 
 /* Definitions from linux/hidraw.h. Since these are new, some distros
    may not have header files which contain them. */
@@ -53,13 +57,49 @@
 #define HIDIOCGFEATURE(len)    _IOC(_IOC_WRITE|_IOC_READ, 'H', 0x07, len)
 #endif
 
+/* Results of hid_write_async() kept for hid_write_wait(), as many as
+   the libusb backend has writes in flight */
+#define ASYNC_WRITES 8
+
+struct async_write {
+	int token;  /* 0 while the slot is free */
+	int result; /* Bytes written or -1 */
+};
+
 struct hid_device_ {
 	int device_handle;
 	int blocking;
 	int uses_numbered_reports;
+	/* Where hid_read_borrow() reads to, allocated on first use */
+	unsigned char *borrow_buf;
+	/* hid_write_async() results, protected by write_lock */
+	pthread_mutex_t write_lock;
+	struct async_write writes[ASYNC_WRITES];
+	int next_token;
 };
 
 
+/* A device registered with a reactor */
+struct hid_reactor_entry {
+	hid_device *dev;
+	hid_report_callback callback;
+	void *user_data;
+	int removed; /* Removed while the reactor was dispatching */
+	struct hid_reactor_entry *next;
+};
+
+/* Largest report the reactor reads, HID_MAX_BUFFER_SIZE in the kernel */
+#define REACTOR_MAX_REPORT 4096
+/* Ready devices taken from the kernel per epoll_wait() */
+#define REACTOR_MAX_EVENTS 16
+
+struct hid_reactor_ {
+	int epoll_fd;
+	int dispatching; /* boolean */
+	struct hid_reactor_entry *entries;
+	unsigned char buf[REACTOR_MAX_REPORT];
+};
+
 static __u32 kernel_version = 0;
 
 hid_device *new_hid_device()
@@ -68,6 +108,9 @@ hid_device *new_hid_device()
 	dev->device_handle = -1;
 	dev->blocking = 1;
 	dev->uses_numbered_reports = 0;
+	dev->borrow_buf = NULL;
+	pthread_mutex_init(&dev->write_lock, NULL);
+	dev->next_token = 1;
 
 	return dev;
 }
@@ -209,13 +252,9 @@ int HID_API_EXPORT hid_init(void)
 	return 0;
 }
 
-int HID_API_EXPORT hid_exit(void)
-{
-	/* Nothing to do for this in the Linux/hidraw implementation. */
-	return 0;
-}
-
-struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* Walk the hidraw devices on the bus. This is what hid_enumerate()
+   did before the index; it is now only called to fill the index. */
+static struct hid_device_info *scan_bus(unsigned short vendor_id, unsigned short product_id)
 {
 	struct udev *udev;
 	struct udev_enumerate *enumerate;
@@ -351,6 +390,44 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	return root;
 }
 
+static struct hid_device_info *scan_all(void)
+{
+	return scan_bus(0x0, 0x0);
+}
+
+/* A hidraw node going away takes its path with it. */
+static int match_removed(struct hid_device_info *info, struct udev_device *udev_dev)
+{
+	const char *devnode = udev_device_get_devnode(udev_dev);
+
+	return devnode && info->path && strcmp(devnode, info->path) == 0;
+}
+
+static struct hid_index device_index = {
+	PTHREAD_MUTEX_INITIALIZER, "hidraw", NULL, scan_all, match_removed,
+};
+
+int HID_API_EXPORT hid_exit(void)
+{
+	pthread_mutex_lock(&device_index.lock);
+	hid_index_free(&device_index);
+	pthread_mutex_unlock(&device_index.lock);
+
+	return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root;
+
+	pthread_mutex_lock(&device_index.lock);
+	hid_index_refresh(&device_index);
+	root = hid_index_enumerate(&device_index, vendor_id, product_id);
+	pthread_mutex_unlock(&device_index.lock);
+
+	return root;
+}
+
 void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 {
 	struct hid_device_info *d = devs;
@@ -367,35 +444,21 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 
 hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, wchar_t *serial_number)
 {
-	struct hid_device_info *devs, *cur_dev;
-	const char *path_to_open = NULL;
+	char *path_to_open;
 	hid_device *handle = NULL;
-	
-	devs = hid_enumerate(vendor_id, product_id);
-	cur_dev = devs;
-	while (cur_dev) {
-		if (cur_dev->vendor_id == vendor_id &&
-		    cur_dev->product_id == product_id) {
-			if (serial_number) {
-				if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
-					path_to_open = cur_dev->path;
-					break;
-				}
-			}
-			else {
-				path_to_open = cur_dev->path;
-				break;
-			}
-		}
-		cur_dev = cur_dev->next;
-	}
+
+	/* Look the device up in the index rather than enumerating. */
+	pthread_mutex_lock(&device_index.lock);
+	hid_index_refresh(&device_index);
+	path_to_open = hid_index_find(&device_index, vendor_id, product_id, serial_number);
+	pthread_mutex_unlock(&device_index.lock);
 
 	if (path_to_open) {
 		/* Open the device */
 		handle = hid_open_path(path_to_open);
 	}
 
-	hid_free_enumeration(devs);
+	free(path_to_open);
 	
 	return handle;
 }
@@ -511,6 +574,29 @@ int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT_CALL hid_read_borrow(hid_device *dev, const unsigned char **data, int milliseconds)
+{
+	int bytes_read;
+
+	/* read() always copies out of the kernel, so the report is read
+	   into a buffer kept with the device and lent from there. */
+	if (!dev->borrow_buf) {
+		dev->borrow_buf = malloc(REACTOR_MAX_REPORT);
+		if (!dev->borrow_buf)
+			return -1;
+	}
+
+	bytes_read = hid_read_timeout(dev, dev->borrow_buf, REACTOR_MAX_REPORT, milliseconds);
+	if (bytes_read > 0)
+		*data = dev->borrow_buf;
+	return bytes_read;
+}
+
+void HID_API_EXPORT_CALL hid_read_release(hid_device *dev)
+{
+	/* Nothing to give back, the buffer is reused by the next read. */
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	int flags, res;
@@ -564,6 +650,8 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	if (!dev)
 		return;
 	close(dev->device_handle);
+	free(dev->borrow_buf);
+	pthread_mutex_destroy(&dev->write_lock);
 	free(dev);
 }
 
@@ -589,7 +677,225 @@ int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index
 }
 
 
-HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
+int HID_API_EXPORT_CALL hid_write_async(hid_device *dev, const unsigned char *data, size_t length, int milliseconds)
+{
+	struct async_write *w = NULL;
+	int i, token, res;
+
+	/* hidraw has no asynchronous write, so write now and keep the
+	   result under a token, the same as the libusb backend does for
+	   a device without an interrupt out endpoint. */
+	pthread_mutex_lock(&dev->write_lock);
+	for (i = 0; i < ASYNC_WRITES; i++) {
+		if (dev->writes[i].token == 0) {
+			w = &dev->writes[i];
+			break;
+		}
+	}
+	if (!w) {
+		/* Every slot is waiting for hid_write_wait(). */
+		pthread_mutex_unlock(&dev->write_lock);
+		return -1;
+	}
+	/* Tokens are positive, wrap before next_token++ would overflow */
+	token = dev->next_token;
+	dev->next_token = (token == INT_MAX) ? 1 : token + 1;
+	w->token = token;
+	w->result = -1;
+	pthread_mutex_unlock(&dev->write_lock);
+
+	res = hid_write(dev, data, length);
+	pthread_mutex_lock(&dev->write_lock);
+	w->result = res;
+	pthread_mutex_unlock(&dev->write_lock);
+	return token;
+}
+
+int HID_API_EXPORT_CALL hid_write_wait(hid_device *dev, int token, int milliseconds)
+{
+	int i, result = -1;
+
+	/* The write finished in hid_write_async() */
+	pthread_mutex_lock(&dev->write_lock);
+	for (i = 0; i < ASYNC_WRITES; i++) {
+		if (token > 0 && dev->writes[i].token == token) {
+			result = dev->writes[i].result;
+			dev->writes[i].token = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dev->write_lock);
+
+	return result;
+}
+
+hid_reactor * HID_API_EXPORT hid_reactor_new(void)
+{
+	hid_reactor *reactor = calloc(1, sizeof(hid_reactor));
+	if (!reactor)
+		return NULL;
+
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor->epoll_fd < 0) {
+		free(reactor);
+		return NULL;
+	}
+
+	return reactor;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_report_callback callback, void *user_data)
+{
+	struct hid_reactor_entry *entry;
+	struct epoll_event ev;
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return -1;
+	entry->dev = dev;
+	entry->callback = callback;
+	entry->user_data = user_data;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = entry;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, dev->device_handle, &ev) < 0) {
+		free(entry);
+		return -1;
+	}
+
+	entry->next = reactor->entries;
+	reactor->entries = entry;
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev)
+{
+	struct hid_reactor_entry **cur, *entry;
+
+	for (cur = &reactor->entries; *cur; cur = &(*cur)->next) {
+		entry = *cur;
+		if (entry->dev != dev || entry->removed)
+			continue;
+
+		epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, dev->device_handle, NULL);
+		if (reactor->dispatching) {
+			/* Events already taken may still point at it. It is
+			   freed once hid_reactor_run() is done with them. */
+			entry->removed = 1;
+		}
+		else {
+			*cur = entry->next;
+			free(entry);
+		}
+		return 0;
+	}
+
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds)
+{
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	struct hid_reactor_entry **cur, *entry;
+	int num_events, i, res;
+	int dispatched = 0;
+
+	do {
+		num_events = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, milliseconds);
+	} while (num_events < 0 && errno == EINTR);
+	if (num_events < 0)
+		return -1;
+
+	reactor->dispatching = 1;
+	for (i = 0; i < num_events; i++) {
+		entry = events[i].data.ptr;
+		if (entry->removed)
+			continue;
+
+		/* The device is readable, so this read won't block. One
+		   report is read per wakeup; if more are queued, the fd
+		   is still readable on the next call. */
+		res = hid_read_timeout(entry->dev, reactor->buf, sizeof(reactor->buf), 0);
+		if (res > 0) {
+			entry->callback(entry->dev, reactor->buf, res, entry->user_data);
+			dispatched++;
+		}
+		else if (res < 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+			/* The device is gone. Tell the caller with an
+			   empty report, and stop watching it. */
+			entry->callback(entry->dev, NULL, 0, entry->user_data);
+			if (!entry->removed)
+				hid_reactor_remove(reactor, entry->dev);
+		}
+	}
+	reactor->dispatching = 0;
+
+	/* Free the entries removed while dispatching. */
+	cur = &reactor->entries;
+	while (*cur) {
+		entry = *cur;
+		if (entry->removed) {
+			*cur = entry->next;
+			free(entry);
+		}
+		else {
+			cur = &entry->next;
+		}
+	}
+
+	return dispatched;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_get_fd(hid_reactor *reactor)
+{
+	return reactor->epoll_fd;
+}
+
+void HID_API_EXPORT_CALL hid_reactor_free(hid_reactor *reactor)
+{
+	struct hid_reactor_entry *entry, *next;
+
+	if (!reactor)
+		return;
+
+	for (entry = reactor->entries; entry; entry = next) {
+		next = entry->next;
+		free(entry);
+	}
+	close(reactor->epoll_fd);
+	free(reactor);
+}
+
+int HID_API_EXPORT_CALL hid_set_input_transfers(int count)
+{
+	/* The kernel queues the transfers for hidraw devices. */
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_set_event_mode(int mode)
+{
+	/* Reads poll the hidraw device directly, there is no event thread. */
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_get_pollfds(struct hid_pollfd *fds, int max)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_handle_events(int milliseconds)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_get_input_stats(hid_device *dev, struct hid_input_stats *stats)
+{
+	/* The kernel queues input reports and does not report drops. */
+	return -1;
+}
+
+HID_API_EXPORT const char * HID_API_CALL hid_error(hid_device *dev)
 {
 	return strerror(errno);
 }
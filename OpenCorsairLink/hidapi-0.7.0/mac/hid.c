@@ -1039,6 +1039,85 @@ int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index
 }
 
 
+int HID_API_EXPORT_CALL hid_write_async(hid_device *dev, const unsigned char *data, size_t length, int milliseconds)
+{
+	/* Not implemented on this platform yet. */
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_write_wait(hid_device *dev, int token, int milliseconds)
+{
+	return -1;
+}
+
+hid_reactor * HID_API_EXPORT hid_reactor_new(void)
+{
+	/* Not implemented on this platform yet. */
+	return NULL;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_report_callback callback, void *user_data)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_reactor_get_fd(hid_reactor *reactor)
+{
+	return -1;
+}
+
+void HID_API_EXPORT_CALL hid_reactor_free(hid_reactor *reactor)
+{
+}
+
+int HID_API_EXPORT_CALL hid_set_input_transfers(int count)
+{
+	/* Not implemented on this platform yet. */
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_set_event_mode(int mode)
+{
+	/* Not implemented on this platform yet. */
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_get_pollfds(struct hid_pollfd *fds, int max)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_handle_events(int milliseconds)
+{
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_get_input_stats(hid_device *dev, struct hid_input_stats *stats)
+{
+	/* Not implemented on this platform yet. */
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_read_borrow(hid_device *dev, const unsigned char **data, int milliseconds)
+{
+	/* Not implemented on this platform yet. */
+	return -1;
+}
+
+void HID_API_EXPORT_CALL hid_read_release(hid_device *dev)
+{
+}
+
 HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 {
 	// TODO:
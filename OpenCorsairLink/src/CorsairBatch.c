@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairFrame.h"
+#include "CorsairPipe.h"
+#include "CorsairBatch.h"
+
+/*
+ * Command IDs go out as one byte and 0 would make a badly formed
+ * message, so wrap the same way the kernel drivers do. IDs that may
+ * still get a reply are skipped.
+ */
+static unsigned char next_cmd_id(CorsairLink_t *cl)
+{
+	int tries;
+
+	for (tries = 0; tries < 0xff - 0x81; tries++) {
+		if (cl->CommandId >= 0xff || cl->CommandId < 0x81)
+			cl->CommandId = 0x81;
+		if (!CorsairPipe_id_busy(cl, cl->CommandId))
+			break;
+		cl->CommandId++;
+	}
+	return cl->CommandId++;
+}
+
+void CorsairBatch_init(CorsairBatch_t *b, CorsairLink_t *cl, int interface)
+{
+	b->cl = cl;
+	b->interface = interface;
+	b->nops = 0;
+	b->group = 0;
+	b->reports = 0;
+}
+
+/*
+ * Start a new group. Everything queued until the next call is sent in
+ * the same report, e.g. a FAN_Select and the reads that depend on it.
+ */
+void CorsairBatch_group(CorsairBatch_t *b)
+{
+	b->group++;
+}
+
+static int queue_op(CorsairBatch_t *b, int opcode, int reg, unsigned int value)
+{
+	CorsairOp_t *op;
+
+	if (b->nops >= CL_BATCH_MAX_OPS) {
+		fprintf(stderr, "Batch: too many operations queued\n");
+		return -1;
+	}
+	op = &b->ops[b->nops];
+	op->opcode = opcode;
+	op->reg = reg;
+	op->data[0] = value & 0xff;
+	op->data[1] = (value >> 8) & 0xff;
+	op->data[2] = (value >> 16) & 0xff;
+	op->cmdId = 0;
+	op->group = b->group;
+	op->done = 0;
+	op->value = 0;
+	return b->nops++;
+}
+
+/*
+ * Queue a register read, returns the op index to fetch the value with.
+ */
+int CorsairBatch_read(CorsairBatch_t *b, int opcode, int reg)
+{
+	return queue_op(b, opcode, reg, 0);
+}
+
+/*
+ * Queue a register write, returns the op index.
+ */
+int CorsairBatch_write(CorsairBatch_t *b, int opcode, int reg, unsigned int value)
+{
+	return queue_op(b, opcode, reg, value);
+}
+
+/*
+ * Queue a read of a whole H80i register, the opcode coming from its
+ * width. Returns the op index, or -1 for registers too wide to read.
+ */
+int CorsairBatch_readReg(CorsairBatch_t *b, int reg)
+{
+	int opcode = CorsairFrame_opcode(reg, 0);
+
+	if (opcode < 0) {
+		fprintf(stderr, "Batch: register %02x cannot be read in one op\n", reg);
+		return -1;
+	}
+	return queue_op(b, opcode, reg, 0);
+}
+
+int CorsairBatch_writeReg(CorsairBatch_t *b, int reg, unsigned int value)
+{
+	int opcode = CorsairFrame_opcode(reg, 1);
+
+	if (opcode < 0) {
+		fprintf(stderr, "Batch: register %02x cannot be written in one op\n", reg);
+		return -1;
+	}
+	return queue_op(b, opcode, reg, value);
+}
+
+/*
+ * Work out how many ops starting at first fit in one report, never
+ * splitting a group. Returns 0 if a single group is too big.
+ */
+static int pack_report(CorsairBatch_t *b, int first)
+{
+	int req = 0, rep = 0;
+	int i, end, greq, grep;
+
+	if (b->interface == CLINK)
+		return 1;
+
+	i = first;
+	while (i < b->nops) {
+		greq = 0;
+		grep = 0;
+		end = i;
+		while (end < b->nops && b->ops[end].group == b->ops[i].group) {
+			greq += CL_OP_SIZE(b->ops[end].opcode)->request;
+			grep += CL_OP_SIZE(b->ops[end].opcode)->reply;
+			end++;
+		}
+		if (req + greq > H80I_MAX_REQUEST || rep + grep > H80I_MAX_REPLY)
+			break;
+		req += greq;
+		rep += grep;
+		i = end;
+	}
+	return i - first;
+}
+
+/*
+ * Hand each op of a report its part of the reply.
+ */
+static void report_done(CorsairXfer_t *x, int status, const unsigned char *buf, int res)
+{
+	CorsairReport_t *r = x->ctx;
+	CorsairOp_t *ops = &r->batch->ops[r->first];
+	int n;
+
+	r->status = 1;
+	if (status != CL_XFER_OK) {
+		if (status == CL_XFER_TIMEOUT)
+			fprintf(stderr, "Batch: no reply for command %02x\n", x->cmdId);
+		return;
+	}
+
+	n = CorsairFrame_decode(buf, res, ops, r->count);
+	if (n < r->count) {
+		fprintf(stderr, "Batch: reply for command %02x missing\n", ops[n].cmdId);
+		return;
+	}
+	r->status = 0;
+}
+
+/*
+ * Build the frame for ops [first, first + count) and send it.
+ */
+static void send_report(CorsairBatch_t *b, CorsairReport_t *r, int first, int count)
+{
+	CorsairLink_t *cl = b->cl;
+	int i;
+
+	for (i = first; i < first + count; i++)
+		b->ops[i].cmdId = next_cmd_id(cl);
+
+	r->batch = b;
+	r->first = first;
+	r->count = count;
+	r->status = 1;
+	r->xfer.req_len = CorsairFrame_encode(r->xfer.req, b->interface, &b->ops[first], count);
+	r->xfer.done = report_done;
+	r->xfer.ctx = r;
+	b->reports++;
+
+	if (r->xfer.req_len < 0) {
+		fprintf(stderr, "Batch: unable to encode command %02x\n", b->ops[first].cmdId);
+		return;
+	}
+	CorsairPipe_submit(cl, &r->xfer);
+}
+
+/*
+ * Send everything queued using as few reports as possible.
+ * Returns 0 when every op got its reply.
+ */
+int CorsairBatch_run(CorsairBatch_t *b)
+{
+	int first = 0;
+	int count;
+	int err = 0;
+	int i;
+
+	b->reports = 0;
+	while (first < b->nops) {
+		count = pack_report(b, first);
+		if (count == 0) {
+			fprintf(stderr, "Batch: operation group does not fit in a report\n");
+			err = 1;
+			break;
+		}
+		send_report(b, &b->report[b->reports], first, count);
+		first += count;
+	}
+	CorsairPipe_drain(b->cl);
+
+	for (i = 0; i < b->reports; i++) {
+		if (b->report[i].status)
+			err = 1;
+	}
+	return err;
+}
+
+int CorsairBatch_done(CorsairBatch_t *b, int op)
+{
+	if (op < 0 || op >= b->nops)
+		return 0;
+	return b->ops[op].done;
+}
+
+unsigned int CorsairBatch_value(CorsairBatch_t *b, int op)
+{
+	if (op < 0 || op >= b->nops)
+		return 0;
+	return b->ops[op].value;
+}
@@ -0,0 +1,58 @@
+
+/*
+ * Request batching for the CorsairLink protocol.
+ *
+ * A H80i/H100i report can carry several <cmdId><opcode><reg>[data]
+ * requests and the reply carries one <cmdId><opcode>[data] answer for
+ * each of them, in order. Operations are queued here, packed into as
+ * few reports as will hold them, and the answers are handed back to
+ * each operation by command ID.
+ *
+ * The Cooling Node only takes one request per report, so there every
+ * operation costs a report of its own.
+ *
+ * Reports go out through CorsairPipe, so with a window above one the
+ * next report is sent before the previous reply is in.
+ */
+
+/* Most payload bytes (after the length byte) in one H80i request */
+#define H80I_MAX_REQUEST	16
+/* Most bytes in one H80i reply */
+#define H80I_MAX_REPLY		16
+
+#define CL_BATCH_MAX_OPS	64
+
+struct CorsairBatch;
+
+/* One report worth of ops */
+struct CorsairReport {
+	CorsairXfer_t		xfer;
+	struct CorsairBatch	*batch;
+	int			first;		/* First op carried */
+	int			count;
+	int			status;		/* 0 once every op got its reply */
+};
+
+typedef struct CorsairReport CorsairReport_t;
+
+struct CorsairBatch {
+	CorsairLink_t	*cl;
+	int		interface;
+	int		nops;
+	int		group;		/* Group new ops are added to */
+	int		reports;	/* Reports sent by the last run */
+	CorsairOp_t	ops[CL_BATCH_MAX_OPS];
+	CorsairReport_t	report[CL_BATCH_MAX_OPS];
+};
+
+typedef struct CorsairBatch CorsairBatch_t;
+
+void CorsairBatch_init(CorsairBatch_t *, CorsairLink_t *, int);
+void CorsairBatch_group(CorsairBatch_t *);
+int CorsairBatch_read(CorsairBatch_t *, int, int);
+int CorsairBatch_write(CorsairBatch_t *, int, int, unsigned int);
+int CorsairBatch_readReg(CorsairBatch_t *, int);
+int CorsairBatch_writeReg(CorsairBatch_t *, int, unsigned int);
+int CorsairBatch_run(CorsairBatch_t *);
+int CorsairBatch_done(CorsairBatch_t *, int);
+unsigned int CorsairBatch_value(CorsairBatch_t *, int);
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairDaemon.h"
+#include "corsairlink_temp.h"
+
+#define SNAPSHOT_MAX	2048
+#define LINE_MAX_LEN	128
+/* Answers a client may leave unread before it is dropped */
+#define CLIENT_OUT_MAX	(4 * SNAPSHOT_MAX)
+
+/*
+ * Latest readings, kept pre-formatted so answering GET is one write
+ */
+struct Snapshot {
+	unsigned long long	sampled_us;	/* Ctime_us() of the sample */
+	unsigned long long	wall_ms;	/* Wall clock of the sample */
+	int			len;		/* 0 until a sample has worked */
+	char			text[SNAPSHOT_MAX];
+};
+
+/*
+ * Client sockets are non-blocking: answers queue in out and go as the
+ * client reads them, so one slow client never holds up sampling.
+ */
+struct Client {
+	int	fd;
+	int	len;
+	char	line[LINE_MAX_LEN];
+	int	out_len;
+	char	out[CLIENT_OUT_MAX];
+};
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_signal(int sig)
+{
+	daemon_stop = 1;
+}
+
+/*
+ * Read every fan and sensor and format the result for clients. A sweep
+ * that fails leaves the last good snapshot, and its age, as they were.
+ * Returns 0 if the snapshot was replaced.
+ */
+static int take_sample(CorsairLink_t *cl, int interface, int num_temps, struct Snapshot *snap)
+{
+	unsigned short temps[NUMTEMPS];
+	unsigned int milli;
+	int len = 0;
+	int i;
+
+	memset(temps, 0x00, sizeof(temps));
+	if (ReadAllInfo(cl, interface, temps, num_temps))
+		return -1;
+	snap->sampled_us = Ctime_us();
+	snap->wall_ms = Cwalltime_ms();
+
+	for (i = 0; i < num_temps; i++) {
+		milli = corsairlink_temp_milli(temps[i]);
+		len += snprintf(&snap->text[len], SNAPSHOT_MAX - len, "TEMP %d %u\n",
+				i + 1, milli);
+	}
+	for (i = 0; i < NUMFANS; i++) {
+		len += snprintf(&snap->text[len], SNAPSHOT_MAX - len, "FAN %d %02x %d %d %s\n",
+				i + 1, cl->fans[i].Mode, cl->fans[i].RPM,
+				cl->fans[i].maxRPM, cl->fans[i].Name);
+	}
+	snap->len = len;
+	return 0;
+}
+
+static int send_all(int fd, const char *buf, int len)
+{
+	int res;
+
+	while (len > 0) {
+		res = send(fd, buf, len, MSG_NOSIGNAL);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += res;
+		len -= res;
+	}
+	return 0;
+}
+
+/*
+ * Queue len bytes for the client. Returns -1 if it has left so much
+ * unread that it should be dropped.
+ */
+static int client_queue(struct Client *c, const char *buf, int len)
+{
+	if (len > CLIENT_OUT_MAX - c->out_len)
+		return -1;
+	memcpy(&c->out[c->out_len], buf, len);
+	c->out_len += len;
+	return 0;
+}
+
+static int client_puts(struct Client *c, const char *str)
+{
+	return client_queue(c, str, strlen(str));
+}
+
+/*
+ * Send as much of what is queued as the socket takes without blocking.
+ * Returns -1 if the client has gone.
+ */
+static int client_flush(struct Client *c)
+{
+	int res;
+
+	while (c->out_len > 0) {
+		res = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		c->out_len -= res;
+		memmove(c->out, &c->out[res], c->out_len);
+	}
+	return 0;
+}
+
+static int send_snapshot(struct Client *c, struct Snapshot *snap)
+{
+	char head[LINE_MAX_LEN];
+	int len;
+
+	if (snap->len == 0)
+		return client_puts(c, "ERR no reading yet\n");
+	len = snprintf(head, sizeof(head), "TIME %llu %llu\n", snap->wall_ms,
+		       (Ctime_us() - snap->sampled_us) / 1000);
+	if (client_queue(c, head, len) || client_queue(c, snap->text, snap->len))
+		return -1;
+	return client_puts(c, "OK\n");
+}
+
+/*
+ * SET <fan> <mode> [rpm]
+ */
+static int handle_set(CorsairLink_t *cl, int interface, struct Client *c, char *args)
+{
+	CorsairFanInfo_t fanInfo;
+	int fan = 0, mode = 0, rpm = 0;
+	int n;
+
+	n = sscanf(args, "%d %d %d", &fan, &mode, &rpm);
+	if (n < 2 || fan < 1 || fan > NUMFANS) {
+		return client_puts(c, "ERR usage: SET <fan> <mode> [rpm]\n");
+	}
+	if (mode == FixedRPM && rpm <= 0) {
+		return client_puts(c, "ERR fixed RPM mode needs an RPM\n");
+	}
+
+	memset(&fanInfo, 0x00, sizeof(fanInfo));
+	fanInfo.Mode = mode;
+	fanInfo.RPM = rpm;
+	if (SetFansInfo(cl, interface, fan - 1, &fanInfo))
+		return client_puts(c, "ERR device refused setting\n");
+	return client_puts(c, "OK\n");
+}
+
+/*
+ * Run one request line, returns -1 when the client should be dropped
+ * and 1 when the snapshot needs refreshing.
+ */
+static int handle_line(CorsairLink_t *cl, int interface, struct Client *c, struct Snapshot *snap)
+{
+	char *line = c->line;
+
+	if (!strcmp(line, "GET"))
+		return send_snapshot(c, snap);
+	if (!strncmp(line, "SET ", 4)) {
+		if (handle_set(cl, interface, c, line + 4))
+			return -1;
+		return 1;
+	}
+	if (!strcmp(line, "QUIT"))
+		return -1;
+	return client_puts(c, "ERR unknown request\n");
+}
+
+/*
+ * Pull whatever the client sent and run each complete line
+ */
+static int service_client(CorsairLink_t *cl, int interface, struct Client *c,
+			  struct Snapshot *snap, int *resample)
+{
+	char buf[LINE_MAX_LEN];
+	int res, i, r;
+
+	res = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 0;
+	if (res <= 0)
+		return -1;
+
+	for (i = 0; i < res; i++) {
+		if (buf[i] == '\r')
+			continue;
+		if (buf[i] != '\n') {
+			if (c->len >= LINE_MAX_LEN - 1)
+				return -1;
+			c->line[c->len++] = buf[i];
+			continue;
+		}
+		c->line[c->len] = '\0';
+		c->len = 0;
+		r = handle_line(cl, interface, c, snap);
+		if (r < 0)
+			return -1;
+		if (r > 0)
+			*resample = 1;
+	}
+	return client_flush(c);
+}
+
+static int open_listener(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to create socket: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&addr, 0x00, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Sample the device every interval ms and answer clients on path until
+ * SIGINT/SIGTERM. Runs in the foreground.
+ */
+int CorsairDaemon_run(CorsairLink_t *cl, int interface, const char *path, int interval)
+{
+	struct pollfd pfd[CL_DAEMON_MAX_CLIENTS + 1];
+	struct Client clients[CL_DAEMON_MAX_CLIENTS];
+	struct Snapshot snap;
+	unsigned long long next_us, now;
+	int num_temps;
+	int listen_fd;
+	int nclients = 0;
+	int resample;
+	int timeout;
+	int i, fd;
+
+	listen_fd = open_listener(path);
+	if (listen_fd < 0)
+		return 1;
+
+	signal(SIGINT, daemon_signal);
+	signal(SIGTERM, daemon_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	num_temps = ConnectedTemps(cl, interface);
+	if (num_temps > NUMTEMPS)
+		num_temps = NUMTEMPS;
+
+	memset(&snap, 0x00, sizeof(snap));
+	take_sample(cl, interface, num_temps, &snap);
+	next_us = Ctime_us() + interval * 1000ULL;
+
+	while (!daemon_stop) {
+		now = Ctime_us();
+		if (now >= next_us) {
+			take_sample(cl, interface, num_temps, &snap);
+			/* Keep to the schedule, but never try to catch up */
+			now = Ctime_us();
+			next_us += interval * 1000ULL;
+			if (next_us <= now)
+				next_us = now + interval * 1000ULL;
+			continue;
+		}
+		timeout = (int)((next_us - now + 999) / 1000);
+
+		pfd[0].fd = listen_fd;
+		pfd[0].events = POLLIN;
+		for (i = 0; i < nclients; i++) {
+			pfd[i + 1].fd = clients[i].fd;
+			pfd[i + 1].events = POLLIN;
+			if (clients[i].out_len > 0)
+				pfd[i + 1].events |= POLLOUT;
+		}
+		if (poll(pfd, nclients + 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			break;
+		}
+
+		resample = 0;
+		for (i = nclients - 1; i >= 0; i--) {
+			if (!pfd[i + 1].revents)
+				continue;
+			if (((pfd[i + 1].revents & POLLOUT) && client_flush(&clients[i])) ||
+			    ((pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+			     service_client(cl, interface, &clients[i], &snap, &resample))) {
+				close(clients[i].fd);
+				clients[i] = clients[--nclients];
+			}
+		}
+		if (resample)
+			next_us = 0;
+
+		if (pfd[0].revents & POLLIN) {
+			fd = accept(listen_fd, NULL, NULL);
+			if (fd >= 0) {
+				if (nclients < CL_DAEMON_MAX_CLIENTS &&
+				    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0) {
+					clients[nclients].fd = fd;
+					clients[nclients].len = 0;
+					clients[nclients].out_len = 0;
+					nclients++;
+				} else {
+					close(fd);
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < nclients; i++)
+		close(clients[i].fd);
+	close(listen_fd);
+	unlink(path);
+	return 0;
+}
+
+/*
+ * Client side: send one request to a running daemon and copy the
+ * answer to stdout. Returns 0 if the daemon said OK.
+ */
+int CorsairDaemon_query(const char *path, const char *request)
+{
+	struct sockaddr_un addr;
+	char buf[SNAPSHOT_MAX];
+	int total = 0;
+	int fd, res;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return 1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to create socket: %s\n", strerror(errno));
+		return 1;
+	}
+	memset(&addr, 0x00, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Unable to reach daemon on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	if (send_all(fd, request, strlen(request)) || send_all(fd, "\n", 1)) {
+		close(fd);
+		return 1;
+	}
+
+	/* Every answer ends in an OK or ERR line */
+	while (total < (int)sizeof(buf) - 1) {
+		res = recv(fd, &buf[total], sizeof(buf) - 1 - total, 0);
+		if (res <= 0)
+			break;
+		total += res;
+		buf[total] = '\0';
+		if (total >= 3 && buf[total - 1] == '\n' &&
+		    (!strncmp(&buf[total - 3], "OK\n", 3) || strstr(buf, "ERR ")))
+			break;
+	}
+	close(fd);
+	buf[total] = '\0';
+	fputs(buf, stdout);
+
+	return strncmp(buf, "ERR", 3) == 0 || strstr(buf, "\nERR") || total == 0;
+}
@@ -0,0 +1,25 @@
+
+/*
+ * Daemon mode: keep the device open, sample it on a schedule and serve
+ * the latest readings over a Unix socket, so clients never touch USB.
+ *
+ * Line protocol, one request per line:
+ *	GET			-> the last snapshot, then "OK"
+ *	SET <fan> <mode> [rpm]	-> "OK" or "ERR <reason>"
+ *	QUIT			-> connection closed
+ * A snapshot is:
+ *	TIME <ms since epoch> <ms since sampled>
+ *	TEMP <sensor> <millidegrees C>
+ *	FAN <fan> <mode> <rpm> <max rpm> <name>
+ * A sample that fails keeps the last good snapshot, whose age in TIME
+ * then keeps growing. GET answers "ERR no reading yet" until one works.
+ * A client that leaves too many answers unread is dropped.
+ */
+
+#define CL_DEFAULT_SOCKET	"/var/run/OpenCorsairLink.sock"
+#define CL_DEFAULT_INTERVAL	1000	/* ms between samples */
+
+#define CL_DAEMON_MAX_CLIENTS	16
+
+int CorsairDaemon_run(CorsairLink_t *, int, const char *, int);
+int CorsairDaemon_query(const char *, const char *);
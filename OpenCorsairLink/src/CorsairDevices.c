@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pthread.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairDevices.h"
+#include "CorsairTransport.h"
+
+static int already_listed(CorsairDevices_t *t, const char *path, const char *serial)
+{
+	int i;
+
+	for (i = 0; i < t->count; i++) {
+		if (!strcmp(t->dev[i].link.path, path) && !strcmp(t->dev[i].serial, serial))
+			return 1;
+	}
+	return 0;
+}
+
+static void add_devices(CorsairDevices_t *t, const CorsairTransport_t *transport,
+			unsigned short pid, int interface)
+{
+	struct hid_device_info *devs, *cur;
+	CorsairDevice_t *d;
+	char serial[CL_MAX_SERIAL];
+
+	devs = transport->enumerate(CL_VENDOR_ID, pid);
+	for (cur = devs; cur != NULL; cur = cur->next) {
+		if (cur->path == NULL || strlen(cur->path) >= CL_MAX_PATH)
+			continue;
+		serial[0] = '\0';
+		if (cur->serial_number != NULL &&
+		    wcstombs(serial, cur->serial_number, sizeof(serial)) == (size_t)-1)
+			serial[0] = '\0';
+		serial[sizeof(serial) - 1] = '\0';
+
+		if (already_listed(t, cur->path, serial))
+			continue;
+		if (t->count >= CL_MAX_DEVICES) {
+			fprintf(stderr, "Ignoring %s: more than %d devices\n", cur->path, CL_MAX_DEVICES);
+			continue;
+		}
+
+		d = &t->dev[t->count++];
+		memset(d, 0x00, sizeof(*d));
+		strcpy(d->link.path, cur->path);
+		d->link.transport = transport;
+		strcpy(d->serial, serial);
+		d->interface = interface;
+		d->num_temps = -1;
+	}
+	transport->free_enumeration(devs);
+}
+
+/*
+ * Fill the table with every H80I and/or CLINK device (0 for both) that
+ * transport knows of, hidapi if NULL. Nothing is opened yet, so read
+ * settings can still be put in each link. Returns the number of
+ * devices found.
+ */
+int CorsairDevices_scan(CorsairDevices_t *t, int interface, const CorsairTransport_t *transport)
+{
+	if (transport == NULL)
+		transport = &CorsairHidTransport;
+
+	t->count = 0;
+	if (interface == 0 || interface == H80I)
+		add_devices(t, transport, CL_PID_H80I, H80I);
+	if (interface == 0 || interface == CLINK)
+		add_devices(t, transport, CL_PID_CLINK, CLINK);
+	return t->count;
+}
+
+/*
+ * Look a device up by 1-based index, path or serial number.
+ * Returns its table index or -1.
+ */
+int CorsairDevices_find(CorsairDevices_t *t, const char *key)
+{
+	char *end;
+	long n;
+	int i;
+
+	n = strtol(key, &end, 10);
+	if (*key != '\0' && *end == '\0')
+		return (n >= 1 && n <= t->count) ? (int)n - 1 : -1;
+
+	for (i = 0; i < t->count; i++) {
+		if (!strcmp(t->dev[i].link.path, key) ||
+		    (t->dev[i].serial[0] != '\0' && !strcmp(t->dev[i].serial, key)))
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Open every device in the table. One that fails is left closed and
+ * skipped by the sweep. Returns the number opened.
+ */
+int CorsairDevices_open(CorsairDevices_t *t)
+{
+	int opened = 0;
+	int i;
+
+	for (i = 0; i < t->count; i++) {
+		if (CorsairLink_init(&t->dev[i].link, t->dev[i].interface))
+			opened++;
+		else
+			t->dev[i].status = -1;
+	}
+	return opened;
+}
+
+static void *sweep_device(void *arg)
+{
+	CorsairDevice_t *d = arg;
+
+	if (d->num_temps < 0) {
+		d->num_temps = ConnectedTemps(&d->link, d->interface);
+		if (d->num_temps > NUMTEMPS)
+			d->num_temps = NUMTEMPS;
+		if (d->num_temps < 0)
+			d->num_temps = 0;
+	}
+	d->status = ReadAllInfo(&d->link, d->interface, d->temps, d->num_temps);
+	return NULL;
+}
+
+/*
+ * Read temperatures and fans of every open device, each on its own
+ * thread. Returns the number of devices that failed.
+ */
+int CorsairDevices_sweep(CorsairDevices_t *t)
+{
+	int started[CL_MAX_DEVICES];
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < t->count; i++) {
+		started[i] = 0;
+		if (t->dev[i].link.handle == NULL)
+			continue;
+		if (pthread_create(&t->dev[i].thread, NULL, sweep_device, &t->dev[i]) == 0)
+			started[i] = 1;
+		else
+			sweep_device(&t->dev[i]);
+	}
+	for (i = 0; i < t->count; i++) {
+		if (started[i])
+			pthread_join(t->dev[i].thread, NULL);
+		if (t->dev[i].status != 0)
+			failed++;
+	}
+	return failed;
+}
+
+void CorsairDevices_close(CorsairDevices_t *t)
+{
+	int i;
+
+	for (i = 0; i < t->count; i++)
+		Close(&t->dev[i].link);
+}
@@ -0,0 +1,38 @@
+
+/*
+ * Every Corsair Link device on the machine, found with the transport's
+ * enumerate() and keyed by path and serial number. A sweep reads all
+ * of them at once, one thread per device, so it takes as long as the
+ * slowest device instead of the sum of all of them.
+ */
+
+#define CL_VENDOR_ID		0x1b1c
+#define CL_PID_CLINK		0x0c02	/* Old Cooling node */
+#define CL_PID_H80I		0x0c04	/* H80i/H100i */
+
+#define CL_MAX_DEVICES		8
+
+struct CorsairDevice {
+	CorsairLink_t		link;
+	int			interface;		/* H80I or CLINK */
+	char			serial[CL_MAX_SERIAL];
+	int			num_temps;
+	unsigned short		temps[NUMTEMPS];
+	int			status;			/* ReadAllInfo() result of the last sweep */
+	pthread_t		thread;
+};
+
+typedef struct CorsairDevice CorsairDevice_t;
+
+struct CorsairDevices {
+	int			count;
+	CorsairDevice_t		dev[CL_MAX_DEVICES];
+};
+
+typedef struct CorsairDevices CorsairDevices_t;
+
+int CorsairDevices_scan(CorsairDevices_t *, int, const struct CorsairTransport *);
+int CorsairDevices_find(CorsairDevices_t *, const char *);
+int CorsairDevices_open(CorsairDevices_t *);
+int CorsairDevices_sweep(CorsairDevices_t *);
+void CorsairDevices_close(CorsairDevices_t *);
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <errno.h>
 #include "CorsairFanInfo.h"
+#include "corsairlink_temp.h"
 
 struct ModeToString {
 	int	mode;
@@ -49,38 +50,7 @@ void PrintInfo(CorsairFanInfo_t *fi){
 }
 
 void PrintTempInfo(unsigned short temp) {
-	unsigned char	wtemp;
-	unsigned char	frtemp;
-	unsigned int	trans = 0;
+	unsigned int	milli = corsairlink_temp_milli(temp);
 
-	wtemp = ((temp >> 8) & 0xff);
-	frtemp = temp & 0xff;
-
-	if (frtemp & 0x80) {
-		trans += 500;	/* 128/256 */
-	}
-	if (frtemp & 0x40) {
-		trans += 250;	/* 64/256 */
-	}
-	if (frtemp & 0x20) {
-		trans += 125;	/* 32/256 */
-	}
-	if (frtemp & 0x10) {
-		trans += 62;	/* 16/256 */
-	}
-	if (frtemp & 0x08) {
-		trans += 31;	/* 8/256 */
-	}
-	if (frtemp & 0x04) {
-		trans += 16;	/* 4/256 */
-	}
-	if (frtemp & 0x02) {
-		trans += 8;	/* 2/256 */
-	}
-	if (frtemp & 0x01) {
-		trans += 4;	/* 1/256 */
-	}
-
-	printf("Temperature %d.%.3d C\n", wtemp, trans); 
+	printf("Temperature %u.%.3u C\n", milli / 1000, milli % 1000);
 }
-
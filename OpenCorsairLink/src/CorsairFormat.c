@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairDevices.h"
+#include "CorsairFormat.h"
+#include "corsairlink_temp.h"
+
+/*
+ * Like snprintf() into buf at *len. If it does not all fit *len is set
+ * to room, which no complete record has, and later calls do nothing:
+ * callers check for that and drop the record rather than emit half.
+ */
+static void put(char *buf, int room, int *len, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (*len >= room)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(&buf[*len], room - *len, fmt, ap);
+	va_end(ap);
+	if (n < 0 || n >= room - *len) {
+		*len = room;
+		return;
+	}
+	*len += n;
+}
+
+/*
+ * Drop a device's record that did not fit, back to where it started.
+ * Returns 1 if it was dropped.
+ */
+static int dropped(CorsairDevice_t *d, int room, int *len, int start)
+{
+	if (*len < room)
+		return 0;
+	fprintf(stderr, "Format: no room for the reading of %s, dropped\n", d->link.path);
+	*len = start;
+	return 1;
+}
+
+/*
+ * JSON string body, quotes and control characters escaped
+ */
+static void put_json_str(char *buf, int room, int *len, const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			put(buf, room, len, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			put(buf, room, len, "\\u%04x", *s);
+		else
+			put(buf, room, len, "%c", *s);
+	}
+}
+
+/*
+ * RFC 4180 CSV field, always quoted with embedded quotes doubled
+ */
+static void put_csv_str(char *buf, int room, int *len, const char *s)
+{
+	put(buf, room, len, "\"");
+	for (; *s; s++) {
+		if (*s == '"')
+			put(buf, room, len, "\"\"");
+		else
+			put(buf, room, len, "%c", *s);
+	}
+	put(buf, room, len, "\"");
+}
+
+int CorsairFormat_parse(const char *name)
+{
+	if (!strcmp(name, "text"))
+		return CL_FORMAT_TEXT;
+	if (!strcmp(name, "jsonl"))
+		return CL_FORMAT_JSONL;
+	if (!strcmp(name, "csv"))
+		return CL_FORMAT_CSV;
+	return -1;
+}
+
+/*
+ * Header line for formats that have one, returns its length.
+ */
+int CorsairFormat_header(char *buf, int room, int format)
+{
+	int len = 0;
+	int i;
+
+	if (format != CL_FORMAT_CSV)
+		return 0;
+
+	put(buf, room, &len, "time_ms,path,serial,ok");
+	for (i = 0; i < NUMTEMPS; i++)
+		put(buf, room, &len, ",temp%d", i + 1);
+	for (i = 0; i < NUMFANS; i++)
+		put(buf, room, &len, ",fan%d_mode,fan%d_rpm,fan%d_max_rpm", i + 1, i + 1, i + 1);
+	put(buf, room, &len, "\n");
+	return len < room ? len : 0;
+}
+
+static void sample_jsonl(char *buf, int room, int *len, CorsairDevices_t *t,
+			 unsigned long long now_ms)
+{
+	static const char tail[] = "]}\n";
+	CorsairDevice_t *d;
+	CorsairFanInfo_t *fan;
+	unsigned int milli;
+	int first = 1;
+	int start;
+	int i, j;
+
+	/* Devices get what is left after the closing brackets */
+	room -= sizeof(tail) - 1;
+	put(buf, room, len, "{\"time_ms\":%llu,\"devices\":[", now_ms);
+	for (j = 0; j < t->count; j++) {
+		d = &t->dev[j];
+		if (d->link.handle == NULL)
+			continue;
+		start = *len;
+		put(buf, room, len, "%s{\"path\":\"", first ? "" : ",");
+		put_json_str(buf, room, len, d->link.path);
+		put(buf, room, len, "\",\"serial\":\"");
+		put_json_str(buf, room, len, d->serial);
+		put(buf, room, len, "\",\"type\":\"%s\",\"ok\":%s,\"temps\":[",
+		    d->interface == CLINK ? "clink" : "h80i", d->status ? "false" : "true");
+		for (i = 0; i < d->num_temps; i++) {
+			milli = corsairlink_temp_milli(d->temps[i]);
+			put(buf, room, len, "%s%u.%03u", i ? "," : "", milli / 1000, milli % 1000);
+		}
+		put(buf, room, len, "],\"fans\":[");
+		for (i = 0; i < NUMFANS; i++) {
+			fan = &d->link.fans[i];
+			put(buf, room, len, "%s{\"name\":\"", i ? "," : "");
+			put_json_str(buf, room, len, fan->Name);
+			put(buf, room, len, "\",\"mode\":%d,\"rpm\":%d,\"max_rpm\":%d}",
+			    fan->Mode, fan->RPM, fan->maxRPM);
+		}
+		put(buf, room, len, "]}");
+		if (!dropped(d, room, len, start))
+			first = 0;
+	}
+	if (*len >= room) {
+		/* Not even the start fitted */
+		*len = room + sizeof(tail) - 1;
+		return;
+	}
+	put(buf, room + sizeof(tail) - 1, len, "%s", tail);
+}
+
+static void sample_csv(char *buf, int room, int *len, CorsairDevices_t *t,
+		       unsigned long long now_ms)
+{
+	CorsairDevice_t *d;
+	CorsairFanInfo_t *fan;
+	unsigned int milli;
+	int start;
+	int i, j;
+
+	for (j = 0; j < t->count; j++) {
+		d = &t->dev[j];
+		if (d->link.handle == NULL)
+			continue;
+		start = *len;
+		put(buf, room, len, "%llu,", now_ms);
+		put_csv_str(buf, room, len, d->link.path);
+		put(buf, room, len, ",");
+		put_csv_str(buf, room, len, d->serial);
+		put(buf, room, len, ",%d", !d->status);
+		for (i = 0; i < NUMTEMPS; i++) {
+			if (i < d->num_temps) {
+				milli = corsairlink_temp_milli(d->temps[i]);
+				put(buf, room, len, ",%u.%03u", milli / 1000, milli % 1000);
+			} else {
+				put(buf, room, len, ",");
+			}
+		}
+		for (i = 0; i < NUMFANS; i++) {
+			fan = &d->link.fans[i];
+			put(buf, room, len, ",%d,%d,%d", fan->Mode, fan->RPM, fan->maxRPM);
+		}
+		put(buf, room, len, "\n");
+		dropped(d, room, len, start);
+	}
+}
+
+/*
+ * Format the last sweep of every open device, returns the length. A
+ * device whose record does not fit is left out, and 0 returned if not
+ * even the sample's own framing does.
+ */
+int CorsairFormat_sample(char *buf, int room, int format, CorsairDevices_t *t,
+			 unsigned long long now_ms)
+{
+	int len = 0;
+
+	if (format == CL_FORMAT_JSONL)
+		sample_jsonl(buf, room, &len, t, now_ms);
+	else if (format == CL_FORMAT_CSV)
+		sample_csv(buf, room, &len, t, now_ms);
+	return len < room ? len : 0;
+}
+
+/*
+ * One write() for the whole sample, looping only if the pipe is full.
+ */
+int CorsairFormat_write(int fd, const char *buf, int len)
+{
+	int res;
+
+	while (len > 0) {
+		res = write(fd, buf, len);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += res;
+		len -= res;
+	}
+	return 0;
+}
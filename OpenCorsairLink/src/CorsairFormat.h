@@ -0,0 +1,27 @@
+
+/*
+ * Machine readable output for collectors. Each sample is formatted
+ * into one buffer and written with a single write(), so lines from
+ * concurrent samplers never interleave half way.
+ *
+ * jsonl: one object per sample
+ *	{"time_ms":..,"devices":[{"path":..,"serial":..,"type":..,
+ *	 "temps":[30.500,..],"fans":[{"name":..,"mode":..,"rpm":..,"max_rpm":..},..]},..]}
+ * csv:   a header line, then one row per device per sample
+ *	time_ms,path,serial,ok,temp1..temp4,fan1_mode,fan1_rpm,fan1_max_rpm,..
+ * Temperatures are degrees C with three decimals. ok (1 or 0) says
+ * whether the device's last sweep read everything. A record that does
+ * not fit the buffer is left out whole, with a message on stderr.
+ */
+
+#define CL_FORMAT_TEXT		0
+#define CL_FORMAT_JSONL		1
+#define CL_FORMAT_CSV		2
+
+/* Room for one sample of every device */
+#define CL_FORMAT_MAX		(1024 * CL_MAX_DEVICES)
+
+int CorsairFormat_parse(const char *);
+int CorsairFormat_header(char *, int, int);
+int CorsairFormat_sample(char *, int, int, CorsairDevices_t *, unsigned long long);
+int CorsairFormat_write(int, const char *, int);
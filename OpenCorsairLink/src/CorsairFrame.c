@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairFrame.h"
+
+/*
+ * Indexed by opcode - WriteOneByte
+ */
+const struct CorsairOpSize CorsairOpSizes[] = {
+	/*			 request reply data count write */
+	[WriteOneByte - WriteOneByte]	= { 4, 2, 1, 0, 1 },
+	[ReadOneByte - WriteOneByte]	= { 3, 3, 1, 0, 0 },
+	[WriteTwoBytes - WriteOneByte]	= { 5, 2, 2, 0, 1 },
+	[ReadTwoBytes - WriteOneByte]	= { 3, 4, 2, 0, 0 },
+	[WriteThreeBytes - WriteOneByte] = { 7, 2, 3, 1, 1 },
+	[ReadThreeBytes - WriteOneByte]	= { 4, 5, 3, 1, 0 },
+};
+
+/*
+ * Width in bytes of each register, from the CorsairLinkCommands notes
+ */
+static const unsigned char RegWidth[CL_NUM_REGS] = {
+	[DeviceID]			= 1,
+	[FirmwareID]			= 2,
+	[ProductName]			= 8,
+	[Status]			= 1,
+	[LED_SelectCurrent]		= 1,
+	[LED_Count]			= 1,
+	[LED_Mode]			= 1,
+	[LED_CurrentColor]		= 3,
+	[LED_TemperatureColor]		= 2,
+	[LED_TemperatureMode]		= 6,
+	[LED_TemperatureModeColors]	= 9,
+	[LED_CycleColors]		= 12,
+	[TEMP_SelectActiveSensor]	= 1,
+	[TEMP_CountSensors]		= 1,
+	[TEMP_Read]			= 2,
+	[TEMP_Limit]			= 2,
+	[FAN_Select]			= 1,
+	[FAN_Count]			= 1,
+	[FAN_Mode]			= 1,
+	[FAN_FixedPWM]			= 1,
+	[FAN_FixedRPM]			= 2,
+	[FAN_ReportExtTemp]		= 2,
+	[FAN_ReadRPM]			= 2,
+	[FAN_MaxRecordedRPM]		= 2,
+	[FAN_UnderSpeedThreshold]	= 2,
+	[FAN_RPMTable]			= 10,
+	[FAN_TempTable]			= 10,
+};
+
+static const unsigned char ReadOp[4] = { 0, ReadOneByte, ReadTwoBytes, ReadThreeBytes };
+static const unsigned char WriteOp[4] = { 0, WriteOneByte, WriteTwoBytes, WriteThreeBytes };
+
+int CorsairFrame_width(int reg)
+{
+	if (reg < 0 || reg >= CL_NUM_REGS)
+		return 0;
+	return RegWidth[reg];
+}
+
+/*
+ * Opcode that reads (write == 0) or writes a whole H80i register,
+ * -1 for registers wider than the three byte opcodes.
+ */
+int CorsairFrame_opcode(int reg, int write)
+{
+	int width = CorsairFrame_width(reg);
+
+	if (width < 1 || width > 3)
+		return -1;
+	return write ? WriteOp[width] : ReadOp[width];
+}
+
+/*
+ * Build the request frame for count ops into out, which must hold
+ * CL_MAX_FRAME bytes. Returns the number of bytes to hand to
+ * hid_write(), or -1 if the ops do not fit in one frame.
+ */
+int CorsairFrame_encode(unsigned char *out, int interface, const CorsairOp_t *ops, int count)
+{
+	const struct CorsairOpSize *sz;
+	int len, i, n, size;
+
+	if (interface == CLINK) {
+		if (count != 1 || !CL_OP_VALID(ops[0].opcode))
+			return -1;
+		sz = CL_OP_SIZE(ops[0].opcode);
+		out[0] = ops[0].cmdId;
+		out[1] = ops[0].opcode;
+		out[2] = ops[0].reg;
+		len = 3;
+		if (sz->count)
+			out[len++] = 0x03;
+		if (sz->write) {
+			for (n = 0; n < sz->data; n++)
+				out[len++] = ops[0].data[n];
+		}
+		return len;
+	}
+
+	len = 1;
+	for (i = 0; i < count; i++) {
+		if (!CL_OP_VALID(ops[i].opcode))
+			return -1;
+		sz = CL_OP_SIZE(ops[i].opcode);
+		if (len + sz->request > H80I_LONG_REPORT)
+			return -1;
+		out[len++] = ops[i].cmdId;
+		out[len++] = ops[i].opcode;
+		out[len++] = ops[i].reg;
+		if (sz->count)
+			out[len++] = 0x03;
+		if (sz->write) {
+			for (n = 0; n < sz->data; n++)
+				out[len++] = ops[i].data[n];
+		}
+	}
+	out[0] = len - 1; // Length
+
+	/* Pad to the report size, only the tail that is not ours */
+	size = len <= H80I_SHORT_REPORT ? H80I_SHORT_REPORT : H80I_LONG_REPORT;
+	if (len < size)
+		memset(&out[len], 0x00, size - len);
+	return size;
+}
+
+/*
+ * Hand each op its part of a reply. Replies come back in request
+ * order, each answer carrying its op's command ID and opcode; both
+ * have to match. Returns how many ops were answered, stopping at the
+ * first one that is missing.
+ */
+int CorsairFrame_decode(const unsigned char *in, int len, CorsairOp_t *ops, int count)
+{
+	const struct CorsairOpSize *sz;
+	int i, j, n;
+
+	for (i = 0, j = 0; i < count; i++) {
+		sz = CL_OP_SIZE(ops[i].opcode);
+		if (j + sz->reply > len ||
+		    in[j] != ops[i].cmdId || in[j + 1] != ops[i].opcode)
+			break;
+		ops[i].value = 0;
+		if (!sz->write) {
+			for (n = sz->data - 1; n >= 0; n--)
+				ops[i].value = (ops[i].value << 8) | in[j + 2 + n];
+		}
+		ops[i].done = 1;
+		j += sz->reply;
+	}
+	return i;
+}
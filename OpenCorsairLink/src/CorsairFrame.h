@@ -0,0 +1,51 @@
+
+/*
+ * Frame encoder/decoder for both CorsairLink framings.
+ *
+ * H80I:  <len> { <cmdId> <opcode> <reg> [03] [data] } ...
+ *        sent as an 11 or 17 byte output report, len doubling as the
+ *        report ID.
+ * CLINK: <cmdId> <opcode> <reg> [data], one request per report.
+ * Replies are { <cmdId> <opcode> [data] } ... in request order.
+ *
+ * Sizes come from a table indexed by opcode, so building a frame is a
+ * handful of byte stores into the caller's buffer.
+ */
+
+/* Output report sizes the H80i accepts, report ID included */
+#define H80I_SHORT_REPORT	11
+#define H80I_LONG_REPORT	17
+
+/* Largest request frame either framing produces */
+#define CL_MAX_FRAME		H80I_LONG_REPORT
+
+struct CorsairOp {
+	unsigned char	opcode;		/* _CorsairLinkOpCodes */
+	unsigned char	reg;		/* Register (CorsairLinkCommands or port) */
+	unsigned char	data[3];	/* Little-endian data to write */
+	unsigned char	cmdId;		/* Command ID it went out with */
+	int		group;		/* Ops of one group go out in one report */
+	int		done;		/* Reply received for this op */
+	unsigned int	value;		/* Little-endian data read back */
+};
+
+typedef struct CorsairOp CorsairOp_t;
+
+/* Sizes of one request and its answer for an opcode */
+struct CorsairOpSize {
+	unsigned char	request;	/* cmdId, opcode, register, count, data */
+	unsigned char	reply;		/* cmdId, opcode, data */
+	unsigned char	data;		/* Data bytes written or read */
+	unsigned char	count;		/* Carries the 03 byte count */
+	unsigned char	write;
+};
+
+extern const struct CorsairOpSize CorsairOpSizes[];
+
+#define CL_OP_VALID(op)		((op) >= WriteOneByte && (op) <= ReadThreeBytes)
+#define CL_OP_SIZE(op)		(&CorsairOpSizes[(op) - WriteOneByte])
+
+int CorsairFrame_width(int);
+int CorsairFrame_opcode(int, int);
+int CorsairFrame_encode(unsigned char *, int, const CorsairOp_t *, int);
+int CorsairFrame_decode(const unsigned char *, int, CorsairOp_t *, int);
@@ -4,68 +4,176 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include "hidapi.h"
 #include "CorsairFanInfo.h"
 #include "CorsairLink.h"
+#include "CorsairFrame.h"
+#include "CorsairPipe.h"
+#include "CorsairBatch.h"
+#include "CorsairTransport.h"
 
 #define CLINK_HUB 1
 
+/*
+ * How long (ms) a shadow copy of each H80i register stays good.
+ * Identity registers never change, settings only change when someone
+ * sets them, and measurements always go to the device.
+ */
+static const int RegTTL[CL_NUM_REGS] = {
+	[DeviceID]		= CL_TTL_FOREVER,
+	[FirmwareID]		= CL_TTL_FOREVER,
+	[ProductName]		= CL_TTL_FOREVER,
+	[Status]		= CL_TTL_NONE,
+	[LED_SelectCurrent]	= CL_TTL_NONE,
+	[LED_Count]		= CL_TTL_FOREVER,
+	[LED_Mode]		= CL_TTL_MODE,
+	[LED_CurrentColor]	= CL_TTL_NONE,
+	[LED_TemperatureColor]	= CL_TTL_MODE,
+	[LED_TemperatureMode]	= CL_TTL_MODE,
+	[LED_TemperatureModeColors] = CL_TTL_MODE,
+	[LED_CycleColors]	= CL_TTL_MODE,
+	[TEMP_SelectActiveSensor] = CL_TTL_NONE,
+	[TEMP_CountSensors]	= CL_TTL_FOREVER,
+	[TEMP_Read]		= CL_TTL_NONE,
+	[TEMP_Limit]		= CL_TTL_MODE,
+	[FAN_Select]		= CL_TTL_NONE,
+	[FAN_Count]		= CL_TTL_FOREVER,
+	[FAN_Mode]		= CL_TTL_MODE,
+	[FAN_FixedPWM]		= CL_TTL_MODE,
+	[FAN_FixedRPM]		= CL_TTL_MODE,
+	[FAN_ReportExtTemp]	= CL_TTL_NONE,
+	[FAN_ReadRPM]		= CL_TTL_NONE,
+	[FAN_MaxRecordedRPM]	= CL_TTL_NONE,
+	[FAN_UnderSpeedThreshold] = CL_TTL_MODE,
+	[FAN_RPMTable]		= CL_TTL_MODE,
+	[FAN_TempTable]		= CL_TTL_MODE
+};
+
+/*
+ * Return 1 and the value if the shadow copy of reg (on channel chan)
+ * is still good, otherwise 0 and the caller has to ask the device.
+ * Only the H80i register space is shadowed.
+ */
+int ShadowGet(CorsairLink_t *cl, int reg, int chan, unsigned int *value)
+{
+	CorsairShadowReg_t *sr;
+	int ttl;
+
+	if (cl->interface != H80I || reg < 0 || reg >= CL_NUM_REGS ||
+	    chan < 0 || chan >= CL_NUM_CHANNELS)
+		return 0;
+
+	ttl = RegTTL[reg];
+	sr = &cl->shadow[reg][chan];
+	if (ttl == CL_TTL_NONE || !sr->valid ||
+	    (ttl != CL_TTL_FOREVER && Ctime_us() - sr->stamp_us >= ttl * 1000ULL)) {
+		cl->shadow_misses++;
+		return 0;
+	}
+	cl->shadow_hits++;
+	*value = sr->value;
+	return 1;
+}
+
+/*
+ * Remember a value just read from (or written to) the device
+ */
+void ShadowSet(CorsairLink_t *cl, int reg, int chan, unsigned int value)
+{
+	CorsairShadowReg_t *sr;
+
+	if (cl->interface != H80I || reg < 0 || reg >= CL_NUM_REGS ||
+	    chan < 0 || chan >= CL_NUM_CHANNELS || RegTTL[reg] == CL_TTL_NONE)
+		return;
+
+	sr = &cl->shadow[reg][chan];
+	sr->value = value;
+	sr->stamp_us = Ctime_us();
+	sr->valid = 1;
+}
+
+void ShadowInvalidate(CorsairLink_t *cl)
+{
+	memset(cl->shadow, 0x00, sizeof(cl->shadow));
+}
+
+/*
+ * Queue a read of reg unless the shadow copy is still good.
+ * Returns the op to pass to CachedValue(), or -1 on a shadow hit with
+ * the shadow value left in *cached. The value is taken now, the shadow
+ * copy may have expired by the time the batch has run.
+ */
+static int QueueCachedRead(CorsairBatch_t *b, int opcode, int reg, int chan,
+			   unsigned int *cached)
+{
+	*cached = 0;
+	if (ShadowGet(b->cl, reg, chan, cached))
+		return -1;
+	return CorsairBatch_read(b, opcode, reg);
+}
+
+/*
+ * Value of a register queued with QueueCachedRead() after the batch ran
+ */
+static unsigned int CachedValue(CorsairBatch_t *b, int op, int reg, int chan,
+				unsigned int cached)
+{
+	unsigned int value;
+
+	if (op < 0)
+		return cached;
+	value = CorsairBatch_value(b, op);
+	if (CorsairBatch_done(b, op))
+		ShadowSet(b->cl, reg, chan, value);
+	return value;
+}
+
 int Initialize(CorsairLink_t *cl, int interface)
 {
-	int res;
 	int deviceId;
-	unsigned char buf[256];
+	int op;
+	CorsairBatch_t batch;
 
 	if(cl->handle == NULL){
-		if (hid_init())
-			return 0;
-			
-		// Set up the command buffer.
-		memset(buf,0x00,sizeof(buf));
-		buf[0] = 0x01;
-		buf[1] = 0x81;
-		
+		if (cl->transport == NULL)
+			cl->transport = &CorsairHidTransport;
+
+		/* Whatever we knew belonged to whatever was open before */
+		ShadowInvalidate(cl);
+		cl->interface = interface;
+
 		// Open the device using the VID, PID,
 		// and optionally the Serial number.
 		// open Corsair H80i or H100i cooler 
-		if (interface == CLINK) {
-			cl->handle = hid_open(0x1b1c, 0x0c02, NULL); /* Old Cooling node */
+		if (cl->path[0] != '\0') {
+			cl->handle = cl->transport->open(cl->path, 0);
+			if (!cl->handle) {
+				fprintf(stderr, "Error: Unable to open %s\n", cl->path);
+				return 0;
+			}
+		} else if (interface == CLINK) {
+			cl->handle = cl->transport->open("", 0x0c02); /* Old Cooling node */
 			if (!cl->handle) {
 				fprintf(stderr,
 					"Error: Unable to open Corsair Cooler Node\n");
 				return 0;
 			}
 		} else {
-			cl->handle = hid_open(0x1b1c, 0x0c04, NULL); /* H80i/H100i */
+			cl->handle = cl->transport->open("", 0x0c04); /* H80i/H100i */
 			if (!cl->handle) {
 				fprintf(stderr,
 					"Error: Unable to open Corsair H80i or H100i CPU Cooler\n");
 				return 0;
 			}
 		}
-
-		hid_set_nonblocking(cl->handle, 1);
 		
 		// Read Device ID: 0x3b = H80i. 0x3c = H100i
-		buf[0] = 0x03; // Length
-		buf[1] = cl->CommandId++; // Command ID
-		buf[2] = ReadTwoBytes; // Command Opcode
-		buf[3] = DeviceID; // Command data...
-		
-		if (interface == CLINK) {
-			res = hid_write(cl->handle, &buf[1], 3);
-		} else {
-			res = hid_write(cl->handle, buf, 11);
-		}
-		if (res < 0) {
-			fprintf(stderr, "Error: Unable to write() %s\n", hid_error(cl->handle));
-		}
-		memset(buf,0x00,sizeof(buf));
-		res = hid_read_wrapper(cl, cl->handle, buf);
-		if (res < 0) {
-			fprintf(stderr, "Error: Unable to read() %s\n", hid_error(cl->handle));
-		}
-		deviceId = buf[2];
+		CorsairBatch_init(&batch, cl, interface);
+		op = CorsairBatch_read(&batch, ReadTwoBytes, DeviceID);
+		CorsairBatch_run(&batch);
+		deviceId = CorsairBatch_value(&batch, op) & 0xff;
 
 		if (interface == CLINK) {
 			if (deviceId != 0x38) {
@@ -81,6 +189,7 @@ int Initialize(CorsairLink_t *cl, int interface)
 				Close(cl);
 				return 0;
 			}
+			ShadowSet(cl, DeviceID, 0, deviceId);
 		}
 	} else {
 		fprintf(stderr, "Cannot initialize twice\n");
@@ -92,36 +201,37 @@ int Initialize(CorsairLink_t *cl, int interface)
 int CorsairLink_init(CorsairLink_t *cl,int interface) {
 	cl->handle = NULL;
 	cl->CommandId = 0x81;
-	cl->max_ms_read_wait = 5000;
+	/* Caller may have picked a read deadline/mode already, zero is default */
+	if (cl->max_ms_read_wait <= 0)
+		cl->max_ms_read_wait = 5000;
+	memset(&cl->latency, 0x00, sizeof(cl->latency));
+	cl->shadow_hits = 0;
+	cl->shadow_misses = 0;
+	cl->inflight = 0;
+	memset(cl->recent, 0x00, sizeof(cl->recent));
+	cl->recent_next = 0;
+	memset(cl->stale, 0x00, sizeof(cl->stale));
+	cl->stale_next = 0;
+	cl->stale_replies = 0;
+	cl->dup_replies = 0;
 	//fans = new CorsairFanInfo[5];
 	return Initialize(cl, interface);
 }
 
 int ConnectedTemps(CorsairLink_t *cl, int interface) {
 	int sensors = 0;
-	unsigned char buf[256];
-	int res;
+	CorsairBatch_t batch;
+	unsigned int cached;
+	int op;
 	
 	if (interface == CLINK) {
 		sensors = 4;
 	} else {
-		memset(buf,0x00,sizeof(buf));
 		// Read number of temp sensors
-		buf[0] = 0x03; // Length
-		buf[1] = cl->CommandId++; // Command ID
-		buf[2] = ReadOneByte; // Command Opcode
-		buf[3] = TEMP_CountSensors; // Command data...
-		
-		res = hid_write(cl->handle, buf, 11);
-		if (res < 0) {
-			fprintf(stderr, "Error: Unable to write() %s\n", hid_error(cl->handle));
-		}
-		
-		res = hid_read_wrapper(cl, cl->handle, buf);
-		if (res < 0) {
-			fprintf(stderr, "Error: Unable to read() %s\n", hid_error(cl->handle));
-		}
-		sensors = buf[2];
+		CorsairBatch_init(&batch, cl, interface);
+		op = QueueCachedRead(&batch, ReadOneByte, TEMP_CountSensors, 0, &cached);
+		CorsairBatch_run(&batch);
+		sensors = CachedValue(&batch, op, TEMP_CountSensors, 0, cached);
 	}
 	return sensors;
 }
@@ -134,52 +244,31 @@ int TempIndxToPort[] = {
 	0x07
 };
 
-unsigned short ReadTempInfo(CorsairLink_t *cl, int interface, int indx)
+/*
+ * Queue the reads for one temperature sensor, returns the op holding it.
+ */
+static int QueueTempInfo(CorsairBatch_t *b, int interface, int indx)
 {
-	unsigned short Temp = 0;
-	int res = 0;
-	unsigned char buf[256];
+	CorsairBatch_group(b);
+	if (interface == CLINK)
+		return CorsairBatch_read(b, ReadTwoBytes, TempIndxToPort[indx]);
 
-	memset(buf,0x00,sizeof(buf));
+	CorsairBatch_writeReg(b, TEMP_SelectActiveSensor, indx);
+	return CorsairBatch_readReg(b, TEMP_Read);
+}
 
-	if (interface == CLINK) {
-		// Read fan Temp
-		buf[0] = 0x03; // Length
-		buf[1] = cl->CommandId++; // Command ID
-		buf[2] = ReadTwoBytes; // Command Opcode
-		buf[3] = TempIndxToPort[indx]; // Command data...
-		res = hid_write(cl->handle, &buf[1], 3);
-	} else {
-		// Read fan Temp
-		buf[0] = 0x07; // Length
-		buf[1] = cl->CommandId++; // Command ID
-		buf[2] = WriteOneByte; // Command Opcode
-		buf[3] = TEMP_SelectActiveSensor; // Command data...
-		buf[4] = indx; // Command data...
-		buf[5] = cl->CommandId++; // Command ID
-		buf[6] = ReadTwoBytes; // Command Opcode
-		buf[7] = TEMP_Read; // Command data...
-		res = hid_write(cl->handle, buf, 11);
-	}
-	if (res < 0) {
-		fprintf(stderr, "Error: Unable to write for temp %s\n", hid_error(cl->handle));
-	}
-	
-	memset(buf,0x00,sizeof(buf));
-	res = hid_read_wrapper(cl, cl->handle, buf);
-	if (res < 0) {
-		fprintf(stderr, "Error: Unable to read temp %s\n", hid_error(cl->handle));
-	}
+unsigned short ReadTempInfo(CorsairLink_t *cl, int interface, int indx)
+{
+	CorsairBatch_t batch;
+	int op;
+
+	CorsairBatch_init(&batch, cl, interface);
+	op = QueueTempInfo(&batch, interface, indx);
+	if (CorsairBatch_run(&batch))
+		fprintf(stderr, "Error: Unable to read temp %d\n", indx);
 
 	//All data is little-endian.
-	if (interface == CLINK) {
-		Temp = buf[3] << 8;
-		Temp += buf[2];
-	} else {
-		Temp = buf[5] << 8;
-		Temp += buf[4];
-	}
-	return Temp;
+	return CorsairBatch_value(&batch, op);
 }
 		
 int ConnectedFans(CorsairLink_t *cl, int interface)
@@ -190,34 +279,24 @@ int ConnectedFans(CorsairLink_t *cl, int interface)
 		fans = 5;
 	} else {
 		int i = 0;
-		int fanMode = 0;
-		unsigned char buf[256];
-		int res;
+		int modeOp[NUMFANS];
+		unsigned int mode[NUMFANS];
+		CorsairBatch_t batch;
 
+		CorsairBatch_init(&batch, cl, interface);
 		for (i = 0; i < NUMFANS; i++) {
-			memset(buf,0x00,sizeof(buf));
-			// Read fan Mode
-			buf[0] = 0x07; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = WriteOneByte; // Command Opcode
-			buf[3] = FAN_Select; // Command data...
-			buf[4] = i; // select fan
-			buf[5] = cl->CommandId++; // Command ID
-			buf[6] = ReadOneByte; // Command Opcode
-			buf[7] = FAN_Mode; // Command data...
-		
-			res = hid_write(cl->handle, buf, 11);
-			if (res < 0) {
-				fprintf(stderr, "Error: Unable to write() %s\n", hid_error(cl->handle));
-			}
+			// Read fan Mode, unless we still know it
+			modeOp[i] = -1;
+			if (ShadowGet(cl, FAN_Mode, i, &mode[i]))
+				continue;
+			CorsairBatch_group(&batch);
+			CorsairBatch_writeReg(&batch, FAN_Select, i);
+			modeOp[i] = CorsairBatch_readReg(&batch, FAN_Mode);
+		}
+		CorsairBatch_run(&batch);
 
-			res = hid_read_wrapper(cl, cl->handle, buf);
-			if (res < 0) {
-				fprintf(stderr, "Error: Unable to read() %s\n", hid_error(cl->handle));
-			}
-			fanMode = buf[4];
-		
-			if(fanMode != 0x03){
+		for (i = 0; i < NUMFANS; i++) {
+			if(CachedValue(&batch, modeOp[i], FAN_Mode, i, mode[i]) != 0x03){
 				fans++;
 			}
 		}
@@ -254,238 +333,158 @@ int FanFixRPMIndxToPort[] = {
 	0x62
 };
 
-void ReadFansInfo(CorsairLink_t *cl, int interface){
-	int i = 0;
-	int fanMode = 0;
-	int res = 0;
-	int rpm, maxrpm;
-	unsigned char buf[256];
-
-	for (i = 0; i < NUMFANS; i++) {
-		memset(&cl->fans[i].Name, 0x00, sizeof(cl->fans[i].Name));
-		if (interface == CLINK) {
-			snprintf(&cl->fans[i].Name[0], sizeof(cl->fans[i].Name), "Fan %d", i + 1);
-		} else {
-			if(i < 4){
-				snprintf(&cl->fans[i].Name[0], sizeof(cl->fans[i].Name), "Fan %d",
-					 i + 1);
-			} else {
-				snprintf(&cl->fans[i].Name[0], sizeof(cl->fans[i].Name), "Pump");
-			}
-		}
-
-		memset(buf,0x00,sizeof(buf));
-		// Read fan Mode
-		if (interface == CLINK) {
-			buf[0] = 0x03; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = ReadTwoBytes; // Command Opcode
-			buf[3] = FanModeIndxToPort[i]; // Command data...
-			res = hid_write(cl->handle, &buf[1], 3);
-		} else {
-			buf[0] = 0x07; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = WriteOneByte; // Command Opcode
-			buf[3] = FAN_Select; // Command data...
-			buf[4] = i; // select fan
-			buf[5] = cl->CommandId++; // Command ID
-			buf[6] = ReadOneByte; // Command Opcode
-			buf[7] = FAN_Mode; // Command data...
-			res = hid_write(cl->handle, buf, 11);
-		}
-
-		if (res < 0) {
-			fprintf(stderr, "Error: Unable to write() %s\n", hid_error(cl->handle));
-		}
-
-		res = hid_read_wrapper(cl, cl->handle, buf);
-		if (res < 0) {
-			fprintf(stderr, "Error: Unable to read() %s\n", hid_error(cl->handle));
-		}
-		if (interface == CLINK) {
-			fanMode = buf[2];
-		} else {
-			fanMode = buf[4];
-		}
-		memset(buf,0x00,sizeof(buf));
-		// Read fan RPM
-		if (interface == CLINK) {
-			buf[0] = 0x03; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = ReadTwoBytes; // Command Opcode
-			buf[3] = FanRPMIndxToPort[i]; // Command data...
-			res = hid_write(cl->handle, &buf[1], 3);
-		} else {
-			buf[0] = 0x07; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = WriteOneByte; // Command Opcode
-			buf[3] = FAN_Select; // Command data...
-			buf[4] = i; // select fan
-			buf[5] = cl->CommandId++; // Command ID
-			buf[6] = ReadTwoBytes; // Command Opcode
-			buf[7] = FAN_ReadRPM; // Command data...
-			res = hid_write(cl->handle, buf, 11);
-		}
+/*
+ * Ops holding one fan's readings in a batch
+ */
+struct FanOps {
+	int	mode;
+	int	rpm;
+	int	maxrpm;
+	unsigned int modeval;	/* Shadow copy of the mode if mode is -1 */
+};
 
-		if (res < 0) {
-			fprintf(stderr, "Error: Unable to write() %s\n", hid_error(cl->handle));
-		}
+/*
+ * Queue mode, RPM and max RPM reads for one fan. On the H80i these
+ * all share one FAN_Select so they go out in the same report.
+ */
+static void QueueFanInfo(CorsairBatch_t *b, int interface, int i, struct FanOps *ops)
+{
+	ops->modeval = 0;
+	CorsairBatch_group(b);
+	if (interface == CLINK) {
+		ops->mode = CorsairBatch_read(b, ReadTwoBytes, FanModeIndxToPort[i]);
+		ops->rpm = CorsairBatch_read(b, ReadTwoBytes, FanRPMIndxToPort[i]);
+		ops->maxrpm = CorsairBatch_read(b, ReadTwoBytes, FanMaxRPMIndxToPort[i]);
+	} else {
+		CorsairBatch_writeReg(b, FAN_Select, i);
+		ops->mode = QueueCachedRead(b, ReadOneByte, FAN_Mode, i, &ops->modeval);
+		ops->rpm = CorsairBatch_readReg(b, FAN_ReadRPM);
+		ops->maxrpm = CorsairBatch_readReg(b, FAN_MaxRecordedRPM);
+	}
+}
 
-		res = hid_read_wrapper(cl, cl->handle, buf);
-		//All data is little-endian.
-		if (interface == CLINK) {
-			rpm = buf[3] << 8;
-			rpm += buf[2];
+static void CollectFanInfo(CorsairLink_t *cl, CorsairBatch_t *b, int interface, int i,
+			   struct FanOps *ops)
+{
+	memset(&cl->fans[i].Name, 0x00, sizeof(cl->fans[i].Name));
+	if (interface == CLINK) {
+		snprintf(&cl->fans[i].Name[0], sizeof(cl->fans[i].Name), "Fan %d", i + 1);
+	} else {
+		if(i < 4){
+			snprintf(&cl->fans[i].Name[0], sizeof(cl->fans[i].Name), "Fan %d",
+				 i + 1);
 		} else {
-			rpm = buf[5] << 8;
-			rpm += buf[4];
+			snprintf(&cl->fans[i].Name[0], sizeof(cl->fans[i].Name), "Pump");
 		}
+	}
 
-		memset(buf,0x00,sizeof(buf));
-		// Read fan RPM
-		if (interface == CLINK) {
-			buf[0] = 0x03; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = ReadTwoBytes; // Command Opcode
-			buf[3] = FanMaxRPMIndxToPort[i]; // Command data...
-			res = hid_write(cl->handle, &buf[1], 32);
-		} else {
-			buf[0] = 0x07; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = WriteOneByte; // Command Opcode
-			buf[3] = FAN_Select; // Command data...
-			buf[4] = i; // select fan
-			buf[5] = cl->CommandId++; // Command ID
-			buf[6] = ReadTwoBytes; // Command Opcode
-			buf[7] = FAN_MaxRecordedRPM; // Command data...
-			res = hid_write(cl->handle, buf, 11);
-		}
+	// Mode is the low byte on both interfaces
+	cl->fans[i].Mode = CachedValue(b, ops->mode, FAN_Mode, i, ops->modeval) & 0xff;
+	cl->fans[i].RPM = CorsairBatch_value(b, ops->rpm);
+	cl->fans[i].maxRPM = CorsairBatch_value(b, ops->maxrpm);
+}
 
-		if (res < 0) {
-			fprintf(stderr, "Error: Unable to write() %s\n", hid_error(cl->handle));
-		}
+void ReadFansInfo(CorsairLink_t *cl, int interface){
+	int i = 0;
+	struct FanOps ops[NUMFANS];
+	CorsairBatch_t batch;
 
-		res = hid_read_wrapper(cl, cl->handle, buf);
-		//All data is little-endian.
-		if (interface == CLINK) {
-			maxrpm = buf[3] << 8;
-			maxrpm += buf[2];
-		} else {
-			maxrpm = buf[5] << 8;
-			maxrpm += buf[4];
-		}
+	CorsairBatch_init(&batch, cl, interface);
+	for (i = 0; i < NUMFANS; i++)
+		QueueFanInfo(&batch, interface, i, &ops[i]);
 
-		cl->fans[i].Mode = fanMode;
-		cl->fans[i].RPM = rpm;
-		cl->fans[i].maxRPM = maxrpm;
+	if (CorsairBatch_run(&batch))
+		fprintf(stderr, "Error: Unable to read all fans\n");
 
-	}
+	for (i = 0; i < NUMFANS; i++)
+		CollectFanInfo(cl, &batch, interface, i, &ops[i]);
+}
 
+/*
+ * Read every fan and the first num_temps temperature sensors in one
+ * batch, so the whole sweep costs as few reports as possible.
+ */
+int ReadAllInfo(CorsairLink_t *cl, int interface, unsigned short *temps, int num_temps){
+	int i = 0;
+	int res;
+	struct FanOps ops[NUMFANS];
+	int tempOp[NUMTEMPS];
+	CorsairBatch_t batch;
+
+	if (num_temps > NUMTEMPS)
+		num_temps = NUMTEMPS;
+
+	CorsairBatch_init(&batch, cl, interface);
+	for (i = 0; i < num_temps; i++)
+		tempOp[i] = QueueTempInfo(&batch, interface, i);
+	for (i = 0; i < NUMFANS; i++)
+		QueueFanInfo(&batch, interface, i, &ops[i]);
+
+	res = CorsairBatch_run(&batch);
+	if (res)
+		fprintf(stderr, "Error: Unable to read all fans and temps\n");
+
+	for (i = 0; i < num_temps; i++)
+		temps[i] = CorsairBatch_value(&batch, tempOp[i]);
+	for (i = 0; i < NUMFANS; i++)
+		CollectFanInfo(cl, &batch, interface, i, &ops[i]);
+	return res;
 }
 
 int SetFansInfo(CorsairLink_t *cl, int interface, int fanIndex, CorsairFanInfo_t *fanInfo){
-	unsigned char buf[256];
-	int rpm;
-	int res;
+	CorsairBatch_t batch;
+	int modeOp = -1;
+	int rpmOp = -1;
+
+	if(fanInfo->Mode != FixedPWM && fanInfo->Mode != FixedRPM
+		&& fanInfo->Mode != Default && fanInfo->Mode != Quiet
+		&& fanInfo->Mode != Balanced && fanInfo->Mode != Performance
+		&& fanInfo->Mode != Custom) {
+		fprintf(stderr, "Invalid fan mode.\n");
+		return 1;
+	}
 
-	memset(buf,0x00,sizeof(buf));
-	if(fanInfo->Mode == FixedPWM || fanInfo->Mode == FixedRPM
-		|| fanInfo->Mode == Default || fanInfo->Mode == Quiet
-		|| fanInfo->Mode == Balanced || fanInfo->Mode == Performance
-		|| fanInfo->Mode == Custom) {
+	CorsairBatch_init(&batch, cl, interface);
+	CorsairBatch_group(&batch);
+	if (interface == CLINK) {
+		CorsairBatch_write(&batch, WriteOneByte, FanModeIndxToPort[fanIndex], fanInfo->Mode);
+	} else {
+		CorsairBatch_writeReg(&batch, FAN_Select, fanIndex);
+		CorsairBatch_writeReg(&batch, FAN_Mode, fanInfo->Mode);
+		modeOp = CorsairBatch_readReg(&batch, FAN_Mode);
+	}
 
+	if(fanInfo->RPM != 0) {
+		CorsairBatch_group(&batch);
 		if (interface == CLINK) {
-			buf[0] = 0x04; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = WriteOneByte; // Command Opcode
-			buf[3] = FanModeIndxToPort[fanIndex]; // Command data...
-			buf[4] = fanInfo->Mode;
-
-			res = hid_write(cl->handle, &buf[1], 4);
+			CorsairBatch_write(&batch, WriteTwoBytes, FanFixRPMIndxToPort[fanIndex],
+					   fanInfo->RPM);
 		} else {
-			buf[0] = 0x0b; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = WriteOneByte; // Command Opcode
-			buf[3] = FAN_Select; // Command data...
-			buf[4] = fanIndex; // select fan
-			buf[5] = cl->CommandId++; // Command ID
-			buf[6] = WriteOneByte; // Command Opcode
-			buf[7] = FAN_Mode; // Command data...
-			buf[8] = fanInfo->Mode;
-			buf[9] = cl->CommandId++; // Command ID
-			buf[10] = ReadOneByte; // Command Opcode
-			buf[11] = FAN_Mode; // Command data...
-
-			res = hid_write(cl->handle, buf, 17);
-		}
-		if (res < 0) {
-			fprintf(stderr, "SetFan: write failed %s\n", hid_error(cl->handle));
-			return 1;
+			CorsairBatch_writeReg(&batch, FAN_Select, fanIndex);
+			CorsairBatch_writeReg(&batch, FAN_FixedRPM, fanInfo->RPM);
+			rpmOp = CorsairBatch_readReg(&batch, FAN_FixedRPM);
 		}
+	}
 
-		res = hid_read_wrapper(cl, cl->handle, buf);
-		if (res < 0) {
-			fprintf(stderr, "SetFan: read failed %s\n", hid_error(cl->handle));
-			return 1;
-		}
-		if (interface == H80I) {
-			if(fanInfo->Mode != buf[6]){
-				fprintf(stderr, "SetFan: Cannot set fan mode.\n");
-				return 1;
-			}
-		}
-	} else {
-		fprintf(stderr, "Invalid fan mode.\n");
+	if (CorsairBatch_run(&batch)) {
+		/* No telling what made it to the device */
+		ShadowInvalidate(cl);
+		fprintf(stderr, "SetFan: transfer failed\n");
 		return 1;
 	}
-	if(fanInfo->RPM != 0) {
-		memset(buf,0x00,sizeof(buf));
 
-		if (interface == CLINK) {
-			buf[0] = 0x05; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = WriteOneByte; // Command Opcode
-			buf[3] = FanFixRPMIndxToPort[fanIndex]; // Command data...
-			buf[4] = fanInfo->RPM & 0x00ff;
-			buf[5] = fanInfo->RPM >> 8;
-
-			res = hid_write(cl->handle, &buf[1], 5);
-		} else {
-			buf[0] = 0x0b; // Length
-			buf[1] = cl->CommandId++; // Command ID
-			buf[2] = WriteOneByte; // Command Opcode
-			buf[3] = FAN_Select; // Command data...
-			buf[4] = fanIndex; // select fan
-			buf[5] = cl->CommandId++; // Command ID
-			buf[6] = WriteTwoBytes; // Command Opcode
-			buf[7] = FAN_FixedRPM; // Command data...
-			buf[8] = fanInfo->RPM & 0x00FF;
-			buf[9] = fanInfo->RPM >> 8;
-			buf[10] = cl->CommandId++; // Command ID
-			buf[11] = ReadTwoBytes; // Command Opcode
-			buf[12] = FAN_ReadRPM; // Command data...
-
-			res = hid_write(cl->handle, buf, 18);
-		}
-		if (res < 0) {
-			fprintf(stderr, "SetFan: write failed %s\n", hid_error(cl->handle));
+	if (interface == H80I) {
+		ShadowSet(cl, FAN_Mode, fanIndex, CorsairBatch_value(&batch, modeOp));
+		if (rpmOp >= 0)
+			ShadowSet(cl, FAN_FixedRPM, fanIndex, CorsairBatch_value(&batch, rpmOp));
+		if((fanInfo->Mode & 0x0e) != (CorsairBatch_value(&batch, modeOp) & 0x0e)){
+			fprintf(stderr, "SetFan: Cannot set fan mode.\n");
 			return 1;
 		}
-
-		res = hid_read_wrapper(cl, cl->handle, buf);
-		if (res < 0) {
-			fprintf(stderr, "SetFan: read failed %s\n", hid_error(cl->handle));
+		if(rpmOp >= 0 && (unsigned int)fanInfo->RPM != CorsairBatch_value(&batch, rpmOp)){
+			fprintf(stderr, "SetFan: Cannot set fan RPM.\n");
 			return 1;
 		}
-		//All data is little-endian.
-		if (interface != CLINK) {
-			rpm = buf[7] << 8;
-			rpm += buf[6];
-			if(fanInfo->RPM != rpm){
-				fprintf(stderr, "SetFan: Cannot set fan mode.\n");
-				return 1;
-			}
-		}
 	}
 
 	return 0;
@@ -493,8 +492,7 @@ int SetFansInfo(CorsairLink_t *cl, int interface, int fanIndex, CorsairFanInfo_t
 
 void Close(CorsairLink_t *cl) {
 	if(cl->handle != NULL){	
-		hid_close(cl->handle);
-		hid_exit();
+		cl->transport->close(cl->handle);
 		cl->handle = NULL;
 	}
 }
@@ -505,7 +503,7 @@ char *GetManufacturer(CorsairLink_t *cl){
 	int res;
 
 	wstr[0] = 0x0000;
-	res = hid_get_manufacturer_string(cl->handle, wstr, MAX_STR);
+	res = cl->transport->get_manufacturer(cl->handle, wstr, MAX_STR);
 	if (res < 0)
 		fprintf(stderr, "Unable to read manufacturer string\n");
 	str = malloc((wcslen(wstr)+2) * sizeof(wchar_t));
@@ -519,7 +517,7 @@ char *GetProduct(CorsairLink_t *cl){
 	int res;
 
 	wstr[0] = 0x0000;
-	res = hid_get_product_string(cl->handle, wstr, MAX_STR);
+	res = cl->transport->get_product(cl->handle, wstr, MAX_STR);
 	if (res < 0)
 		fprintf(stderr, "Unable to read product string\n");
 	str = malloc((wcslen(wstr)+2) * sizeof(wchar_t));
@@ -535,25 +533,101 @@ void Csleep(int ms){
 	#endif
 }
 
+unsigned long long Ctime_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
 
-int hid_read_wrapper(CorsairLink_t *cl, hid_device *handle, unsigned char *buf)
+/* Wall clock, for timestamps handed to other programs */
+unsigned long long Cwalltime_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Count one transaction that took us from its request going out to
+ * its reply being routed back to it.
+ */
+void RecordLatency(CorsairLatency_t *lat, unsigned long long us)
+{
+	int bucket = 0;
+
+	while (bucket < CL_LAT_BUCKETS - 1 && (1ULL << bucket) <= us)
+		bucket++;
+	lat->hist[bucket]++;
+	if (lat->count == 0 || us < lat->min_us)
+		lat->min_us = us;
+	if (us > lat->max_us)
+		lat->max_us = us;
+	lat->total_us += us;
+	lat->count++;
+}
+
+/*
+ * Start writing a request. Where the transport can, the write goes on
+ * in the background and *token is what hid_write_collect() takes;
+ * otherwise it is done before this returns and *token is 0. Returns
+ * -1 on error.
+ */
+int hid_write_wrapper(CorsairLink_t *cl, const unsigned char *buf, size_t len, int *token)
+{
+	cl->xfer_start_us = Ctime_us();
+	*token = 0;
+	if (!cl->transport->write_async)
+		return cl->transport->write(cl->handle, buf, len);
+	/* A write still going when its reply is due has failed too */
+	*token = cl->transport->write_async(cl->handle, buf, len, cl->max_ms_read_wait);
+	if (*token > 0)
+		return *token;
+	*token = 0;
+	return -1;
+}
+
+/*
+ * Wait for a write hid_write_wrapper() started. Returns the bytes
+ * written or -1 on error.
+ */
+int hid_write_collect(CorsairLink_t *cl, int token)
+{
+	if (token == 0)
+		return 0;
+	return cl->transport->write_wait(cl->handle, token, -1);
+}
+
+/*
+ * Wait for a reply and point *buf at the transport's own copy of it,
+ * which stays valid until transport->release(). Returns its length, 0
+ * on timeout or -1 on error.
+ */
+int hid_read_wrapper(CorsairLink_t *cl, const unsigned char **buf)
 {
-	// Read requested state. hid_read() has been set to be
-	// non-blocking by the call to hid_set_nonblocking() above.
-	// This loop demonstrates the non-blocking nature of hid_read().
 	int res = 0;
 	int sleepTotal = 0;
-	while (res == 0 && sleepTotal < cl->max_ms_read_wait) {
-		res = hid_read(handle, buf, sizeof(buf));
-		if (res < 0)
-			fprintf(stderr, "Unable to read()n");
-		
-		Csleep(100);
-		sleepTotal += 100;
-	}
-	if(sleepTotal == cl->max_ms_read_wait) {
-		res = 0;
+
+	if (cl->read_mode == CL_READ_POLL) {
+		// Read requested state, without waiting in hidapi.
+		while (res == 0 && sleepTotal < cl->max_ms_read_wait) {
+			res = cl->transport->read(cl->handle, buf, 0);
+			if (res != 0)
+				break;
+			Csleep(100);
+			sleepTotal += 100;
+		}
+	} else {
+		/*
+		 * Sleep in the backend until the reply shows up or the
+		 * deadline passes, so a 2ms reply costs 2ms and not 100ms.
+		 */
+		res = cl->transport->read(cl->handle, buf, cl->max_ms_read_wait);
 	}
-	return 1;
-}
 
+	if (res < 0)
+		fprintf(stderr, "Unable to read()\n");
+	return res;
+}
@@ -183,12 +183,92 @@ enum CorsairLedModes {
 };
 
 #define NUMFANS			5
+#define NUMTEMPS		4
+
+/* How hid_read_wrapper() waits for a reply */
+#define CL_READ_BLOCKING	0	/* hid_read_borrow() up to max_ms_read_wait (default) */
+#define CL_READ_POLL		1	/* old non-blocking read + Csleep(100) loop */
+
+/*
+ * Per transaction latency, from the request write to its reply.
+ * Bucket N counts replies that took less than 2^N microseconds
+ * (the last bucket catches everything slower).
+ */
+#define CL_LAT_BUCKETS		24
+
+struct CorsairLatency {
+	unsigned long		count;
+	unsigned long		timeouts;
+	unsigned long long	total_us;
+	unsigned long long	min_us;
+	unsigned long long	max_us;
+	unsigned long		hist[CL_LAT_BUCKETS];
+};
+
+typedef struct CorsairLatency CorsairLatency_t;
+
+/*
+ * Shadow copy of the H80i register space (CorsairLinkCommands).
+ * Registers behind FAN_Select, TEMP_SelectActiveSensor or
+ * LED_SelectCurrent keep one copy per channel, the rest use channel 0.
+ */
+#define CL_NUM_REGS		(FAN_TempTable + 1)
+#define CL_NUM_CHANNELS		NUMFANS
+
+/* Shadow time-to-live values in ms */
+#define CL_TTL_FOREVER		-1	/* Never changes while the device is open */
+#define CL_TTL_NONE		0	/* Always read from the device */
+#define CL_TTL_MODE		5000	/* Settings that only change when someone sets them */
+
+struct CorsairShadowReg {
+	int			valid;
+	unsigned long long	stamp_us;	/* When value was read */
+	unsigned int		value;
+};
+
+typedef struct CorsairShadowReg CorsairShadowReg_t;
+
+/*
+ * Requests allowed in flight at once (see CorsairPipe.h). One is the
+ * old request/reply lock step and the safe default, more only helps
+ * with firmware that queues requests. The most is the number of
+ * writes hid_write_async() keeps in flight per device.
+ */
+#define CL_DEFAULT_WINDOW	1
+#define CL_MAX_WINDOW		8
+
+/* Command IDs recently answered, to tell duplicates from stale replies */
+#define CL_RECENT_IDS		16
+/* Command IDs recently given up on, whose replies may still come */
+#define CL_STALE_IDS		16
+
+/* Room for a hidapi device path and serial number */
+#define CL_MAX_PATH		256
+#define CL_MAX_SERIAL		64
 
 struct CorsairLink {
 	CorsairFanInfo_t	fans[NUMFANS];
-	hid_device		*handle;
+	const struct CorsairTransport *transport;	/* NULL for hidapi */
+	void			*handle;	/* From transport->open(), NULL when closed */
+	char			path[CL_MAX_PATH];	/* Device to open, empty for the first one found */
 	unsigned int		CommandId;
 	int			max_ms_read_wait;
+	int			read_mode;
+	unsigned long long	xfer_start_us;	/* When the last request was written */
+	CorsairLatency_t	latency;
+	int			interface;	/* H80I or CLINK */
+	CorsairShadowReg_t	shadow[CL_NUM_REGS][CL_NUM_CHANNELS];
+	unsigned long		shadow_hits;
+	unsigned long		shadow_misses;
+	int			window;		/* Most transactions in flight */
+	int			inflight;
+	struct CorsairXfer	*pending[CL_MAX_WINDOW];	/* Oldest first */
+	unsigned char		recent[CL_RECENT_IDS];
+	int			recent_next;
+	unsigned char		stale[CL_STALE_IDS];
+	int			stale_next;
+	unsigned long		stale_replies;	/* Replies to nothing we sent or gave up on */
+	unsigned long		dup_replies;	/* Second reply to a finished request */
 };
 
 typedef struct CorsairLink CorsairLink_t;
@@ -206,7 +286,16 @@ char *GetManufacturer(CorsairLink_t *);
 char *GetProduct(CorsairLink_t *);
 void ReadFansInfo(CorsairLink_t *, int );
 int SetFansInfo(CorsairLink_t *, int, int, CorsairFanInfo_t *);
-int hid_read_wrapper(CorsairLink_t *, hid_device *, unsigned char *);
+int hid_read_wrapper(CorsairLink_t *, const unsigned char **);
+int hid_write_wrapper(CorsairLink_t *, const unsigned char *, size_t, int *);
+int hid_write_collect(CorsairLink_t *, int);
 void Csleep(int);
+unsigned long long Ctime_us(void);
+void RecordLatency(CorsairLatency_t *, unsigned long long);
+unsigned long long Cwalltime_ms(void);
 int ConnectedTemps(CorsairLink_t *, int);
 unsigned short ReadTempInfo(CorsairLink_t *, int, int);
+int ReadAllInfo(CorsairLink_t *, int, unsigned short *, int);
+int ShadowGet(CorsairLink_t *, int, int, unsigned int *);
+void ShadowSet(CorsairLink_t *, int, int, unsigned int);
+void ShadowInvalidate(CorsairLink_t *);
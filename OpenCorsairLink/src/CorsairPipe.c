@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairFrame.h"
+#include "CorsairPipe.h"
+#include "CorsairTransport.h"
+
+static int window(CorsairLink_t *cl)
+{
+	if (cl->window < 1)
+		return CL_DEFAULT_WINDOW;
+	if (cl->window > CL_MAX_WINDOW)
+		return CL_MAX_WINDOW;
+	return cl->window;
+}
+
+static int id_in(const unsigned char *ids, int count, unsigned char cmdId)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (ids[i] == cmdId)
+			return 1;
+	}
+	return 0;
+}
+
+static int recently_done(CorsairLink_t *cl, unsigned char cmdId)
+{
+	return id_in(cl->recent, CL_RECENT_IDS, cmdId);
+}
+
+/*
+ * Whether cmdId may still get a reply: it is in flight, was answered
+ * lately (a duplicate may follow) or was given up on (the real reply
+ * may yet come). A new request must not go out with it, or that late
+ * reply would be taken for the new request's answer.
+ */
+int CorsairPipe_id_busy(CorsairLink_t *cl, unsigned char cmdId)
+{
+	int i;
+
+	for (i = 0; i < cl->inflight; i++) {
+		if (cl->pending[i]->cmdId == cmdId)
+			return 1;
+	}
+	return recently_done(cl, cmdId) || id_in(cl->stale, CL_STALE_IDS, cmdId);
+}
+
+/*
+ * Take pending[slot] off the in-flight list and run its callback.
+ */
+static void complete(CorsairLink_t *cl, int slot, int status,
+		     const unsigned char *reply, int len)
+{
+	CorsairXfer_t *x = cl->pending[slot];
+	int i;
+
+	for (i = slot; i < cl->inflight - 1; i++)
+		cl->pending[i] = cl->pending[i + 1];
+	cl->inflight--;
+
+	/* A request that never made it out explains its timeout */
+	if (hid_write_collect(cl, x->token) < 0 && status == CL_XFER_TIMEOUT)
+		status = CL_XFER_ERROR;
+	x->token = 0;
+
+	if (status == CL_XFER_OK) {
+		/* Only a reply routed to this request says how long it took */
+		RecordLatency(&cl->latency, Ctime_us() - x->sent_us);
+		cl->recent[cl->recent_next] = x->cmdId;
+		cl->recent_next = (cl->recent_next + 1) % CL_RECENT_IDS;
+	} else {
+		if (status == CL_XFER_TIMEOUT)
+			cl->latency.timeouts++;
+		/* Its reply may still turn up, and must not be taken for another's */
+		cl->stale[cl->stale_next] = x->cmdId;
+		cl->stale_next = (cl->stale_next + 1) % CL_STALE_IDS;
+	}
+	x->state = CL_XFER_DONE;
+	if (x->done)
+		x->done(x, status, reply, len);
+}
+
+/*
+ * Find the transaction a reply belongs to, -1 if none. Only the
+ * command ID counts: a reply with the right opcode but another ID is
+ * a late answer to something else, even in lock step.
+ */
+static int route(CorsairLink_t *cl, const unsigned char *reply)
+{
+	int i;
+
+	for (i = 0; i < cl->inflight; i++) {
+		if (cl->pending[i]->cmdId == reply[0])
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Wait for one reply and hand it to its transaction. A timeout fails
+ * the oldest transaction. Returns -1 on a read error, 0 otherwise.
+ */
+int CorsairPipe_pump(CorsairLink_t *cl)
+{
+	const unsigned char *buf;
+	int res, slot;
+
+	if (cl->inflight == 0)
+		return 0;
+
+	res = hid_read_wrapper(cl, &buf);
+	if (res < 0) {
+		fprintf(stderr, "Error: Unable to read() %s\n", cl->transport->error(cl->handle));
+		CorsairPipe_cancel(cl);
+		return -1;
+	}
+	if (res == 0) {
+		complete(cl, 0, CL_XFER_TIMEOUT, NULL, 0);
+		return 0;
+	}
+
+	/* The reply is read in place, and given back once handled */
+	slot = route(cl, buf);
+	if (slot < 0) {
+		if (recently_done(cl, buf[0]))
+			cl->dup_replies++;
+		else
+			cl->stale_replies++;
+	} else {
+		complete(cl, slot, CL_XFER_OK, buf, res);
+	}
+	cl->transport->release(cl->handle);
+	return 0;
+}
+
+/*
+ * Send a transaction, first waiting for room in the window.
+ * Returns 0 once it is on its way; on failure the callback has
+ * already been run with CL_XFER_ERROR.
+ */
+int CorsairPipe_submit(CorsairLink_t *cl, CorsairXfer_t *x)
+{
+	int res;
+
+	while (cl->inflight >= window(cl)) {
+		if (CorsairPipe_pump(cl) < 0)
+			break;
+	}
+
+	if (cl->interface == CLINK) {
+		x->cmdId = x->req[0];
+		x->opcode = x->req[1];
+	} else {
+		/* H80i frames lead with the length byte */
+		x->cmdId = x->req[1];
+		x->opcode = x->req[2];
+	}
+
+	res = hid_write_wrapper(cl, x->req, x->req_len, &x->token);
+	if (res < 0) {
+		fprintf(stderr, "Error: Unable to write() %s\n", cl->transport->error(cl->handle));
+		x->state = CL_XFER_DONE;
+		if (x->done)
+			x->done(x, CL_XFER_ERROR, NULL, 0);
+		return -1;
+	}
+	x->sent_us = cl->xfer_start_us;
+	x->state = CL_XFER_SENT;
+	cl->pending[cl->inflight++] = x;
+	return 0;
+}
+
+/*
+ * Wait until every transaction in flight has finished.
+ */
+int CorsairPipe_drain(CorsairLink_t *cl)
+{
+	while (cl->inflight > 0) {
+		if (CorsairPipe_pump(cl) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Give up on everything in flight.
+ */
+void CorsairPipe_cancel(CorsairLink_t *cl)
+{
+	while (cl->inflight > 0)
+		complete(cl, 0, CL_XFER_ERROR, NULL, 0);
+}
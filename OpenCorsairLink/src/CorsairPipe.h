@@ -0,0 +1,41 @@
+
+/*
+ * Asynchronous transactions: a request report is submitted with a
+ * completion callback and up to cl->window of them may be in flight at
+ * once. Each reply is routed back to its request by the command ID in
+ * its first byte, like the pend_cmdID check in the kernel drivers.
+ * Replies nobody is waiting for are dropped and counted, and no ID
+ * that may still get one goes out again until it has aged out.
+ */
+
+/* Transaction states */
+#define CL_XFER_IDLE		0
+#define CL_XFER_SENT		1	/* Waiting for its reply */
+#define CL_XFER_DONE		2	/* Callback has run */
+
+/* Completion status handed to the callback */
+#define CL_XFER_OK		0
+#define CL_XFER_TIMEOUT		-1
+#define CL_XFER_ERROR		-2
+
+typedef struct CorsairXfer CorsairXfer_t;
+
+typedef void (*CorsairXferDone_t)(CorsairXfer_t *, int, const unsigned char *, int);
+
+struct CorsairXfer {
+	unsigned char		req[CL_MAX_FRAME];
+	int			req_len;	/* Bytes of req handed to hid_write() */
+	int			token;		/* Write still to collect, 0 if none */
+	unsigned char		cmdId;		/* ID of the first request in req */
+	unsigned char		opcode;		/* Opcode of the first request */
+	int			state;
+	unsigned long long	sent_us;
+	CorsairXferDone_t	done;		/* Called with status, reply, reply length */
+	void			*ctx;
+};
+
+int CorsairPipe_submit(CorsairLink_t *, CorsairXfer_t *);
+int CorsairPipe_pump(CorsairLink_t *);
+int CorsairPipe_drain(CorsairLink_t *);
+void CorsairPipe_cancel(CorsairLink_t *);
+int CorsairPipe_id_busy(CorsairLink_t *, unsigned char);
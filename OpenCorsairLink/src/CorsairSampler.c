@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+#include <pthread.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairSampler.h"
+#include "CorsairTransport.h"
+#include "corsairlink_temp.h"
+
+#define HIST_BUCKETS	65536
+#define RING_MASK	(CL_SAMPLE_RING - 1)
+
+/* Sweep intervals are kept in 10us steps so they fit the histogram */
+#define INTERVAL_UNIT	10
+
+/*
+ * Single producer (the sampling loop), single consumer (the writer).
+ * head is only written by the producer and tail only by the consumer.
+ */
+struct Ring {
+	CorsairSample_t		*slot;
+	unsigned long		head;
+	unsigned long		tail;
+	unsigned long		overruns;	/* Sweeps dropped because the ring was full */
+	int			done;		/* Producer has finished */
+};
+
+struct Writer {
+	struct Ring		*ring;
+	FILE			*out;
+	int			num_temps;
+	unsigned long long	first_us;
+	unsigned long long	last_us;
+	unsigned long		failed;		/* Sweeps that did not get every reply */
+	CorsairChanStats_t	chan[CL_SAMPLE_CHANNELS];
+	CorsairChanStats_t	interval;
+};
+
+static volatile sig_atomic_t sampler_stop = 0;
+
+static void sampler_signal(int sig)
+{
+	sampler_stop = 1;
+}
+
+static void stats_add(CorsairChanStats_t *s, unsigned int v)
+{
+	long long d;
+
+	if (s->count == 0 || v < s->min)
+		s->min = v;
+	if (v > s->max)
+		s->max = v;
+	if (s->count > 0) {
+		d = (long long)v - s->last;
+		s->sum_sq_diff += d * d;
+	}
+	s->last = v;
+	s->sum += v;
+	s->hist[v < HIST_BUCKETS ? v : HIST_BUCKETS - 1]++;
+	s->count++;
+}
+
+static unsigned int stats_p99(CorsairChanStats_t *s)
+{
+	unsigned long want, seen = 0;
+	unsigned int i;
+
+	want = s->count - s->count / 100;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += s->hist[i];
+		if (seen >= want)
+			return i;
+	}
+	return HIST_BUCKETS - 1;
+}
+
+/* RMS of the change from one sample to the next */
+static double stats_jitter(CorsairChanStats_t *s)
+{
+	if (s->count < 2)
+		return 0.0;
+	return sqrt((double)s->sum_sq_diff / (s->count - 1));
+}
+
+static void write_sample(struct Writer *w, CorsairSample_t *smp)
+{
+	unsigned int milli;
+	int i;
+
+	if (w->last_us == 0) {
+		w->first_us = smp->t_us;
+	} else {
+		stats_add(&w->interval, (smp->t_us - w->last_us) / INTERVAL_UNIT);
+	}
+	w->last_us = smp->t_us;
+
+	if (smp->status) {
+		w->failed++;
+	} else {
+		for (i = 0; i < CL_SAMPLE_CHANNELS; i++) {
+			if (i < NUMTEMPS && i >= w->num_temps)
+				continue;
+			stats_add(&w->chan[i], smp->value[i]);
+		}
+	}
+
+	if (w->out == NULL)
+		return;
+	fprintf(w->out, "%llu,%d", smp->t_us - w->first_us, smp->status);
+	for (i = 0; i < w->num_temps; i++) {
+		milli = corsairlink_temp_milli(smp->value[i]);
+		fprintf(w->out, ",%u.%03u", milli / 1000, milli % 1000);
+	}
+	for (i = NUMTEMPS; i < CL_SAMPLE_CHANNELS; i++)
+		fprintf(w->out, ",%u", smp->value[i]);
+	fputc('\n', w->out);
+}
+
+/*
+ * Drain the ring until the producer is done and the ring is empty.
+ */
+static void *writer_thread(void *arg)
+{
+	struct Writer *w = arg;
+	struct Ring *r = w->ring;
+	unsigned long head, tail;
+
+	tail = r->tail;
+	for (;;) {
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			if (__atomic_load_n(&r->done, __ATOMIC_ACQUIRE) &&
+			    __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+				break;
+			usleep(1000);
+			continue;
+		}
+		while (tail != head) {
+			write_sample(w, &r->slot[tail & RING_MASK]);
+			tail++;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+	if (w->out)
+		fflush(w->out);
+	return NULL;
+}
+
+static void print_stats(struct Writer *w, unsigned long overruns)
+{
+	CorsairChanStats_t *s;
+	unsigned int mn, mx, p99, mean;
+	double secs;
+	int i;
+
+	secs = (w->last_us - w->first_us) / 1000000.0;
+	printf("Sweeps: %lu in %.3f s (%.1f Hz)  failed: %lu  dropped: %lu\n",
+		w->interval.count + 1, secs,
+		secs > 0 ? w->interval.count / secs : 0.0, w->failed, overruns);
+	if (w->interval.count > 0) {
+		s = &w->interval;
+		printf("Interval ms: min %.2f mean %.2f max %.2f p99 %.2f jitter %.2f\n",
+			s->min * INTERVAL_UNIT / 1000.0,
+			(double)s->sum / s->count * INTERVAL_UNIT / 1000.0,
+			s->max * INTERVAL_UNIT / 1000.0,
+			stats_p99(s) * INTERVAL_UNIT / 1000.0,
+			stats_jitter(s) * INTERVAL_UNIT / 1000.0);
+	}
+
+	for (i = 0; i < CL_SAMPLE_CHANNELS; i++) {
+		s = &w->chan[i];
+		if (s->count == 0)
+			continue;
+		mean = (unsigned int)((s->sum + s->count / 2) / s->count);
+		p99 = stats_p99(s);
+		if (i < NUMTEMPS) {
+			mn = corsairlink_temp_milli(s->min);
+			mx = corsairlink_temp_milli(s->max);
+			p99 = corsairlink_temp_milli(p99);
+			mean = corsairlink_temp_milli(mean);
+			printf("Sensor %d C: min %u.%03u mean %u.%03u max %u.%03u p99 %u.%03u jitter %.3f\n",
+				i + 1, mn / 1000, mn % 1000, mean / 1000, mean % 1000,
+				mx / 1000, mx % 1000, p99 / 1000, p99 % 1000,
+				stats_jitter(s) / 256.0);
+		} else {
+			printf("Fan %d RPM: min %u mean %u max %u p99 %u jitter %.1f\n",
+				i - NUMTEMPS + 1, s->min, mean, s->max, p99, stats_jitter(s));
+		}
+	}
+}
+
+/*
+ * Sample one device for seconds (0 until SIGINT) at rate Hz (0 as
+ * fast as it answers). Raw samples go to path as CSV if given.
+ */
+int CorsairSampler_run(CorsairLink_t *cl, int interface, int seconds, int rate, const char *path)
+{
+	static struct Ring ring;
+	static struct Writer w;
+	struct hid_input_stats usb;
+	unsigned short temps[NUMTEMPS];
+	unsigned long long start_us, next_us, now, period_us = 0;
+	CorsairSample_t *smp;
+	pthread_t writer;
+	unsigned long head;
+	int num_temps;
+	int status;
+	int i, res = 0;
+
+	num_temps = ConnectedTemps(cl, interface);
+	if (num_temps > NUMTEMPS)
+		num_temps = NUMTEMPS;
+	if (num_temps < 0)
+		num_temps = 0;
+
+	/* Everything the run needs is allocated up front */
+	memset(&ring, 0x00, sizeof(ring));
+	memset(&w, 0x00, sizeof(w));
+	ring.slot = calloc(CL_SAMPLE_RING, sizeof(CorsairSample_t));
+	w.interval.hist = calloc(HIST_BUCKETS, sizeof(unsigned int));
+	if (ring.slot == NULL || w.interval.hist == NULL)
+		res = 1;
+	for (i = 0; i < CL_SAMPLE_CHANNELS; i++) {
+		w.chan[i].hist = calloc(HIST_BUCKETS, sizeof(unsigned int));
+		if (w.chan[i].hist == NULL)
+			res = 1;
+	}
+	if (res) {
+		fprintf(stderr, "Unable to allocate sample buffers\n");
+		goto out;
+	}
+	w.ring = &ring;
+	w.num_temps = num_temps;
+	if (path) {
+		w.out = fopen(path, "w");
+		if (w.out == NULL) {
+			fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+			res = 1;
+			goto out;
+		}
+		setvbuf(w.out, NULL, _IOFBF, 1 << 16);
+		fprintf(w.out, "t_us,status");
+		for (i = 0; i < num_temps; i++)
+			fprintf(w.out, ",temp%d", i + 1);
+		for (i = 0; i < NUMFANS; i++)
+			fprintf(w.out, ",fan%d_rpm", i + 1);
+		fputc('\n', w.out);
+	}
+
+	if (pthread_create(&writer, NULL, writer_thread, &w)) {
+		fprintf(stderr, "Unable to start writer thread\n");
+		res = 1;
+		goto out;
+	}
+
+	sampler_stop = 0;
+	signal(SIGINT, sampler_signal);
+	signal(SIGTERM, sampler_signal);
+
+	if (rate > 0)
+		period_us = 1000000ULL / rate;
+	start_us = next_us = Ctime_us();
+	head = 0;
+	while (!sampler_stop) {
+		if (seconds > 0 && Ctime_us() - start_us >= seconds * 1000000ULL)
+			break;
+		if (period_us) {
+			now = Ctime_us();
+			/* Keep to the rate, but never burst to catch up */
+			if (next_us > now)
+				usleep(next_us - now);
+			else
+				next_us = now;
+			next_us += period_us;
+		}
+
+		status = ReadAllInfo(cl, interface, temps, num_temps);
+
+		if (head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) >= CL_SAMPLE_RING) {
+			ring.overruns++;
+			continue;
+		}
+		smp = &ring.slot[head & RING_MASK];
+		smp->t_us = Ctime_us();
+		smp->status = status;
+		for (i = 0; i < NUMTEMPS; i++)
+			smp->value[i] = i < num_temps ? temps[i] : 0;
+		for (i = 0; i < NUMFANS; i++)
+			smp->value[NUMTEMPS + i] = cl->fans[i].RPM;
+		head++;
+		__atomic_store_n(&ring.head, head, __ATOMIC_RELEASE);
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	__atomic_store_n(&ring.done, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+
+	print_stats(&w, ring.overruns);
+	if (cl->transport->input_stats(cl->handle, &usb) == 0)
+		printf("USB input reports: %lu received, %lu dropped, at most %u of %u queued\n",
+			usb.received, usb.dropped, usb.max_queued, usb.capacity);
+
+out:
+	if (w.out)
+		fclose(w.out);
+	for (i = 0; i < CL_SAMPLE_CHANNELS; i++)
+		free(w.chan[i].hist);
+	free(w.interval.hist);
+	free(ring.slot);
+	return res;
+}
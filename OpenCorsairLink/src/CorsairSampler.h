@@ -0,0 +1,37 @@
+
+/*
+ * High-rate sampling: sweep one device as fast as the USB round trips
+ * allow (or at a fixed rate), push each sweep into a preallocated
+ * single producer/single consumer ring and let a writer thread drain
+ * it to disk and keep the statistics. Nothing on the sampling side
+ * allocates, locks or touches the file.
+ */
+
+/* Ring slots, a power of two */
+#define CL_SAMPLE_RING		4096
+
+/* Channels per sample: every temperature sensor, then every fan */
+#define CL_SAMPLE_CHANNELS	(NUMTEMPS + NUMFANS)
+
+struct CorsairSample {
+	unsigned long long	t_us;		/* Ctime_us() when the sweep finished */
+	int			status;		/* ReadAllInfo() result */
+	unsigned short		value[CL_SAMPLE_CHANNELS];	/* Raw temps, then RPMs */
+};
+
+typedef struct CorsairSample CorsairSample_t;
+
+/* Running statistics for one channel, kept by the writer thread */
+struct CorsairChanStats {
+	unsigned long		count;
+	unsigned int		min;
+	unsigned int		max;
+	unsigned long long	sum;
+	unsigned long long	sum_sq_diff;	/* Of successive differences, for jitter */
+	unsigned int		last;
+	unsigned int		*hist;		/* 65536 buckets, for p99 */
+};
+
+typedef struct CorsairChanStats CorsairChanStats_t;
+
+int CorsairSampler_run(CorsairLink_t *, int, int, int, const char *);
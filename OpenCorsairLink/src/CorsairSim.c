@@ -0,0 +1,864 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairFrame.h"
+#include "CorsairDevices.h"
+#include "CorsairTransport.h"
+#include "CorsairSim.h"
+
+#define SIM_REPORT		64	/* Input report size of both devices */
+#define SIM_REG_BYTES		12	/* Widest register, LED_CycleColors */
+
+#define SIM_AMBIENT		25.0	/* deg C */
+#define SIM_LOAD_PERIOD		60.0	/* s for the heat load to rise and fall again */
+#define SIM_FAN_TAU		1.5	/* s for a fan to get 63% of the way to its target */
+#define SIM_TEMP_TAU		8.0	/* s for a sensor to do the same */
+
+static CorsairSimConfig_t sim_config = {
+	.h80i		= 1,
+	.clink		= 1,
+	.latency_us	= CL_SIM_DEFAULT_LATENCY,
+	.seed		= 1,
+};
+
+struct SimFan {
+	int		present;
+	int		tach;		/* 4-pin fan */
+	double		top_rpm;	/* Flat out */
+	double		rpm;
+	double		max_rpm;	/* Since power-on */
+};
+
+struct SimTemp {
+	double		offset;		/* How much warmer than the coolant */
+	double		value;		/* deg C */
+};
+
+struct SimReply {
+	unsigned long long	due_us;	/* Not readable before this */
+	int			len;
+	unsigned char		data[SIM_REPORT];
+};
+
+struct SimDevice {
+	int			interface;	/* H80I or CLINK */
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;		/* A reply was queued */
+	unsigned int		rng;
+	unsigned long long	start_us;
+	unsigned long long	step_us;	/* Model last brought up to date */
+	int			num_temps;
+	struct SimFan		fan[NUMFANS];
+	struct SimTemp		temp[NUMTEMPS];
+	int			fan_select;
+	int			temp_select;
+	int			led_select;
+	/* Written registers, one copy per channel like the shadow */
+	unsigned char		regs[CL_NUM_REGS][CL_NUM_CHANNELS][SIM_REG_BYTES];
+	struct SimReply		queue[CL_SIM_QUEUE];
+	int			head;
+	int			count;
+	unsigned long long	last_due_us;	/* Replies never overtake each other by themselves */
+	struct SimReply		held;		/* Reordered, goes out after the next one */
+	int			holding;
+	unsigned char		lent[SIM_REPORT];
+	struct hid_input_stats	stats;
+};
+
+/* xorshift32, so runs with the same seed see the same faults */
+static unsigned int sim_rand(struct SimDevice *d)
+{
+	unsigned int x = d->rng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return d->rng = x;
+}
+
+static int sim_chance(struct SimDevice *d, unsigned int ppm)
+{
+	return ppm && sim_rand(d) % 1000000 < ppm;
+}
+
+/* Uniform in [-1, 1] */
+static double sim_noise(struct SimDevice *d)
+{
+	return sim_rand(d) / 2147483647.5 - 1.0;
+}
+
+static unsigned int le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void put_le16(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+/*
+ * Temperature a fan in a curve mode follows: the sensor picked by
+ * bits 6-4 of its mode, 7 being whatever was written to
+ * FAN_ReportExtTemp.
+ */
+static double fan_temp(struct SimDevice *d, int i)
+{
+	int chan = (d->regs[FAN_Mode][i][0] >> 4) & 0x07;
+
+	if (chan == 7)
+		return le16(d->regs[FAN_ReportExtTemp][i]) / 256.0;
+	if (chan >= d->num_temps)
+		chan = 0;
+	return d->temp[chan].value;
+}
+
+/*
+ * RPM the controller drives fan i towards in its current mode.
+ * Temperature tables are 8.8 fixed point like TEMP_Read.
+ */
+static double fan_target(struct SimDevice *d, int i)
+{
+	struct SimFan *f = &d->fan[i];
+	const unsigned char *rpms = d->regs[FAN_RPMTable][i];
+	const unsigned char *temps = d->regs[FAN_TempTable][i];
+	double temp, lo, hi, t0, t1, frac, rpm;
+	int n;
+
+	if (!f->present)
+		return 0.0;
+
+	switch (d->regs[FAN_Mode][i][0] & 0x0e) {
+	case 0x00:
+		return 0.0;
+	case FixedPWM:
+		return f->top_rpm * d->regs[FAN_FixedPWM][i][0] / 255.0;
+	case FixedRPM:
+		rpm = le16(d->regs[FAN_FixedRPM][i]);
+		return rpm < f->top_rpm ? rpm : f->top_rpm;
+	case Custom:
+		temp = fan_temp(d, i);
+		if (temp <= le16(&temps[0]) / 256.0)
+			return le16(&rpms[0]);
+		for (n = 1; n < 5; n++) {
+			t0 = le16(&temps[2 * (n - 1)]) / 256.0;
+			t1 = le16(&temps[2 * n]) / 256.0;
+			if (temp < t1 && t1 > t0) {
+				frac = (temp - t0) / (t1 - t0);
+				return le16(&rpms[2 * (n - 1)]) +
+					frac * ((double)le16(&rpms[2 * n]) - le16(&rpms[2 * (n - 1)]));
+			}
+		}
+		return le16(&rpms[8]);
+	case Quiet:
+		lo = 0.25;
+		hi = 0.60;
+		break;
+	case Performance:
+		lo = 0.50;
+		hi = 1.00;
+		break;
+	default:	/* Default and Balanced */
+		lo = 0.35;
+		hi = 0.80;
+		break;
+	}
+
+	/* Curve modes ramp from lo at 30C to hi at 50C */
+	frac = (fan_temp(d, i) - 30.0) / 20.0;
+	if (frac < 0.0)
+		frac = 0.0;
+	if (frac > 1.0)
+		frac = 1.0;
+	return f->top_rpm * (lo + (hi - lo) * frac);
+}
+
+/*
+ * Advance the model to now. Fans chase their targets and wobble a
+ * little, sensors follow a slow load cycle less what the fans take
+ * away, both as first order lags.
+ */
+static void sim_step(struct SimDevice *d, unsigned long long now)
+{
+	struct SimFan *f;
+	double dt, t, k, load, target;
+	double cooling = 0.0;
+	int i, fans = 0;
+
+	if (now <= d->step_us)
+		return;
+	dt = (now - d->step_us) / 1000000.0;
+	t = (now - d->start_us) / 1000000.0;
+	d->step_us = now;
+
+	k = 1.0 - exp(-dt / SIM_FAN_TAU);
+	for (i = 0; i < NUMFANS; i++) {
+		f = &d->fan[i];
+		if (!f->present)
+			continue;
+		f->rpm += (fan_target(d, i) - f->rpm) * k;
+		f->rpm += f->rpm * 0.02 * sqrt(dt) * sim_noise(d);
+		if (f->rpm < 0.0)
+			f->rpm = 0.0;
+		if (f->rpm > f->max_rpm)
+			f->max_rpm = f->rpm;
+		cooling += f->rpm / f->top_rpm;
+		fans++;
+	}
+	if (fans)
+		cooling /= fans;
+
+	load = 0.5 - 0.5 * cos(2.0 * M_PI * t / SIM_LOAD_PERIOD);
+	k = 1.0 - exp(-dt / SIM_TEMP_TAU);
+	for (i = 0; i < d->num_temps; i++) {
+		target = SIM_AMBIENT + d->temp[i].offset + 25.0 * load - 10.0 * cooling;
+		d->temp[i].value += (target - d->temp[i].value) * k;
+	}
+}
+
+/* A reading of sensor i in 8.8 fixed point, with a little noise */
+static unsigned int temp_raw(struct SimDevice *d, int i)
+{
+	double v = (d->temp[i].value + 0.1 * sim_noise(d)) * 256.0;
+
+	if (v < 0.0)
+		return 0;
+	if (v > 0xffff)
+		return 0xffff;
+	return (unsigned int)(v + 0.5);
+}
+
+static int sim_status(struct SimDevice *d)
+{
+	int i;
+
+	for (i = 0; i < d->num_temps; i++) {
+		if (d->temp[i].value * 256.0 > le16(d->regs[TEMP_Limit][i]))
+			return 0xff;
+	}
+	return 0x00;
+}
+
+/*
+ * Channel a register behind one of the select registers is kept on
+ */
+static int reg_channel(struct SimDevice *d, int reg)
+{
+	if (reg >= FAN_Select)
+		return d->fan_select;
+	if (reg >= TEMP_SelectActiveSensor)
+		return d->temp_select;
+	if (reg >= LED_SelectCurrent)
+		return d->led_select;
+	return 0;
+}
+
+/*
+ * Read width bytes at offset of register reg on channel chan, little
+ * endian. Registers that are measured or fixed come from the model,
+ * everything else reads back what was written.
+ */
+static void reg_read(struct SimDevice *d, int reg, int chan, int offset,
+		     unsigned char *out, int width)
+{
+	struct SimFan *f = &d->fan[chan];
+	unsigned int v;
+	int i;
+
+	memset(out, 0x00, width);
+	if (reg < 0 || reg >= CL_NUM_REGS)
+		return;
+
+	switch (reg) {
+	case DeviceID:
+		v = d->interface == CLINK ? 0x38 : 0x3b;
+		break;
+	case FirmwareID:
+		v = 0x1005;
+		break;
+	case Status:
+		v = sim_status(d);
+		break;
+	case LED_SelectCurrent:
+		v = d->led_select;
+		break;
+	case LED_Count:
+		v = 1;
+		break;
+	case TEMP_SelectActiveSensor:
+		v = d->temp_select;
+		break;
+	case TEMP_CountSensors:
+		v = d->num_temps;
+		break;
+	case TEMP_Read:
+		v = chan < d->num_temps ? temp_raw(d, chan) : 0;
+		break;
+	case FAN_Select:
+		v = d->fan_select;
+		break;
+	case FAN_Count:
+		v = NUMFANS;
+		break;
+	case FAN_Mode:
+		v = d->regs[FAN_Mode][chan][0] & 0x7e;
+		if (f->present)
+			v |= 0x80;
+		if (f->tach)
+			v |= 0x01;
+		break;
+	case FAN_ReadRPM:
+		v = (unsigned int)(f->rpm + 0.5);
+		break;
+	case FAN_MaxRecordedRPM:
+		v = (unsigned int)(f->max_rpm + 0.5);
+		break;
+	default:
+		for (i = 0; i < width && offset + i < SIM_REG_BYTES; i++)
+			out[i] = d->regs[reg][chan][offset + i];
+		return;
+	}
+	for (i = 0; i < width && i < 4; i++)
+		out[i] = (v >> (8 * i)) & 0xff;
+}
+
+static void reg_write(struct SimDevice *d, int reg, int chan, int offset,
+		      const unsigned char *in, int width)
+{
+	int i;
+
+	if (reg < 0 || reg >= CL_NUM_REGS)
+		return;
+
+	switch (reg) {
+	case LED_SelectCurrent:
+		d->led_select = 0;	/* Only the one LED */
+		return;
+	case TEMP_SelectActiveSensor:
+		if (in[0] < d->num_temps)
+			d->temp_select = in[0];
+		return;
+	case FAN_Select:
+		if (in[0] < NUMFANS)
+			d->fan_select = in[0];
+		return;
+	case DeviceID:
+	case FirmwareID:
+	case ProductName:
+	case Status:
+	case LED_Count:
+	case TEMP_CountSensors:
+	case TEMP_Read:
+	case FAN_Count:
+	case FAN_ReadRPM:
+	case FAN_MaxRecordedRPM:
+		return;		/* Read only */
+	}
+	for (i = 0; i < width && offset + i < SIM_REG_BYTES; i++)
+		d->regs[reg][chan][offset + i] = in[i];
+}
+
+/*
+ * Where a Cooling Node port lives in the register model. Fans have a
+ * block of ports each at 0x20, 0x30, ... Returns the register, -1 for
+ * ports the model has nothing behind.
+ */
+static int clink_port(int port, int *chan, int *offset)
+{
+	int k;
+
+	*chan = 0;
+	*offset = 0;
+	if (port == 0x00)
+		return DeviceID;
+	if (port == 0x01)
+		return FirmwareID;
+	if (port == 0x02)
+		return Status;
+	if (port >= 0x07 && port <= 0x0a) {
+		*chan = 0x0a - port;
+		return TEMP_Read;
+	}
+	if (port >= 0x0b && port <= 0x0f) {
+		*chan = port - 0x0b;
+		return FAN_ReadRPM;
+	}
+	if (port >= 0x10 && port <= 0x14) {
+		*chan = port - 0x10;
+		return FAN_MaxRecordedRPM;
+	}
+	if (port >= 0x20 && port < 0x20 + 0x10 * NUMFANS) {
+		*chan = (port >> 4) - 2;
+		k = port & 0x0f;
+		if (k == 0)
+			return FAN_Mode;
+		if (k == 1)
+			return FAN_FixedPWM;
+		if (k == 2)
+			return FAN_FixedRPM;
+		if (k >= 3 && k <= 7) {
+			*offset = 2 * (k - 3);
+			return FAN_RPMTable;
+		}
+		if (k >= 8 && k <= 0x0c) {
+			*offset = 2 * (k - 8);
+			return FAN_TempTable;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Carry out one <cmdId> <opcode> <reg> [03] [data] request and write
+ * its answer to reply. Returns the request and reply lengths, or 0 if
+ * the request is not one the device understands.
+ */
+static int sim_op(struct SimDevice *d, const unsigned char *req, int len, unsigned char *reply,
+		  int *reply_len)
+{
+	const struct CorsairOpSize *sz;
+	int reg, chan, offset;
+
+	if (len < 3 || !CL_OP_VALID(req[1]))
+		return 0;
+	sz = CL_OP_SIZE(req[1]);
+	if (len < sz->request)
+		return 0;
+
+	if (d->interface == CLINK) {
+		reg = clink_port(req[2], &chan, &offset);
+	} else {
+		reg = req[2];
+		chan = reg_channel(d, reg);
+		offset = 0;
+	}
+
+	reply[0] = req[0];
+	reply[1] = req[1];
+	if (sz->write) {
+		if (reg >= 0)
+			reg_write(d, reg, chan, offset, &req[3 + sz->count], sz->data);
+	} else {
+		reg_read(d, reg, chan, offset, &reply[2], sz->data);
+	}
+	*reply_len = sz->reply;
+	return sz->request;
+}
+
+static void sim_push(struct SimDevice *d, const struct SimReply *r)
+{
+	if (d->count == CL_SIM_QUEUE) {
+		/* Like the hidapi queue, the oldest report makes room */
+		d->head = (d->head + 1) % CL_SIM_QUEUE;
+		d->count--;
+		d->stats.dropped++;
+	}
+	d->queue[(d->head + d->count) % CL_SIM_QUEUE] = *r;
+	d->count++;
+	d->stats.received++;
+	d->stats.queued = d->count;
+	if ((unsigned int)d->count > d->stats.max_queued)
+		d->stats.max_queued = d->count;
+}
+
+/*
+ * Schedule a reply, applying the configured latency and faults.
+ * Called with d->lock held.
+ */
+static void sim_queue(struct SimDevice *d, struct SimReply *r, unsigned long long now)
+{
+	long long delay = sim_config.latency_us;
+
+	if (sim_config.jitter_us > 0)
+		delay += (long long)(sim_rand(d) % (2U * sim_config.jitter_us + 1)) - sim_config.jitter_us;
+	if (delay < 0)
+		delay = 0;
+	r->due_us = now + delay;
+	if (r->due_us < d->last_due_us)
+		r->due_us = d->last_due_us;
+	d->last_due_us = r->due_us;
+
+	if (sim_chance(d, sim_config.drop_ppm))
+		return;
+	if (!d->holding && sim_chance(d, sim_config.reorder_ppm)) {
+		d->held = *r;
+		d->holding = 1;
+		return;
+	}
+
+	sim_push(d, r);
+	if (sim_chance(d, sim_config.dup_ppm))
+		sim_push(d, r);
+	if (d->holding) {
+		d->held.due_us = r->due_us;
+		sim_push(d, &d->held);
+		d->holding = 0;
+	}
+	pthread_cond_broadcast(&d->cond);
+}
+
+static int sim_write(void *handle, const unsigned char *buf, size_t len)
+{
+	struct SimDevice *d = handle;
+	struct SimReply r;
+	unsigned long long now = Ctime_us();
+	int i, end, n, used, reply_len;
+
+	memset(&r, 0x00, sizeof(r));
+	r.len = SIM_REPORT;
+
+	pthread_mutex_lock(&d->lock);
+	sim_step(d, now);
+	n = 0;
+	if (d->interface == CLINK) {
+		if (sim_op(d, buf, len, r.data, &reply_len))
+			n = reply_len;
+	} else {
+		/* Leading length byte, then as many requests as it covers */
+		end = len > 0 ? 1 + buf[0] : 0;
+		if (end > (int)len)
+			end = len;
+		for (i = 1; i < end; i += used) {
+			if (n + CL_OP_SIZE(ReadThreeBytes)->reply > SIM_REPORT)
+				break;
+			used = sim_op(d, &buf[i], end - i, &r.data[n], &reply_len);
+			if (used == 0)
+				break;
+			n += reply_len;
+		}
+	}
+	/* Nothing it understood, nothing to answer */
+	if (n > 0)
+		sim_queue(d, &r, now);
+	pthread_mutex_unlock(&d->lock);
+	return len;
+}
+
+/*
+ * Wait up to milliseconds (forever if negative) for a reply that is
+ * due. It stays in d->lent until the next read.
+ */
+static int sim_read(void *handle, const unsigned char **buf, int milliseconds)
+{
+	struct SimDevice *d = handle;
+	struct SimReply *r;
+	struct timespec ts;
+	unsigned long long now, deadline = 0, wake;
+	int res = 0;
+
+	pthread_mutex_lock(&d->lock);
+	now = Ctime_us();
+	if (milliseconds > 0)
+		deadline = now + milliseconds * 1000ULL;
+	for (;;) {
+		r = &d->queue[d->head];
+		if (d->count > 0 && r->due_us <= now) {
+			memcpy(d->lent, r->data, r->len);
+			res = r->len;
+			d->head = (d->head + 1) % CL_SIM_QUEUE;
+			d->count--;
+			d->stats.queued = d->count;
+			break;
+		}
+		if (milliseconds == 0 || (milliseconds > 0 && now >= deadline))
+			break;
+
+		if (d->count == 0 && milliseconds < 0) {
+			pthread_cond_wait(&d->cond, &d->lock);
+		} else {
+			wake = deadline;
+			if (d->count > 0 && (milliseconds < 0 || r->due_us < wake))
+				wake = r->due_us;
+			ts.tv_sec = wake / 1000000;
+			ts.tv_nsec = (wake % 1000000) * 1000;
+			pthread_cond_timedwait(&d->cond, &d->lock, &ts);
+		}
+		now = Ctime_us();
+	}
+	pthread_mutex_unlock(&d->lock);
+	*buf = d->lent;
+	return res;
+}
+
+static void sim_release(void *handle)
+{
+}
+
+/*
+ * Power-on state: which fans are plugged in, default modes and
+ * curves, a 60C temperature limit and everything at ambient.
+ */
+static void sim_reset(struct SimDevice *d, int index)
+{
+	struct SimFan *f;
+	int i, n;
+
+	d->rng = sim_config.seed * 2654435761U + d->interface * 7919U + index + 1;
+	if (d->rng == 0)
+		d->rng = 1;
+	d->start_us = d->step_us = Ctime_us();
+
+	if (d->interface == CLINK) {
+		d->num_temps = 4;
+		for (i = 0; i < NUMFANS; i++) {
+			f = &d->fan[i];
+			f->present = i < 3;
+			f->tach = 1;
+			f->top_rpm = 1600 + 200 * i;
+		}
+	} else {
+		d->num_temps = 1;
+		memcpy(d->regs[ProductName][0], "H80i", 4);
+		for (i = 0; i < NUMFANS; i++) {
+			f = &d->fan[i];
+			f->present = i < 2 || i == 4;	/* Two fans and the pump */
+			f->tach = i < 2;
+			f->top_rpm = i == 4 ? 2800 : 2000;
+		}
+	}
+
+	for (i = 0; i < d->num_temps; i++) {
+		d->temp[i].offset = 3.0 * i;
+		d->temp[i].value = SIM_AMBIENT + d->temp[i].offset;
+		put_le16(d->regs[TEMP_Limit][i], 60 << 8);
+	}
+	for (i = 0; i < NUMFANS; i++) {
+		f = &d->fan[i];
+		d->regs[FAN_Mode][i][0] = Default;
+		put_le16(d->regs[FAN_FixedRPM][i], f->top_rpm / 2);
+		put_le16(d->regs[FAN_UnderSpeedThreshold][i], 300);
+		for (n = 0; n < 5; n++) {
+			put_le16(&d->regs[FAN_TempTable][i][2 * n], (30 + 5 * n) << 8);
+			put_le16(&d->regs[FAN_RPMTable][i][2 * n], f->top_rpm * (4 + 1.5 * n) / 10);
+		}
+		/* Already spinning when we get there */
+		f->rpm = f->max_rpm = fan_target(d, i);
+	}
+}
+
+/*
+ * Paths are sim:h80i:<n> and sim:clink:<n>; an empty path opens the
+ * first simulated device of product_id.
+ */
+static void *sim_open(const char *path, unsigned short product_id)
+{
+	struct SimDevice *d;
+	pthread_condattr_t attr;
+	char type[8];
+	int interface, index = 0;
+
+	if (path[0] == '\0') {
+		interface = product_id == CL_PID_CLINK ? CLINK : H80I;
+	} else if (sscanf(path, "sim:%7[a-z0-9]:%d", type, &index) == 2) {
+		if (!strcmp(type, "h80i"))
+			interface = H80I;
+		else if (!strcmp(type, "clink"))
+			interface = CLINK;
+		else
+			return NULL;
+	} else {
+		return NULL;
+	}
+	if (index < 0 || index >= (interface == CLINK ? sim_config.clink : sim_config.h80i))
+		return NULL;
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL)
+		return NULL;
+	d->interface = interface;
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);	/* Same clock as Ctime_us() */
+	pthread_cond_init(&d->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	d->stats.capacity = CL_SIM_QUEUE;
+	sim_reset(d, index);
+	return d;
+}
+
+static void sim_close(void *handle)
+{
+	struct SimDevice *d = handle;
+
+	pthread_cond_destroy(&d->cond);
+	pthread_mutex_destroy(&d->lock);
+	free(d);
+}
+
+static const wchar_t *sim_product_name(int interface)
+{
+	return interface == CLINK ? L"Cooling Node (simulated)" : L"H80i (simulated)";
+}
+
+static int sim_string(const wchar_t *s, wchar_t *str, size_t maxlen)
+{
+	if (maxlen == 0)
+		return -1;
+	wcsncpy(str, s, maxlen);
+	str[maxlen - 1] = L'\0';
+	return 0;
+}
+
+static int sim_manufacturer(void *handle, wchar_t *str, size_t maxlen)
+{
+	return sim_string(L"Corsair", str, maxlen);
+}
+
+static int sim_product(void *handle, wchar_t *str, size_t maxlen)
+{
+	struct SimDevice *d = handle;
+
+	return sim_string(sim_product_name(d->interface), str, maxlen);
+}
+
+static int sim_input_stats(void *handle, struct hid_input_stats *stats)
+{
+	struct SimDevice *d = handle;
+
+	pthread_mutex_lock(&d->lock);
+	*stats = d->stats;
+	pthread_mutex_unlock(&d->lock);
+	return 0;
+}
+
+static const char *sim_error(void *handle)
+{
+	return "simulated device";
+}
+
+static struct hid_device_info *sim_device_info(int interface, int index)
+{
+	struct hid_device_info *info;
+	char path[32];
+	wchar_t serial[16];
+
+	info = calloc(1, sizeof(*info));
+	if (info == NULL)
+		return NULL;
+	snprintf(path, sizeof(path), "sim:%s:%d", interface == CLINK ? "clink" : "h80i", index);
+	swprintf(serial, sizeof(serial) / sizeof(serial[0]), L"SIM%ls%04d",
+		 interface == CLINK ? L"CN-" : L"H80I-", index);
+	info->path = strdup(path);
+	info->vendor_id = CL_VENDOR_ID;
+	info->product_id = interface == CLINK ? CL_PID_CLINK : CL_PID_H80I;
+	info->serial_number = wcsdup(serial);
+	info->manufacturer_string = wcsdup(L"Corsair");
+	info->product_string = wcsdup(sim_product_name(interface));
+	return info;
+}
+
+/* The list is the simulator's own, so it frees it too */
+static void sim_free_enumeration(struct hid_device_info *devs)
+{
+	struct hid_device_info *next;
+
+	for (; devs; devs = next) {
+		next = devs->next;
+		free(devs->path);
+		free(devs->serial_number);
+		free(devs->manufacturer_string);
+		free(devs->product_string);
+		free(devs);
+	}
+}
+
+static struct hid_device_info *sim_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root = NULL, **tail = &root;
+	int i;
+
+	if (vendor_id != 0 && vendor_id != CL_VENDOR_ID)
+		return NULL;
+	if (product_id == 0 || product_id == CL_PID_H80I) {
+		for (i = 0; i < sim_config.h80i; i++) {
+			*tail = sim_device_info(H80I, i);
+			if (*tail)
+				tail = &(*tail)->next;
+		}
+	}
+	if (product_id == 0 || product_id == CL_PID_CLINK) {
+		for (i = 0; i < sim_config.clink; i++) {
+			*tail = sim_device_info(CLINK, i);
+			if (*tail)
+				tail = &(*tail)->next;
+		}
+	}
+	return root;
+}
+
+static unsigned int percent_ppm(double pct)
+{
+	return (unsigned int)(pct * 10000.0 + 0.5);
+}
+
+/*
+ * Apply a key=value,... list (see CorsairSim.h) on top of the current
+ * settings. Returns 0, or -1 leaving them unchanged if spec is bad.
+ */
+int CorsairSim_configure(const char *spec)
+{
+	CorsairSimConfig_t c = sim_config;
+	char buf[256];
+	char *tok, *save, *val, *end;
+	double v;
+
+	if (spec == NULL)
+		return 0;
+	if (strlen(spec) >= sizeof(buf))
+		return -1;
+	strcpy(buf, spec);
+
+	for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (val == NULL)
+			return -1;
+		*val++ = '\0';
+		v = strtod(val, &end);
+		if (end == val || *end != '\0' || v < 0)
+			return -1;
+
+		if (!strcmp(tok, "h80i") && v <= CL_MAX_DEVICES)
+			c.h80i = v;
+		else if (!strcmp(tok, "clink") && v <= CL_MAX_DEVICES)
+			c.clink = v;
+		else if (!strcmp(tok, "latency") && v <= 10000000)
+			c.latency_us = v;
+		else if (!strcmp(tok, "jitter") && v <= 10000000)
+			c.jitter_us = v;
+		else if (!strcmp(tok, "drop") && v <= 100)
+			c.drop_ppm = percent_ppm(v);
+		else if (!strcmp(tok, "dup") && v <= 100)
+			c.dup_ppm = percent_ppm(v);
+		else if (!strcmp(tok, "reorder") && v <= 100)
+			c.reorder_ppm = percent_ppm(v);
+		else if (!strcmp(tok, "seed") && v <= 0xffffffffU)
+			c.seed = v;
+		else
+			return -1;
+	}
+	sim_config = c;
+	return 0;
+}
+
+const CorsairTransport_t CorsairSimTransport = {
+	.name			= "sim",
+	.enumerate		= sim_enumerate,
+	.free_enumeration	= sim_free_enumeration,
+	.open			= sim_open,
+	.close			= sim_close,
+	.write			= sim_write,
+	.read			= sim_read,
+	.release		= sim_release,
+	.get_manufacturer	= sim_manufacturer,
+	.get_product		= sim_product,
+	.input_stats		= sim_input_stats,
+	.error			= sim_error,
+};
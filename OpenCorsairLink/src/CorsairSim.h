@@ -0,0 +1,36 @@
+/*
+ * In-process stand-in for H80i/H100i coolers and Cooling Nodes, reached
+ * through CorsairSimTransport. It answers the same frames the hardware
+ * does from a model of its registers: fans spin up and down towards
+ * what their mode asks for, sensors follow a slow load cycle and are
+ * pulled down by the fans, and replies come back after a configurable
+ * latency. Replies can also be dropped, sent twice or held back behind
+ * the next one, to exercise the timeout and reply routing code.
+ *
+ * All randomness comes from one generator per device seeded from the
+ * configuration, so the same seed gives the same faults run after run.
+ *
+ * Configured with a comma separated list, e.g.
+ *	h80i=1,clink=1,latency=2000,jitter=500,drop=1,dup=0.5,reorder=1,seed=7
+ * Times are in microseconds, faults in percent of replies.
+ */
+
+#define CL_SIM_DEFAULT_LATENCY	2000	/* us, about a full speed interrupt round trip */
+
+/* Replies waiting to be read, like the hidapi input queue */
+#define CL_SIM_QUEUE		32
+
+struct CorsairSimConfig {
+	int		h80i;		/* Simulated H80i/H100i coolers */
+	int		clink;		/* Simulated Cooling Nodes */
+	int		latency_us;	/* Request to reply */
+	int		jitter_us;	/* Replies come up to this much sooner or later */
+	unsigned int	drop_ppm;	/* Replies lost, per million */
+	unsigned int	dup_ppm;	/* Replies sent twice */
+	unsigned int	reorder_ppm;	/* Replies held back behind the next one */
+	unsigned int	seed;
+};
+
+typedef struct CorsairSimConfig CorsairSimConfig_t;
+
+int CorsairSim_configure(const char *);
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <pthread.h>
+#include "hidapi.h"
+#include "CorsairTransport.h"
+
+/*
+ * hid_init()/hid_exit() are global to hidapi, so only tear it down
+ * once the last open link is closed.
+ */
+static pthread_mutex_t hid_users_lock = PTHREAD_MUTEX_INITIALIZER;
+static int hid_users = 0;
+static int hid_mode_set = 0;
+
+static int hid_ref(void)
+{
+	int res = 0;
+
+	pthread_mutex_lock(&hid_users_lock);
+	if (hid_users == 0)
+		res = hid_init();
+	if (res == 0 && !hid_mode_set) {
+		/*
+		 * One libusb event thread serves every device this process
+		 * opens rather than one each. The mode outlives hid_exit(),
+		 * so this is done once.
+		 */
+		if (hid_set_event_mode(HID_EVENTS_SHARED) < 0)
+			fprintf(stderr, "hidapi: no shared event thread, using the backend default\n");
+		hid_mode_set = 1;
+	}
+	if (res == 0)
+		hid_users++;
+	pthread_mutex_unlock(&hid_users_lock);
+	return res;
+}
+
+static void hid_unref(void)
+{
+	pthread_mutex_lock(&hid_users_lock);
+	if (hid_users > 0 && --hid_users == 0)
+		hid_exit();
+	pthread_mutex_unlock(&hid_users_lock);
+}
+
+static void *hid_transport_open(const char *path, unsigned short product_id)
+{
+	hid_device *handle;
+
+	if (hid_ref())
+		return NULL;
+	if (path[0] != '\0')
+		handle = hid_open_path(path);
+	else
+		handle = hid_open(0x1b1c, product_id, NULL);
+	if (!handle) {
+		hid_unref();
+		return NULL;
+	}
+	hid_set_nonblocking(handle, 1);
+	return handle;
+}
+
+static void hid_transport_close(void *handle)
+{
+	hid_close(handle);
+	hid_unref();
+}
+
+static int hid_transport_write(void *handle, const unsigned char *buf, size_t len)
+{
+	return hid_write(handle, buf, len);
+}
+
+static int hid_transport_write_async(void *handle, const unsigned char *buf, size_t len,
+				     int milliseconds)
+{
+	return hid_write_async(handle, buf, len, milliseconds);
+}
+
+static int hid_transport_write_wait(void *handle, int token, int milliseconds)
+{
+	return hid_write_wait(handle, token, milliseconds);
+}
+
+static int hid_transport_read(void *handle, const unsigned char **buf, int milliseconds)
+{
+	return hid_read_borrow(handle, buf, milliseconds);
+}
+
+static void hid_transport_release(void *handle)
+{
+	hid_read_release(handle);
+}
+
+static int hid_transport_manufacturer(void *handle, wchar_t *str, size_t maxlen)
+{
+	return hid_get_manufacturer_string(handle, str, maxlen);
+}
+
+static int hid_transport_product(void *handle, wchar_t *str, size_t maxlen)
+{
+	return hid_get_product_string(handle, str, maxlen);
+}
+
+static int hid_transport_stats(void *handle, struct hid_input_stats *stats)
+{
+	return hid_get_input_stats(handle, stats);
+}
+
+static const char *hid_transport_error(void *handle)
+{
+	return hid_error(handle);
+}
+
+const CorsairTransport_t CorsairHidTransport = {
+	.name			= "hidapi",
+	.enumerate		= hid_enumerate,
+	.free_enumeration	= hid_free_enumeration,
+	.open			= hid_transport_open,
+	.close			= hid_transport_close,
+	.write			= hid_transport_write,
+	.write_async		= hid_transport_write_async,
+	.write_wait		= hid_transport_write_wait,
+	.read			= hid_transport_read,
+	.release		= hid_transport_release,
+	.get_manufacturer	= hid_transport_manufacturer,
+	.get_product		= hid_transport_product,
+	.input_stats		= hid_transport_stats,
+	.error			= hid_transport_error,
+};
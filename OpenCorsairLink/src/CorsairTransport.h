@@ -0,0 +1,38 @@
+/*
+ * What a CorsairLink_t talks through. Everything above this only sees
+ * reports going out and reports coming back, so the same code runs on
+ * real hardware (hidapi) or on the built-in simulator (CorsairSim.h).
+ *
+ * The calls mirror the hidapi ones they stand in for: a handle is
+ * whatever open() returned, read() lends out the transport's own copy
+ * of a report until release(), and enumerate() returns a list to hand
+ * back to free_enumeration().
+ *
+ * write_async() and write_wait() are optional: they start a write that
+ * gives up after milliseconds and collect its result later, like
+ * hid_write_async()/hid_write_wait(). They are NULL when write() is
+ * all a transport has.
+ */
+
+struct CorsairTransport {
+	const char	*name;
+	struct hid_device_info *(*enumerate)(unsigned short vendor_id, unsigned short product_id);
+	void		(*free_enumeration)(struct hid_device_info *);
+	/* Open path, or the first device with product_id if path is empty */
+	void		*(*open)(const char *path, unsigned short product_id);
+	void		(*close)(void *);
+	int		(*write)(void *, const unsigned char *, size_t);
+	int		(*write_async)(void *, const unsigned char *, size_t, int milliseconds);
+	int		(*write_wait)(void *, int token, int milliseconds);
+	int		(*read)(void *, const unsigned char **, int milliseconds);
+	void		(*release)(void *);
+	int		(*get_manufacturer)(void *, wchar_t *, size_t);
+	int		(*get_product)(void *, wchar_t *, size_t);
+	int		(*input_stats)(void *, struct hid_input_stats *);
+	const char	*(*error)(void *);
+};
+
+typedef struct CorsairTransport CorsairTransport_t;
+
+extern const CorsairTransport_t CorsairHidTransport;
+extern const CorsairTransport_t CorsairSimTransport;
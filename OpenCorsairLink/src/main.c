@@ -7,9 +7,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "hidapi.h"
 #include "CorsairFanInfo.h"
 #include "CorsairLink.h"
+#include "CorsairDaemon.h"
+#include "CorsairDevices.h"
+#include "CorsairFormat.h"
+#include "CorsairSampler.h"
+#include "CorsairTransport.h"
+#include "CorsairSim.h"
 
 
 static struct option long_options[] = {
@@ -18,45 +26,177 @@ static struct option long_options[] = {
 	{"mode", required_argument, 0, 'm'},
 	{"rpm",  required_argument, 0, 'r'},
 	{"intf",  required_argument, 0, 'i'},
+	{"wait",  required_argument, 0, 'w'},
+	{"poll",  no_argument, 0, 'p'},
+	{"timing",  no_argument, 0, 't'},
+	{"daemon",  no_argument, 0, 'd'},
+	{"socket",  required_argument, 0, 's'},
+	{"query",  no_argument, 0, 'q'},
+	{"interval",  required_argument, 0, 'I'},
+	{"all",  no_argument, 0, 'a'},
+	{"device",  required_argument, 0, 'D'},
+	{"list",  no_argument, 0, 'l'},
+	{"window",  required_argument, 0, 'W'},
+	{"format",  required_argument, 0, 'F'},
+	{"count",  required_argument, 0, 'c'},
+	{"sample",  required_argument, 0, 'S'},
+	{"rate",  required_argument, 0, 'R'},
+	{"output",  required_argument, 0, 'o'},
+	{"transfers",  required_argument, 0, 'T'},
+	{"sim",  optional_argument, 0, 'x'},
 	{0, 0, 0, 0}
 };
 
-int parseArguments(int argc, char **argv, int *, int *, int *, int *);
+/*
+ * What was asked for on the command line
+ */
+struct Options {
+	int	interfaceType;
+	int	fanNumber;
+	int	fanMode;
+	int	fanRPM;
+	int	readWait;	/* ms to wait for a reply, 0 for default */
+	int	readMode;	/* CL_READ_BLOCKING or CL_READ_POLL */
+	int	timing;		/* print the transaction latency histogram */
+	int	daemon;		/* serve readings over a socket */
+	int	query;		/* ask a running daemon instead of the device */
+	int	interval;	/* ms between samples */
+	int	count;		/* samples to take, 0 for no end */
+	int	format;		/* CL_FORMAT_* */
+	int	sample;		/* high-rate sampling for this many seconds */
+	int	rate;		/* samples per second, 0 as fast as possible */
+	char	*output;	/* where high-rate samples go */
+	char	*socketPath;
+	int	allTypes;	/* use H80i and Cooling Node devices alike */
+	int	list;		/* only list the devices found */
+	char	*device;	/* index, path or serial of the device to use */
+	int	window;		/* requests in flight at once */
+	int	transfers;	/* interrupt IN transfers queued per device, 0 default */
+	int	sim;		/* simulated devices instead of USB ones */
+};
+
+int parseArguments(int argc, char **argv, struct Options *);
+void PrintLatency(CorsairLatency_t *);
+void PrintDevices(CorsairDevices_t *);
+int SampleLoop(CorsairDevices_t *, struct Options *);
 
-CorsairLink_t h80_link;
+CorsairDevices_t devices;
 
 int main(int argc, char **argv) {
-	int			interfaceType = H80I;
-	int			fanNumber = 0;
-	int			fanMode = 0;
-	int			fanRPM = 0;
-	int			num_tsen;
-	unsigned short		temp;
-	int			i;
-	CorsairLink_t		*cl = &h80_link;
+	struct Options		opts;
+	int			interfaceType;
+	int			fanNumber;
+	int			fanMode;
+	int			fanRPM;
+	int			i, j;
+	CorsairDevice_t		*dev;
+	CorsairLink_t		*cl;
 	CorsairFanInfo_t	fanInfo;
+	char			request[64];
+
+	memset(&opts, 0x00, sizeof(opts));
+	opts.interfaceType = H80I;
+	opts.readMode = CL_READ_BLOCKING;
+	opts.interval = CL_DEFAULT_INTERVAL;
+	opts.socketPath = CL_DEFAULT_SOCKET;
+	opts.window = CL_DEFAULT_WINDOW;
+	opts.count = 1;
+	opts.format = CL_FORMAT_TEXT;
+
+	if(parseArguments(argc, argv, &opts)) {
+		return 1;
+	}
+	if (opts.format == CL_FORMAT_TEXT)
+		printf("Open Corsair Link ");
+	interfaceType = opts.interfaceType;
+	fanNumber = opts.fanNumber;
+	fanMode = opts.fanMode;
+	fanRPM = opts.fanRPM;
+
+	if (opts.query) {
+		printf("(daemon on %s):\n", opts.socketPath);
+		if (fanNumber != 0)
+			snprintf(request, sizeof(request), "SET %d %d %d", fanNumber, fanMode, fanRPM);
+		else
+			snprintf(request, sizeof(request), "GET");
+		return CorsairDaemon_query(opts.socketPath, request);
+	}
 
-	printf("Open Corsair Link ");
-	if(parseArguments(argc, argv, &fanNumber, &fanMode, &fanRPM, &interfaceType)) {
+	if (opts.format == CL_FORMAT_TEXT) {
+		if (opts.allTypes)
+			printf("(all devices):\n");
+		else if (interfaceType == CLINK)
+			printf("(Cooling Node):\n");
+		else
+			printf("(H80i/H100i):\n");
+	}
+
+	if (!CorsairDevices_scan(&devices, opts.allTypes ? 0 : interfaceType,
+				 opts.sim ? &CorsairSimTransport : NULL)) {
+		fprintf(stderr, "No Corsair Link device found.\n");
+		return 1;
+	}
+	if (opts.list) {
+		for (i = 0; i < devices.count; i++) {
+			dev = &devices.dev[i];
+			printf("%d: %s %s serial %s\n", i + 1,
+				dev->interface == CLINK ? "Cooling Node" : "H80i/H100i",
+				dev->link.path, dev->serial[0] ? dev->serial : "-");
+		}
+		return 0;
+	}
+	if (opts.device) {
+		i = CorsairDevices_find(&devices, opts.device);
+		if (i < 0) {
+			fprintf(stderr, "No device matches %s, see --list.\n", opts.device);
+			return 1;
+		}
+		devices.dev[0] = devices.dev[i];
+		devices.count = 1;
+	}
+	/* Setting fans, daemon and sampling modes work on exactly one device */
+	if ((opts.daemon || opts.sample || fanNumber != 0) && devices.count > 1) {
+		fprintf(stderr, "%d devices found, pick one with --device.\n", devices.count);
 		return 1;
 	}
-	if (interfaceType == CLINK)
-		printf("(Cooling Node):\n");
-	else
-		printf("(H80i/H100i):\n");
 
-	if(!CorsairLink_init(cl, interfaceType)) {
+	if (opts.transfers && hid_set_input_transfers(opts.transfers) < 0)
+		fprintf(stderr, "Cannot queue %d input transfers, using the default.\n", opts.transfers);
+	for (i = 0; i < devices.count; i++) {
+		devices.dev[i].link.max_ms_read_wait = opts.readWait;
+		devices.dev[i].link.read_mode = opts.readMode;
+		devices.dev[i].link.window = opts.window;
+	}
+	if (!CorsairDevices_open(&devices)) {
 		fprintf(stderr, "Cannot initialize link.\n");
 		return 1;
 	}
 
+	dev = &devices.dev[0];
+	cl = &dev->link;
+	interfaceType = dev->interface;
+
+	if (opts.daemon) {
+		i = CorsairDaemon_run(cl, interfaceType, opts.socketPath, opts.interval);
+		CorsairDevices_close(&devices);
+		return i;
+	}
+
+	if (opts.sample) {
+		i = CorsairSampler_run(cl, interfaceType, opts.sample > 0 ? opts.sample : 0,
+				       opts.rate, opts.output);
+		CorsairDevices_close(&devices);
+		return i;
+	}
+
 	if(fanNumber != 0) {
 		if(fanMode != 0 || fanRPM != 0) {
 			if(fanMode == FixedRPM && fanRPM <= 0) {
 				fprintf(stderr, "Fan RMP missing for Fixed RPM fan mode.\n");
+				CorsairDevices_close(&devices);
 				return 1;
 			} else {
-				fanInfo.Name[0] = 0;
+				memset(&fanInfo, 0x00, sizeof(fanInfo));
 				if(fanMode != 0) {
 					printf("Setting fan to mode %s\n", GetFanModeString(fanMode));
 					fanInfo.Mode = fanMode;
@@ -69,33 +209,131 @@ int main(int argc, char **argv) {
 			}
 		} else {
 			fprintf(stderr, "No mode or fan RPM specified for the fan.\n");
+			CorsairDevices_close(&devices);
 			return 1;
 		}
 	} else if(fanMode != 0 || fanRPM != 0) {
 		fprintf(stderr,
 			"Cannot set fan to a specific mode or fixed RPM without specifying the fan number\n");
+		CorsairDevices_close(&devices);
 		return 1;
 	} else {
+		SampleLoop(&devices, &opts);
+	}
 
-		num_tsen = ConnectedTemps(cl, interfaceType);
-		if (num_tsen) {
-			for (i = 0; i < num_tsen; i++ ) {
-				temp = ReadTempInfo(cl, interfaceType, i);
-				printf("Sensor %d ", i + 1);
-				PrintTempInfo(temp);
-			}
+	if (opts.timing) {
+		for (j = 0; j < devices.count; j++) {
+			cl = &devices.dev[j].link;
+			if (devices.count > 1)
+				printf("Device %d:\n", j + 1);
+			PrintLatency(&cl->latency);
+			printf("Register shadow: %lu hits %lu misses\n",
+				cl->shadow_hits, cl->shadow_misses);
+			printf("Replies dropped: %lu stale %lu duplicate\n",
+				cl->stale_replies, cl->dup_replies);
+		}
+	}
+
+	CorsairDevices_close(&devices);
+
+	return 0;
+} 
+
+void PrintDevices(CorsairDevices_t *t) {
+	CorsairDevice_t *dev;
+	int i, j;
+
+	for (j = 0; j < t->count; j++) {
+		dev = &t->dev[j];
+		if (dev->link.handle == NULL)
+			continue;
+		if (t->count > 1)
+			printf("Device %d: %s serial %s\n", j + 1, dev->link.path,
+				dev->serial[0] ? dev->serial : "-");
+		for (i = 0; i < dev->num_temps; i++ ) {
+			printf("Sensor %d ", i + 1);
+			PrintTempInfo(dev->temps[i]);
 		}
-		ReadFansInfo(cl, interfaceType);
 		//std::cout << "Number of fans: " << (sizeof(cl->fans)/sizeof(*cl->fans)) << endl;
 		for(i = 0; i < NUMFANS; i++) {
-			PrintInfo(&cl->fans[i]);
+			PrintInfo(&dev->link.fans[i]);
 		}
 	}
+}
+
+/*
+ * Sweep every device opts->count times, opts->interval ms apart.
+ * Machine formats go out as one write() per sample.
+ */
+int SampleLoop(CorsairDevices_t *t, struct Options *opts) {
+	static char buf[CL_FORMAT_MAX];
+	unsigned long long next_us, now;
+	int len;
+	int n;
 
-	Close(cl);
+	len = CorsairFormat_header(buf, sizeof(buf), opts->format);
+	if (len > 0 && CorsairFormat_write(1, buf, len))
+		return 1;
+
+	next_us = Ctime_us();
+	for (n = 0; opts->count == 0 || n < opts->count; n++) {
+		if (n > 0) {
+			/* Stay on the schedule without trying to catch up */
+			next_us += opts->interval * 1000ULL;
+			now = Ctime_us();
+			if (next_us > now)
+				usleep(next_us - now);
+			else
+				next_us = now;
+		}
 
+		CorsairDevices_sweep(t);
+		if (opts->format == CL_FORMAT_TEXT) {
+			PrintDevices(t);
+			fflush(stdout);
+			continue;
+		}
+		len = CorsairFormat_sample(buf, sizeof(buf), opts->format, t, Cwalltime_ms());
+		if (CorsairFormat_write(1, buf, len)) {
+			fprintf(stderr, "Unable to write sample: %s\n", strerror(errno));
+			return 1;
+		}
+	}
 	return 0;
-} 
+}
+
+/*
+ * Show how long each request/reply round trip took
+ */
+void PrintLatency(CorsairLatency_t *lat) {
+	int i;
+	int width;
+	unsigned long peak = 0;
+
+	printf("Transactions: %lu  timeouts: %lu\n", lat->count, lat->timeouts);
+	if (lat->count == 0)
+		return;
+	printf("Latency usec: min %llu avg %llu max %llu\n", lat->min_us,
+		lat->total_us / lat->count, lat->max_us);
+
+	for (i = 0; i < CL_LAT_BUCKETS; i++) {
+		if (lat->hist[i] > peak)
+			peak = lat->hist[i];
+	}
+	for (i = 0; i < CL_LAT_BUCKETS; i++) {
+		if (lat->hist[i] == 0)
+			continue;
+		width = (int)((lat->hist[i] * 40 + peak - 1) / peak);
+		if (i == CL_LAT_BUCKETS - 1)
+			printf("\t    >= %8llu us %6lu ", 1ULL << (i - 1), lat->hist[i]);
+		else
+			printf("\t%8llu-%8llu us %6lu ", i ? 1ULL << (i - 1) : 0ULL,
+				(1ULL << i) - 1, lat->hist[i]);
+		while (width--)
+			putchar('#');
+		putchar('\n');
+	}
+}
 
 void printHelp() {
 	printf("OpenCorsairLink [options]\n");
@@ -113,17 +351,44 @@ void printHelp() {
 	printf("\t                    12 - Performance\n");
 	printf("\t-r, --rpm <fan RPM> The desired RPM for the selected fan.\n");
 	printf("\t                    NOTE: it works only when fan mode is set to Fixed RPM\n");
+	printf("\t-w, --wait <ms>     How long to wait for each reply from the device (default 5000)\n");
+	printf("\t-p, --poll          Poll for replies every 100ms instead of blocking on them\n");
+	printf("\t-t, --timing        Print a histogram of request/reply latency when done\n");
+	printf("\t-d, --daemon        Keep sampling the device and serve readings on a socket\n");
+	printf("\t-s, --socket <path> Socket for --daemon and --query (default %s)\n", CL_DEFAULT_SOCKET);
+	printf("\t-q, --query         Ask a running daemon instead of opening the device\n");
+	printf("\t-I, --interval <ms> Time between samples (default %d)\n", CL_DEFAULT_INTERVAL);
+	printf("\t-c, --count <n>     Samples to take, 0 to keep going (default 1)\n");
+	printf("\t-F, --format <fmt>  Output as text (default), jsonl or csv\n");
+	printf("\t-a, --all           Use H80i/H100i and Cooling Node devices alike\n");
+	printf("\t-l, --list          List the devices found and exit\n");
+	printf("\t-D, --device <dev>  Only use the device with this --list number, path or serial\n");
+	printf("\t-S, --sample <s>    Sample as fast as possible for s seconds (-1 until ^C) and\n");
+	printf("\t                    print min/mean/max/p99/jitter per sensor and fan\n");
+	printf("\t-R, --rate <hz>     Sample at this rate instead of as fast as possible\n");
+	printf("\t-o, --output <file> Also write every sample to file as CSV\n");
+	printf("\t-W, --window <n>    Requests to keep in flight at once, 1-%d (default %d)\n",
+		CL_MAX_WINDOW, CL_DEFAULT_WINDOW);
+	printf("\t-T, --transfers <n> Input transfers to keep queued per device, 1-8 (default 4)\n");
+	printf("\t-x, --sim[=<opts>]  Use simulated devices, opts is a comma separated list of\n");
+	printf("\t                    h80i=<n>,clink=<n> devices (default 1 each), latency=<us>\n");
+	printf("\t                    (default %d), jitter=<us>, drop=<%%>, dup=<%%>,\n", CL_SIM_DEFAULT_LATENCY);
+	printf("\t                    reorder=<%%> replies and seed=<n>\n");
 	printf("\t-h, --help          Prints this message\n");
 	printf("Not specifying any option will display information about the fans and pumpon a H80i\n");
 }
 
-int parseArguments(int argc, char **argv, int *fanNumber, int *fanMode, int *fanRPM, int *intf) {
+int parseArguments(int argc, char **argv, struct Options *opts) {
 	int c;
 	int returnCode = 0;
 	int option_index = 0;
+	int *fanNumber = &opts->fanNumber;
+	int *fanMode = &opts->fanMode;
+	int *fanRPM = &opts->fanRPM;
+	int *intf = &opts->interfaceType;
 
 	while (1) {
-		c = getopt_long (argc, argv, "i:f:m:r:h", long_options, &option_index);
+		c = getopt_long (argc, argv, "i:f:m:r:w:ptds:qI:alD:W:F:c:S:R:o:T:x::h", long_options, &option_index);
 		//std::cout << c;
 		if (c == -1 || returnCode != 0)
 			break;
@@ -169,6 +434,114 @@ int parseArguments(int argc, char **argv, int *fanNumber, int *fanMode, int *fan
 			}
 			break;
 
+		case 'w':
+			opts->readWait = strtol(optarg, NULL, 10);
+			if(opts->readWait <= 0){
+				fprintf(stderr, "Reply wait must be a positive number of ms.\n");
+				returnCode = 1;
+			}
+			break;
+
+		case 'p':
+			opts->readMode = CL_READ_POLL;
+			break;
+
+		case 't':
+			opts->timing = 1;
+			break;
+
+		case 'd':
+			opts->daemon = 1;
+			break;
+
+		case 's':
+			opts->socketPath = optarg;
+			break;
+
+		case 'q':
+			opts->query = 1;
+			break;
+
+		case 'I':
+			opts->interval = strtol(optarg, NULL, 10);
+			if(opts->interval <= 0){
+				fprintf(stderr, "Interval must be a positive number of ms.\n");
+				returnCode = 1;
+			}
+			break;
+
+		case 'a':
+			opts->allTypes = 1;
+			break;
+
+		case 'l':
+			opts->list = 1;
+			break;
+
+		case 'D':
+			opts->device = optarg;
+			break;
+
+		case 'W':
+			opts->window = strtol(optarg, NULL, 10);
+			if(opts->window < 1 || opts->window > CL_MAX_WINDOW){
+				fprintf(stderr, "Window must be between 1 and %d.\n", CL_MAX_WINDOW);
+				returnCode = 1;
+			}
+			break;
+
+		case 'F':
+			opts->format = CorsairFormat_parse(optarg);
+			if(opts->format < 0){
+				fprintf(stderr, "Format must be text, jsonl or csv.\n");
+				returnCode = 1;
+			}
+			break;
+
+		case 'c':
+			opts->count = strtol(optarg, NULL, 10);
+			if(opts->count < 0){
+				fprintf(stderr, "Sample count cannot be negative.\n");
+				returnCode = 1;
+			}
+			break;
+
+		case 'S':
+			opts->sample = strtol(optarg, NULL, 10);
+			if(opts->sample == 0 || opts->sample < -1){
+				fprintf(stderr, "Sample time must be a number of seconds or -1.\n");
+				returnCode = 1;
+			}
+			break;
+
+		case 'R':
+			opts->rate = strtol(optarg, NULL, 10);
+			if(opts->rate < 0){
+				fprintf(stderr, "Sample rate cannot be negative.\n");
+				returnCode = 1;
+			}
+			break;
+
+		case 'o':
+			opts->output = optarg;
+			break;
+
+		case 'T':
+			opts->transfers = strtol(optarg, NULL, 10);
+			if(opts->transfers < 1 || opts->transfers > 8){
+				fprintf(stderr, "Transfers must be between 1 and 8.\n");
+				returnCode = 1;
+			}
+			break;
+
+		case 'x':
+			opts->sim = 1;
+			if(CorsairSim_configure(optarg) < 0){
+				fprintf(stderr, "Bad simulator settings %s, see --help.\n", optarg);
+				returnCode = 1;
+			}
+			break;
+
 		case 'h':
 			printHelp();
 			exit(0);
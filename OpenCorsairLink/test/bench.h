@@ -0,0 +1,16 @@
+/*
+ * Timing helpers shared by the benchmarks
+ */
+
+#include <time.h>
+
+static inline unsigned long long bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Keeps the compiler from dropping work whose result is not used */
+static volatile unsigned int bench_sink;
@@ -0,0 +1,209 @@
+/*
+ * The event modes of hid-libusb.c on the fake bus in fakeusb.c, with
+ * the Commander streaming a report every frame.
+ *
+ * Checks that devices opened with HID_EVENTS_SHARED get their reports
+ * through one thread between them, which goes when the last of them
+ * closes, where HID_EVENTS_THREAD starts one each; and that with
+ * HID_EVENTS_EXTERNAL no thread is started and nothing arrives until
+ * the application's poll loop, on the descriptors from
+ * hid_get_pollfds(), calls hid_handle_events().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include "hidapi.h"
+#include "fakeusb.h"
+
+#define REPORT		64
+#define POLLFDS_MAX	8
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static int threads(void)
+{
+	DIR *dir = opendir("/proc/self/task");
+	struct dirent *ent;
+	int n = 0;
+
+	if (!dir)
+		return -1;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] != '.')
+			n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+/* Streamed reports read from dev in ms, -1 if they came out of order */
+static int read_stream(hid_device *dev, int ms)
+{
+	unsigned char in[REPORT];
+	unsigned long long end = fakeusb_now_us() + ms * 1000ULL;
+	unsigned int seq, last = 0;
+	int n = 0, res;
+
+	while (fakeusb_now_us() < end) {
+		res = hid_read_timeout(dev, in, sizeof(in), 10);
+		if (res < 0)
+			return -1;
+		if (res == 0)
+			continue;
+		seq = FAKEUSB_SEQ(in);
+		if (n > 0 && seq <= last)
+			return -1;
+		last = seq;
+		n++;
+	}
+	return n;
+}
+
+static void test_shared(int base)
+{
+	hid_device *a, *b;
+
+	/* For comparison: a thread each */
+	CHECK(hid_set_event_mode(HID_EVENTS_THREAD) == 0);
+	a = hid_open(0x1b1c, 0x0c02, NULL);
+	b = hid_open(0x1b1c, 0x0c02, NULL);
+	CHECK(a && b);
+	if (!a || !b)
+		return;
+	CHECK(threads() == base + 2);
+	hid_close(a);
+	hid_close(b);
+	CHECK(threads() == base);
+
+	/* One thread for both, and the stream reaches both through it */
+	CHECK(hid_set_event_mode(HID_EVENTS_SHARED) == 0);
+	a = hid_open(0x1b1c, 0x0c02, NULL);
+	b = hid_open(0x1b1c, 0x0c02, NULL);
+	CHECK(a && b);
+	if (!a || !b)
+		return;
+	CHECK(threads() == base + 1);
+	CHECK(read_stream(a, 100) > 10);
+	CHECK(read_stream(b, 100) > 10);
+
+	/* Closing one leaves the thread to the other */
+	hid_close(a);
+	CHECK(threads() == base + 1);
+	CHECK(read_stream(b, 100) > 10);
+
+	/* And the last one takes it with it */
+	hid_close(b);
+	CHECK(threads() == base);
+}
+
+static void test_external(int base)
+{
+	struct hid_pollfd fds[POLLFDS_MAX];
+	struct pollfd pfds[POLLFDS_MAX];
+	unsigned char in[REPORT], out[REPORT + 1];
+	unsigned long long end;
+	unsigned long streamed;
+	unsigned int seq, last = 0;
+	int n, i, res, reports = 0, ordered = 1, echoed = 0;
+	hid_device *dev;
+
+	CHECK(hid_set_event_mode(HID_EVENTS_EXTERNAL) == 0);
+	dev = hid_open(0x1b1c, 0x0c02, NULL);
+	CHECK(dev != NULL);
+	if (!dev)
+		return;
+	CHECK(threads() == base);
+
+	/* The device sends, but with nobody handling events nothing arrives */
+	streamed = fakeusb.streamed;
+	CHECK(hid_read_timeout(dev, in, sizeof(in), 50) == 0);
+	CHECK(fakeusb.streamed - streamed > 10);
+
+	n = hid_get_pollfds(fds, POLLFDS_MAX);
+	CHECK(n > 0 && n <= POLLFDS_MAX);
+	if (n <= 0 || n > POLLFDS_MAX) {
+		hid_close(dev);
+		return;
+	}
+	CHECK(hid_get_pollfds(fds, 0) == n);
+
+	/* The application's loop: poll, handle, read what came in */
+	end = fakeusb_now_us() + 100000;
+	while (fakeusb_now_us() < end) {
+		for (i = 0; i < n; i++) {
+			pfds[i].fd = fds[i].fd;
+			pfds[i].events = fds[i].events;
+			pfds[i].revents = 0;
+		}
+		if (poll(pfds, n, 10) <= 0)
+			continue;
+		CHECK(hid_handle_events(0) == 0);
+		while ((res = hid_read_timeout(dev, in, sizeof(in), 0)) > 0) {
+			seq = FAKEUSB_SEQ(in);
+			if (reports > 0 && seq <= last)
+				ordered = 0;
+			last = seq;
+			reports++;
+		}
+		CHECK(res == 0);
+	}
+	CHECK(reports > 50);
+	CHECK(ordered);
+
+	/* A write handles events itself while it waits, and its answer
+	   comes in through the same loop */
+	fakeusb.stream_us = 0;
+	CHECK(hid_handle_events(10) == 0);
+	while (hid_read_timeout(dev, in, sizeof(in), 0) > 0)
+		;
+	memset(out, 0, sizeof(out));
+	out[1] = 0xa5;
+	out[2] = 0x5a;
+	out[3] = 0xc3;
+	CHECK(hid_write(dev, out, sizeof(out)) == sizeof(out));
+	end = fakeusb_now_us() + 100000;
+	while (!echoed && fakeusb_now_us() < end) {
+		CHECK(hid_handle_events(10) == 0);
+		if (hid_read_timeout(dev, in, sizeof(in), 0) > 0)
+			echoed = in[0] == 0xa5 && in[1] == 0x5a && in[2] == 0xc3;
+	}
+	CHECK(echoed);
+	fakeusb.stream_us = 1000;
+
+	hid_close(dev);
+	CHECK(threads() == base);
+}
+
+int main(void)
+{
+	int base;
+
+	fakeusb.stream_us = fakeusb.frame_us = 1000;
+	fakeusb.host_us = 100;
+	if (hid_init() < 0)
+		return 1;
+	base = threads();
+
+	test_shared(base);
+	test_external(base);
+
+	hid_exit();
+	if (failures) {
+		fprintf(stderr, "eventtest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("eventtest: ok\n");
+	return 0;
+}
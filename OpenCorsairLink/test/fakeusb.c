@@ -0,0 +1,656 @@
+/*
+ * A stand-in for the parts of libusb-1.0 that hid-libusb.c uses, with
+ * one device on the bus: a Commander (1b1c:0c02) at bus 1 address 2,
+ * whose one HID interface has a 64 byte interrupt IN and OUT endpoint
+ * polled every frame, like a full speed device with bInterval 1.
+ *
+ * A bus thread runs once a frame and moves at most one packet each way:
+ *  - the oldest queued OUT transfer goes out, and the device answers
+ *    it by echoing the request, which it can send from the next frame;
+ *  - if the device has a report to send and an IN transfer is queued,
+ *    the transfer takes it.
+ * With fakeusb.stream_us set the device also makes a report of its own
+ * that often. It has room for one: if no IN transfer takes it before
+ * the next, the older one is lost.
+ *
+ * A finished transfer becomes runnable in libusb_handle_events*()
+ * fakeusb.host_us later, standing in for the time the host takes to
+ * wake whoever handles events. Every fakeusb.stall_every'th completion
+ * takes fakeusb.stall_us instead, standing in for a busy machine, and
+ * holds up the ones after it too: completions run in order.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "libusb.h"
+#include "fakeusb.h"
+
+#define FAKE_VID		0x1b1c
+#define FAKE_PID		0x0c02
+#define FAKE_PACKET		64
+#define FAKE_EP_IN		0x81
+#define FAKE_EP_OUT		0x01
+#define FAKE_REPLIES		16	/* Answers the device can hold */
+
+struct fakeusb_config fakeusb = {
+	.frame_us	= 1000,
+};
+
+struct libusb_device {
+	int		unused;
+};
+
+struct libusb_device_handle {
+	struct libusb_device *dev;
+};
+
+/* A transfer handed to the fake, queued on an endpoint or done */
+struct fake_xfer {
+	struct libusb_transfer	*t;
+	unsigned long long	submitted_us;
+	unsigned long long	runnable_us;	/* Once done */
+	int			*sync_done;	/* libusb_interrupt_transfer() waiting on it */
+	struct fake_xfer	*next;
+};
+
+static struct libusb_device the_device;
+
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bus_cond;	/* Waits on CLOCK_MONOTONIC */
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t bus_thread;
+static int bus_running = 0;
+static int event_fd = -1;
+
+/* Protected by bus_lock */
+static struct fake_xfer *in_queue, *out_queue, *done_queue;
+static unsigned char replies[FAKE_REPLIES][FAKE_PACKET];
+static unsigned long long reply_ready_us[FAKE_REPLIES];
+static int reply_head, reply_count;
+static unsigned char stream_report[FAKE_PACKET];
+static int stream_full;
+static unsigned long long next_stream_us;
+static unsigned long completions;
+static unsigned long long last_runnable_us;
+
+unsigned long long fakeusb_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void append(struct fake_xfer **queue, struct fake_xfer *x)
+{
+	while (*queue)
+		queue = &(*queue)->next;
+	x->next = NULL;
+	*queue = x;
+}
+
+static struct fake_xfer *take(struct fake_xfer **queue, struct libusb_transfer *t)
+{
+	struct fake_xfer *x;
+
+	for (; *queue; queue = &(*queue)->next) {
+		if ((*queue)->t == t) {
+			x = *queue;
+			*queue = x->next;
+			return x;
+		}
+	}
+	return NULL;
+}
+
+/* Move x to the done queue. Called with bus_lock held. */
+static void finish(struct fake_xfer *x, enum libusb_transfer_status status, int len, int delay)
+{
+	unsigned long long now = fakeusb_now_us();
+	uint64_t one = 1;
+
+	x->t->status = status;
+	x->t->actual_length = len;
+	x->runnable_us = now;
+	if (delay) {
+		completions++;
+		if (fakeusb.stall_every && completions % fakeusb.stall_every == 0)
+			x->runnable_us += fakeusb.stall_us;
+		else
+			x->runnable_us += fakeusb.host_us;
+		if (x->runnable_us < last_runnable_us)
+			x->runnable_us = last_runnable_us;
+		last_runnable_us = x->runnable_us;
+	}
+	append(&done_queue, x);
+	pthread_cond_broadcast(&bus_cond);
+	if (write(event_fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+/* The device answers a request by echoing it. Called with bus_lock held. */
+static void device_request(const unsigned char *req, int len, unsigned long long ready_us)
+{
+	int slot;
+
+	if (reply_count == FAKE_REPLIES)
+		return;
+	slot = (reply_head + reply_count) % FAKE_REPLIES;
+	memset(replies[slot], 0, FAKE_PACKET);
+	memcpy(replies[slot], req, len < FAKE_PACKET ? len : FAKE_PACKET);
+	reply_ready_us[slot] = ready_us;
+	reply_count++;
+}
+
+static void device_stream(unsigned long long now)
+{
+	unsigned long seq = fakeusb.streamed++;
+	int i;
+
+	if (stream_full)
+		fakeusb.lost++;
+	memset(stream_report, 0, FAKE_PACKET);
+	for (i = 0; i < 4; i++)
+		stream_report[i] = seq >> (8 * i);
+	for (i = 0; i < 8; i++)
+		stream_report[4 + i] = now >> (8 * i);
+	stream_full = 1;
+}
+
+/* One frame's worth of bus traffic. Called with bus_lock held. */
+static void bus_frame(unsigned long long now)
+{
+	struct fake_xfer *x, **pos;
+	int len;
+
+	if (fakeusb.stream_us && now >= next_stream_us) {
+		device_stream(now);
+		next_stream_us += fakeusb.stream_us;
+		if (next_stream_us < now)
+			next_stream_us = now + fakeusb.stream_us;
+	}
+
+	/* IN transfers that waited too long */
+	for (pos = &in_queue; *pos; ) {
+		x = *pos;
+		if (x->t->timeout && now - x->submitted_us >= x->t->timeout * 1000ULL) {
+			*pos = x->next;
+			finish(x, LIBUSB_TRANSFER_TIMED_OUT, 0, 1);
+		}
+		else
+			pos = &x->next;
+	}
+
+	/* One packet out, answered from the next frame on */
+	if (out_queue) {
+		x = out_queue;
+		out_queue = x->next;
+		device_request(x->t->buffer, x->t->length, now + fakeusb.frame_us);
+		finish(x, LIBUSB_TRANSFER_COMPLETED, x->t->length, 1);
+	}
+
+	/* One packet in, an answer first */
+	if (in_queue && reply_count && reply_ready_us[reply_head] <= now) {
+		x = in_queue;
+		in_queue = x->next;
+		len = x->t->length < FAKE_PACKET ? x->t->length : FAKE_PACKET;
+		memcpy(x->t->buffer, replies[reply_head], len);
+		reply_head = (reply_head + 1) % FAKE_REPLIES;
+		reply_count--;
+		finish(x, LIBUSB_TRANSFER_COMPLETED, len, 1);
+	}
+	else if (in_queue && stream_full) {
+		x = in_queue;
+		in_queue = x->next;
+		len = x->t->length < FAKE_PACKET ? x->t->length : FAKE_PACKET;
+		memcpy(x->t->buffer, stream_report, len);
+		stream_full = 0;
+		finish(x, LIBUSB_TRANSFER_COMPLETED, len, 1);
+	}
+}
+
+static void *bus_main(void *arg)
+{
+	struct timespec next;
+	unsigned long long frame_ns = fakeusb.frame_us * 1000ULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	pthread_mutex_lock(&bus_lock);
+	next_stream_us = fakeusb_now_us();
+	while (bus_running) {
+		pthread_mutex_unlock(&bus_lock);
+		next.tv_nsec += frame_ns;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		pthread_mutex_lock(&bus_lock);
+		bus_frame(fakeusb_now_us());
+	}
+	pthread_mutex_unlock(&bus_lock);
+	return arg;
+}
+
+int libusb_init(libusb_context **ctx)
+{
+	pthread_condattr_t attr;
+
+	if (ctx)
+		*ctx = NULL;
+	if (bus_running)
+		return 0;
+	if (fakeusb.frame_us == 0)
+		fakeusb.frame_us = 1000;
+	event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (event_fd < 0)
+		return LIBUSB_ERROR_NO_MEM;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&bus_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	bus_running = 1;
+	if (pthread_create(&bus_thread, NULL, bus_main, NULL) != 0) {
+		bus_running = 0;
+		pthread_cond_destroy(&bus_cond);
+		close(event_fd);
+		event_fd = -1;
+		return LIBUSB_ERROR_NO_MEM;
+	}
+	return 0;
+}
+
+void libusb_exit(libusb_context *ctx)
+{
+	if (!bus_running)
+		return;
+	pthread_mutex_lock(&bus_lock);
+	bus_running = 0;
+	pthread_mutex_unlock(&bus_lock);
+	pthread_join(bus_thread, NULL);
+	pthread_cond_destroy(&bus_cond);
+	close(event_fd);
+	event_fd = -1;
+}
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+	*list = calloc(2, sizeof(**list));
+	if (!*list)
+		return LIBUSB_ERROR_NO_MEM;
+	(*list)[0] = &the_device;
+	return 1;
+}
+
+void libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+	free(list);
+}
+
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->bLength = 18;
+	desc->bDescriptorType = 1;
+	desc->bcdUSB = 0x0200;
+	desc->bDeviceClass = LIBUSB_CLASS_PER_INTERFACE;
+	desc->bMaxPacketSize0 = 64;
+	desc->idVendor = FAKE_VID;
+	desc->idProduct = FAKE_PID;
+	desc->bcdDevice = 0x0100;
+	desc->iManufacturer = 1;
+	desc->iProduct = 2;
+	desc->iSerialNumber = 3;
+	desc->bNumConfigurations = 1;
+	return 0;
+}
+
+static const struct libusb_endpoint_descriptor endpoints[] = {
+	{
+		.bLength		= 7,
+		.bDescriptorType	= 5,
+		.bEndpointAddress	= FAKE_EP_IN,
+		.bmAttributes		= LIBUSB_TRANSFER_TYPE_INTERRUPT,
+		.wMaxPacketSize		= FAKE_PACKET,
+		.bInterval		= 1,
+	},
+	{
+		.bLength		= 7,
+		.bDescriptorType	= 5,
+		.bEndpointAddress	= FAKE_EP_OUT,
+		.bmAttributes		= LIBUSB_TRANSFER_TYPE_INTERRUPT,
+		.wMaxPacketSize		= FAKE_PACKET,
+		.bInterval		= 1,
+	},
+};
+
+static const struct libusb_interface_descriptor hid_altsetting = {
+	.bLength		= 9,
+	.bDescriptorType	= 4,
+	.bNumEndpoints		= 2,
+	.bInterfaceClass	= LIBUSB_CLASS_HID,
+	.endpoint		= endpoints,
+};
+
+static const struct libusb_interface hid_interface = {
+	.altsetting		= &hid_altsetting,
+	.num_altsetting		= 1,
+};
+
+static struct libusb_config_descriptor config = {
+	.bLength		= 9,
+	.bDescriptorType	= 2,
+	.bNumInterfaces		= 1,
+	.bConfigurationValue	= 1,
+	.interface		= &hid_interface,
+};
+
+int libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config_descriptor **desc)
+{
+	*desc = &config;
+	return 0;
+}
+
+int libusb_get_config_descriptor(libusb_device *dev, uint8_t index, struct libusb_config_descriptor **desc)
+{
+	*desc = &config;
+	return 0;
+}
+
+void libusb_free_config_descriptor(struct libusb_config_descriptor *desc)
+{
+}
+
+uint8_t libusb_get_bus_number(libusb_device *dev)
+{
+	return 1;
+}
+
+uint8_t libusb_get_device_address(libusb_device *dev)
+{
+	return 2;
+}
+
+int libusb_open(libusb_device *dev, libusb_device_handle **handle)
+{
+	*handle = calloc(1, sizeof(**handle));
+	if (!*handle)
+		return LIBUSB_ERROR_NO_MEM;
+	(*handle)->dev = dev;
+	return 0;
+}
+
+void libusb_close(libusb_device_handle *handle)
+{
+	free(handle);
+}
+
+int libusb_kernel_driver_active(libusb_device_handle *handle, int interface_number)
+{
+	return 0;
+}
+
+int libusb_detach_kernel_driver(libusb_device_handle *handle, int interface_number)
+{
+	return 0;
+}
+
+int libusb_attach_kernel_driver(libusb_device_handle *handle, int interface_number)
+{
+	return 0;
+}
+
+int libusb_claim_interface(libusb_device_handle *handle, int interface_number)
+{
+	return 0;
+}
+
+int libusb_release_interface(libusb_device_handle *handle, int interface_number)
+{
+	return 0;
+}
+
+/* String descriptor index as UTF-16LE, index 0 being the language list */
+static int string_descriptor(int index, unsigned char *data, int length)
+{
+	static const char *const strings[] = { NULL, "Corsair", "Commander", "FAKE0001" };
+	const char *s;
+	int i, n;
+
+	if (index == 0) {
+		const unsigned char langs[] = { 4, 3, 0x09, 0x04 };
+		n = length < 4 ? length : 4;
+		memcpy(data, langs, n);
+		return n;
+	}
+	if (index >= (int)(sizeof(strings) / sizeof(strings[0])))
+		return LIBUSB_ERROR_IO;
+	s = strings[index];
+	n = 2 + 2 * strlen(s);
+	if (n > length)
+		n = length & ~1;
+	data[0] = n;
+	data[1] = 3;
+	for (i = 2; i + 1 < n; i += 2) {
+		data[i] = s[i / 2 - 1];
+		data[i + 1] = 0;
+	}
+	return n;
+}
+
+int libusb_control_transfer(libusb_device_handle *handle, uint8_t request_type,
+	uint8_t request, uint16_t value, uint16_t index, unsigned char *data,
+	uint16_t length, unsigned int timeout)
+{
+	if ((request_type & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+		if (request == LIBUSB_REQUEST_GET_DESCRIPTOR && (value >> 8) == 3) {
+			__atomic_add_fetch(&fakeusb.string_reads, 1, __ATOMIC_RELAXED);
+			return string_descriptor(value & 0xff, data, length);
+		}
+		return LIBUSB_ERROR_IO;
+	}
+
+	/* HID SET_REPORT: answered like a report on the OUT endpoint */
+	pthread_mutex_lock(&bus_lock);
+	device_request(data, length, fakeusb_now_us() + fakeusb.frame_us);
+	pthread_mutex_unlock(&bus_lock);
+	return length;
+}
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets)
+{
+	return calloc(1, sizeof(struct libusb_transfer));
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	free(transfer);
+}
+
+static int submit(struct libusb_transfer *transfer, int *sync_done)
+{
+	struct fake_xfer *x = calloc(1, sizeof(*x));
+
+	if (!x)
+		return LIBUSB_ERROR_NO_MEM;
+	x->t = transfer;
+	x->submitted_us = fakeusb_now_us();
+	x->sync_done = sync_done;
+	pthread_mutex_lock(&bus_lock);
+	append((transfer->endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN ?
+	       &in_queue : &out_queue, x);
+	pthread_mutex_unlock(&bus_lock);
+	return 0;
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	return submit(transfer, NULL);
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	struct fake_xfer *x;
+
+	pthread_mutex_lock(&bus_lock);
+	x = take(&in_queue, transfer);
+	if (!x)
+		x = take(&out_queue, transfer);
+	if (x)
+		finish(x, LIBUSB_TRANSFER_CANCELLED, 0, 0);
+	pthread_mutex_unlock(&bus_lock);
+	return x ? 0 : LIBUSB_ERROR_NOT_FOUND;
+}
+
+/* Take the done transfers that are runnable by now, and when the
+   next one will be. Called with bus_lock held. */
+static struct fake_xfer *runnable(unsigned long long now, unsigned long long *next_us)
+{
+	struct fake_xfer *ready = NULL, **tail = &ready, **pos, *x;
+
+	*next_us = 0;
+	for (pos = &done_queue; *pos; ) {
+		x = *pos;
+		if (x->runnable_us <= now) {
+			*pos = x->next;
+			x->next = NULL;
+			*tail = x;
+			tail = &x->next;
+		}
+		else {
+			if (*next_us == 0 || x->runnable_us < *next_us)
+				*next_us = x->runnable_us;
+			pos = &x->next;
+		}
+	}
+	return ready;
+}
+
+static void run_callbacks(struct fake_xfer *ready)
+{
+	struct fake_xfer *x;
+
+	while (ready) {
+		x = ready;
+		ready = x->next;
+		if (x->sync_done) {
+			pthread_mutex_lock(&bus_lock);
+			*x->sync_done = 1;
+			pthread_cond_broadcast(&bus_cond);
+			pthread_mutex_unlock(&bus_lock);
+		}
+		else if (x->t->callback)
+			x->t->callback(x->t);
+		free(x);
+	}
+}
+
+static void abs_time(struct timespec *ts, unsigned long long us)
+{
+	ts->tv_sec = us / 1000000ULL;
+	ts->tv_nsec = (us % 1000000ULL) * 1000;
+}
+
+int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv)
+{
+	struct fake_xfer *ready = NULL;
+	struct timespec ts;
+	unsigned long long now, deadline, next_us;
+	uint64_t count;
+
+	now = fakeusb_now_us();
+	deadline = now + tv->tv_sec * 1000000ULL + tv->tv_usec;
+
+	/* One thread handles events at a time, as in libusb */
+	abs_time(&ts, deadline);
+	if (pthread_mutex_lock(&event_lock) != 0)
+		return LIBUSB_ERROR_IO;
+
+	pthread_mutex_lock(&bus_lock);
+	if (read(event_fd, &count, sizeof(count)) < 0)
+		count = 0;
+	for (;;) {
+		now = fakeusb_now_us();
+		ready = runnable(now, &next_us);
+		if (ready || now >= deadline)
+			break;
+		if (next_us == 0 || next_us > deadline)
+			next_us = deadline;
+		abs_time(&ts, next_us);
+		pthread_cond_timedwait(&bus_cond, &bus_lock, &ts);
+	}
+	pthread_mutex_unlock(&bus_lock);
+
+	run_callbacks(ready);
+	pthread_mutex_unlock(&event_lock);
+	return 0;
+}
+
+int libusb_handle_events(libusb_context *ctx)
+{
+	struct timeval tv = { 60, 0 };
+
+	return libusb_handle_events_timeout(ctx, &tv);
+}
+
+int libusb_interrupt_transfer(libusb_device_handle *handle, unsigned char endpoint,
+	unsigned char *data, int length, int *transferred, unsigned int timeout)
+{
+	struct libusb_transfer transfer;
+	struct fake_xfer *ready;
+	unsigned long long next_us;
+	struct timespec ts;
+	int done = 0, res;
+
+	memset(&transfer, 0, sizeof(transfer));
+	libusb_fill_interrupt_transfer(&transfer, handle, endpoint, data, length,
+				       NULL, NULL, timeout);
+	res = submit(&transfer, &done);
+	if (res < 0)
+		return res;
+
+	/* Run whatever is runnable, like libusb does while it waits, until
+	   this transfer is done. */
+	pthread_mutex_lock(&bus_lock);
+	while (!done) {
+		ready = runnable(fakeusb_now_us(), &next_us);
+		if (ready) {
+			pthread_mutex_unlock(&bus_lock);
+			run_callbacks(ready);
+			pthread_mutex_lock(&bus_lock);
+			continue;
+		}
+		abs_time(&ts, next_us ? next_us : fakeusb_now_us() + fakeusb.frame_us);
+		pthread_cond_timedwait(&bus_cond, &bus_lock, &ts);
+	}
+	pthread_mutex_unlock(&bus_lock);
+
+	*transferred = transfer.actual_length;
+	switch (transfer.status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		return 0;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return LIBUSB_ERROR_TIMEOUT;
+	default:
+		return LIBUSB_ERROR_IO;
+	}
+}
+
+const struct libusb_pollfd **libusb_get_pollfds(libusb_context *ctx)
+{
+	static struct libusb_pollfd pollfd;
+	const struct libusb_pollfd **list = calloc(2, sizeof(*list));
+
+	if (!list)
+		return NULL;
+	pollfd.fd = event_fd;
+	pollfd.events = POLLIN;
+	list[0] = &pollfd;
+	return list;
+}
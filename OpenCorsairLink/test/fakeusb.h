@@ -0,0 +1,33 @@
+/*
+ * A stand-in for libusb-1.0, linked into the benchmarks instead of the
+ * real library so that hid-libusb.c can be timed against a device that
+ * behaves like a USB one without one being attached. See fakeusb.c.
+ */
+
+struct fakeusb_config {
+	/* Set before hid_init() */
+	unsigned int	frame_us;	/* Interval the endpoints are polled at, 1000 by default */
+	unsigned int	host_us;	/* From a transfer finishing to its callback being runnable */
+	unsigned int	stall_every;	/* Every this many completions, 0 for never, ... */
+	unsigned int	stall_us;	/* ... takes this long instead of host_us */
+	unsigned int	stream_us;	/* The device sends a report this often, 0 for never */
+
+	/* Counters */
+	unsigned long	streamed;	/* Reports the device made */
+	unsigned long	lost;		/* Reports overwritten in the device before a transfer took them */
+	unsigned long	string_reads;	/* String descriptor requests, the language list included */
+};
+
+extern struct fakeusb_config fakeusb;
+
+/* The clock the device stamps its streamed reports with */
+unsigned long long fakeusb_now_us(void);
+
+/*
+ * A streamed report starts with its number and the time it was made,
+ * both little endian.
+ */
+#define FAKEUSB_SEQ(r)	((unsigned int)(r)[0] | (unsigned int)(r)[1] << 8 | \
+			 (unsigned int)(r)[2] << 16 | (unsigned int)(r)[3] << 24)
+#define FAKEUSB_STAMP(r) \
+	((unsigned long long)FAKEUSB_SEQ((r) + 8) << 32 | FAKEUSB_SEQ((r) + 4))
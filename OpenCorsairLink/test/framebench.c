@@ -0,0 +1,104 @@
+/*
+ * Cost of building one request frame with CorsairFrame_encode() and
+ * of taking its reply apart with CorsairFrame_decode(), for both
+ * framings.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairFrame.h"
+#include "bench.h"
+
+#define ROUNDS		10000000
+
+/* The reads of one fan on the H80i, all in one report */
+static void h80i_fan_ops(CorsairOp_t *ops)
+{
+	memset(ops, 0x00, 4 * sizeof(*ops));
+	ops[0].opcode = WriteOneByte;
+	ops[0].reg = FAN_Select;
+	ops[0].data[0] = 2;
+	ops[1].opcode = ReadOneByte;
+	ops[1].reg = FAN_Mode;
+	ops[2].opcode = ReadTwoBytes;
+	ops[2].reg = FAN_ReadRPM;
+	ops[3].opcode = ReadTwoBytes;
+	ops[3].reg = FAN_MaxRecordedRPM;
+}
+
+static void report(const char *what, unsigned long long ns, int frames)
+{
+	printf("%-28s %7.2f ns/frame\n", what, (double)ns / frames);
+}
+
+int main(void)
+{
+	unsigned char frame[CL_MAX_FRAME];
+	unsigned char reply[16];
+	CorsairOp_t ops[4];
+	unsigned long long t0;
+	int i, j;
+
+	/* Encode: H80i, one fan per report */
+	h80i_fan_ops(ops);
+	t0 = bench_now_ns();
+	for (i = 0; i < ROUNDS; i++) {
+		for (j = 0; j < 4; j++)
+			ops[j].cmdId = 0x81 + ((i + j) & 0x3f);
+		bench_sink += CorsairFrame_encode(frame, H80I, ops, 4) + frame[1];
+	}
+	report("encode h80i (4 ops)", bench_now_ns() - t0, ROUNDS);
+
+	/* Encode: Cooling Node, one op per report */
+	memset(ops, 0x00, sizeof(ops[0]));
+	ops[0].opcode = ReadTwoBytes;
+	ops[0].reg = 0x0b;
+	t0 = bench_now_ns();
+	for (i = 0; i < ROUNDS; i++) {
+		ops[0].cmdId = 0x81 + (i & 0x3f);
+		bench_sink += CorsairFrame_encode(frame, CLINK, ops, 1) + frame[0];
+	}
+	report("encode clink (1 op)", bench_now_ns() - t0, ROUNDS);
+
+	/* Decode: the H80i reply to the fan frame above */
+	h80i_fan_ops(ops);
+	for (j = 0; j < 4; j++)
+		ops[j].cmdId = 0x81 + j;
+	memset(reply, 0x00, sizeof(reply));
+	i = 0;
+	reply[i++] = 0x81; reply[i++] = WriteOneByte;
+	reply[i++] = 0x82; reply[i++] = ReadOneByte; reply[i++] = 0x86;
+	reply[i++] = 0x83; reply[i++] = ReadTwoBytes; reply[i++] = 0xe8; reply[i++] = 0x03;
+	reply[i++] = 0x84; reply[i++] = ReadTwoBytes; reply[i++] = 0xd0; reply[i++] = 0x07;
+	t0 = bench_now_ns();
+	for (i = 0; i < ROUNDS; i++) {
+		if (CorsairFrame_decode(reply, sizeof(reply), ops, 4) != 4) {
+			fprintf(stderr, "decode failed\n");
+			return 1;
+		}
+		bench_sink += ops[2].value;
+	}
+	report("decode h80i (4 ops)", bench_now_ns() - t0, ROUNDS);
+
+	/* Decode: a Cooling Node RPM reply */
+	memset(ops, 0x00, sizeof(ops[0]));
+	ops[0].opcode = ReadTwoBytes;
+	ops[0].reg = 0x0b;
+	ops[0].cmdId = 0x81;
+	reply[0] = 0x81; reply[1] = ReadTwoBytes; reply[2] = 0xe8; reply[3] = 0x03;
+	t0 = bench_now_ns();
+	for (i = 0; i < ROUNDS; i++) {
+		if (CorsairFrame_decode(reply, 4, ops, 1) != 1) {
+			fprintf(stderr, "decode failed\n");
+			return 1;
+		}
+		bench_sink += ops[0].value;
+	}
+	report("decode clink (1 op)", bench_now_ns() - t0, ROUNDS);
+
+	return 0;
+}
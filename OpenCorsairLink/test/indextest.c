@@ -0,0 +1,339 @@
+/*
+ * The device index in hid-index.h, on a bus and a udev monitor made up
+ * here. The monitor is a pipe: posting an event queues it and writes a
+ * byte, so the index's poll() sees it the way it sees a netlink
+ * message.
+ *
+ * Checks that a removed device is taken out of the index in place with
+ * no rescan, that an added device, or an event the monitor fails to
+ * hand over, makes the next query scan again, and that device strings
+ * are only read for the devices a query returns, once each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <libudev.h>
+#include "hidapi.h"
+
+#define BUS_MAX		8
+#define EVENTS_MAX	8
+
+struct bus_device {
+	const char	*path;
+	unsigned short	vendor_id;
+	unsigned short	product_id;
+	const wchar_t	*serial;
+	int		strings_read;	/* Times the index asked for its strings */
+};
+
+static struct bus_device bus[BUS_MAX];
+static int bus_count;
+static int scans;
+
+/* A udev event: an action on the device with that path, NULL for one
+   the monitor fails to receive */
+struct udev_device {
+	const char	*action;
+	const char	*syspath;
+};
+
+static struct udev_device events[EVENTS_MAX];
+static int events_head, events_tail;
+static int monitor_pipe[2];
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+/* What hid-index.h needs of hidapi and libudev */
+
+void HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+	struct hid_device_info *next;
+
+	for (; devs; devs = next) {
+		next = devs->next;
+		free(devs->path);
+		free(devs->serial_number);
+		free(devs->manufacturer_string);
+		free(devs->product_string);
+		free(devs);
+	}
+}
+
+struct udev *udev_new(void)
+{
+	return (struct udev *)&monitor_pipe;
+}
+
+struct udev *udev_unref(struct udev *udev)
+{
+	return NULL;
+}
+
+struct udev_monitor *udev_monitor_new_from_netlink(struct udev *udev, const char *name)
+{
+	return (struct udev_monitor *)&monitor_pipe;
+}
+
+int udev_monitor_filter_add_match_subsystem_devtype(struct udev_monitor *m, const char *subsystem, const char *devtype)
+{
+	return 0;
+}
+
+int udev_monitor_enable_receiving(struct udev_monitor *m)
+{
+	return 0;
+}
+
+int udev_monitor_get_fd(struct udev_monitor *m)
+{
+	return monitor_pipe[0];
+}
+
+struct udev_device *udev_monitor_receive_device(struct udev_monitor *m)
+{
+	struct udev_device *dev;
+	char byte;
+
+	if (read(monitor_pipe[0], &byte, 1) != 1 || events_head == events_tail)
+		return NULL;
+	dev = &events[events_head++ % EVENTS_MAX];
+	return dev->action ? dev : NULL;
+}
+
+struct udev_monitor *udev_monitor_unref(struct udev_monitor *m)
+{
+	return NULL;
+}
+
+const char *udev_device_get_action(struct udev_device *dev)
+{
+	return dev->action;
+}
+
+struct udev_device *udev_device_unref(struct udev_device *dev)
+{
+	return NULL;
+}
+
+#include "../hidapi-0.7.0/linux/hid-index.h"
+
+/* The backend side: scan the bus, match removals by path, read strings */
+
+static struct hid_device_info *scan_bus(void)
+{
+	struct hid_device_info *root = NULL, **tail = &root;
+	int i;
+
+	scans++;
+	for (i = 0; i < bus_count; i++) {
+		*tail = calloc(1, sizeof(**tail));
+		(*tail)->path = strdup(bus[i].path);
+		(*tail)->vendor_id = bus[i].vendor_id;
+		(*tail)->product_id = bus[i].product_id;
+		tail = &(*tail)->next;
+	}
+	return root;
+}
+
+static int match_path(struct hid_device_info *info, struct udev_device *udev_dev)
+{
+	return strcmp(info->path, udev_dev->syspath) == 0;
+}
+
+static void read_strings(struct hid_device_info *info)
+{
+	int i;
+
+	for (i = 0; i < bus_count; i++) {
+		if (strcmp(bus[i].path, info->path) == 0) {
+			bus[i].strings_read++;
+			info->serial_number = wcsdup(bus[i].serial);
+		}
+	}
+}
+
+static struct hid_index index_under_test = {
+	PTHREAD_MUTEX_INITIALIZER,
+	"hidraw", NULL,
+	scan_bus,
+	match_path,
+	read_strings,
+};
+
+static void bus_add(const char *path, unsigned short pid, const wchar_t *serial)
+{
+	bus[bus_count].path = path;
+	bus[bus_count].vendor_id = 0x1b1c;
+	bus[bus_count].product_id = pid;
+	bus[bus_count].serial = serial;
+	bus[bus_count].strings_read = 0;
+	bus_count++;
+}
+
+static void bus_remove(const char *path)
+{
+	int i;
+
+	for (i = 0; i < bus_count; i++) {
+		if (strcmp(bus[i].path, path) == 0) {
+			bus[i] = bus[--bus_count];
+			return;
+		}
+	}
+}
+
+static void post(const char *action, const char *path)
+{
+	events[events_tail % EVENTS_MAX].action = action;
+	events[events_tail % EVENTS_MAX].syspath = path;
+	events_tail++;
+	if (write(monitor_pipe[1], "e", 1) != 1) {
+		perror("write");
+		exit(1);
+	}
+}
+
+static int strings_read(const char *path)
+{
+	int i;
+
+	for (i = 0; i < bus_count; i++) {
+		if (strcmp(bus[i].path, path) == 0)
+			return bus[i].strings_read;
+	}
+	return -1;
+}
+
+/* The paths a query returns, comma separated, in order */
+static const char *query(unsigned short pid)
+{
+	static char paths[128];
+	struct hid_device_info *devs, *cur;
+
+	hid_index_refresh(&index_under_test);
+	devs = hid_index_enumerate(&index_under_test, pid ? 0x1b1c : 0, pid);
+	paths[0] = '\0';
+	for (cur = devs; cur; cur = cur->next) {
+		if (cur != devs)
+			strcat(paths, ",");
+		strcat(paths, cur->path);
+	}
+	hid_free_enumeration(devs);
+	return paths;
+}
+
+static void test_remove_in_place(void)
+{
+	CHECK(!strcmp(query(0x0c04), "h80i-a,h80i-b"));
+	CHECK(!strcmp(query(0), "h80i-a,h80i-b,clink-a"));
+	CHECK(scans == 1);
+
+	/* Gone from the bus and from every query, without a rescan */
+	bus_remove("h80i-b");
+	post("remove", "h80i-b");
+	CHECK(!strcmp(query(0x0c04), "h80i-a"));
+	CHECK(!strcmp(query(0), "h80i-a,clink-a"));
+	CHECK(scans == 1);
+
+	/* Removing something the index never had changes nothing */
+	post("remove", "elsewhere");
+	CHECK(!strcmp(query(0), "h80i-a,clink-a"));
+	CHECK(scans == 1);
+}
+
+static void test_rescan(void)
+{
+	/* A device arriving means scanning again, once */
+	bus_add("h80i-c", 0x0c04, L"C");
+	post("add", "h80i-c");
+	CHECK(!strcmp(query(0x0c04), "h80i-a,h80i-c"));
+	CHECK(scans == 2);
+	CHECK(!strcmp(query(0x0c04), "h80i-a,h80i-c"));
+	CHECK(scans == 2);
+
+	/* So does an event the monitor could not hand over: it may
+	   have been one that changed the bus */
+	bus_add("clink-b", 0x0c02, L"D");
+	post(NULL, "clink-b");
+	CHECK(!strcmp(query(0x0c02), "clink-a,clink-b"));
+	CHECK(scans == 3);
+}
+
+static void test_lazy_strings(void)
+{
+	struct hid_device_info *devs;
+	char *path;
+	int i;
+
+	/* A fresh scan reads nobody's strings */
+	for (i = 0; i < bus_count; i++)
+		bus[i].strings_read = 0;
+	post("add", "nothing");
+	hid_index_refresh(&index_under_test);
+	CHECK(scans == 4);
+	for (i = 0; i < bus_count; i++)
+		CHECK(bus[i].strings_read == 0);
+
+	/* Finding by VID/PID alone needs no strings */
+	path = hid_index_find(&index_under_test, 0x1b1c, 0x0c04, NULL);
+	CHECK(path && !strcmp(path, "h80i-a"));
+	free(path);
+	CHECK(strings_read("h80i-a") == 0 && strings_read("h80i-c") == 0);
+
+	/* Finding by serial reads them up to the match, and no further */
+	path = hid_index_find(&index_under_test, 0x1b1c, 0x0c04, L"A");
+	CHECK(path && !strcmp(path, "h80i-a"));
+	free(path);
+	CHECK(strings_read("h80i-a") == 1 && strings_read("h80i-c") == 0);
+
+	/* A query reads them for what it returns, and only once */
+	query(0x0c02);
+	CHECK(strings_read("clink-a") == 1 && strings_read("clink-b") == 1);
+	CHECK(strings_read("h80i-c") == 0);
+	query(0);
+	query(0);
+	CHECK(strings_read("h80i-a") == 1 && strings_read("h80i-c") == 1);
+	CHECK(strings_read("clink-a") == 1 && strings_read("clink-b") == 1);
+
+	/* The copies handed out carry them */
+	devs = hid_index_enumerate(&index_under_test, 0x1b1c, 0x0c04);
+	CHECK(devs && devs->serial_number && !wcscmp(devs->serial_number, L"A"));
+	CHECK(devs && devs->next && devs->next->serial_number &&
+	      !wcscmp(devs->next->serial_number, L"C"));
+	hid_free_enumeration(devs);
+}
+
+int main(void)
+{
+	if (pipe(monitor_pipe) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	bus_add("h80i-a", 0x0c04, L"A");
+	bus_add("h80i-b", 0x0c04, L"B");
+	bus_add("clink-a", 0x0c02, L"C-A");
+
+	test_remove_in_place();
+	test_rescan();
+	test_lazy_strings();
+
+	hid_index_free(&index_under_test);
+	if (failures) {
+		fprintf(stderr, "indextest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("indextest: ok\n");
+	return 0;
+}
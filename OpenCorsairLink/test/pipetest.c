@@ -0,0 +1,149 @@
+/*
+ * Reply routing against the simulator, with replies dropped, held back
+ * behind the next one and sent twice. A request that times out has its
+ * reply turn up later, in the middle of someone else's transaction,
+ * which is what used to put the pump's RPM on a fan.
+ *
+ * Every sweep ReadAllInfo() reports as good must have each value on its
+ * own channel: the fan modes say which fans are there, the RPMs sit
+ * near what each fan's curve asks for, and the Cooling Node sensors
+ * keep the 3C steps between them the simulator puts there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairTransport.h"
+#include "CorsairSim.h"
+
+#define SWEEPS		100
+#define FAULTS		"latency=200,jitter=100,drop=2,reorder=5,dup=2"
+
+static int failures;
+static FILE *report;	/* stderr, which the library's own complaints do not go to */
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(report, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+/* What the simulator's fans run at in Default mode below 30C */
+static int expected_rpm(int interface, int i)
+{
+	if (interface == CLINK)
+		return i < 3 ? 0.35 * (1600 + 200 * i) : 0;
+	if (i == 4)
+		return 0.35 * 2800;
+	return i < 2 ? 0.35 * 2000 : 0;
+}
+
+static int expected_mode(int interface, int i)
+{
+	int present = interface == CLINK ? i < 3 : i < 2 || i == 4;
+	int tach = interface == CLINK || i < 2;
+
+	return Default | (present ? 0x80 : 0) | (tach ? 0x01 : 0);
+}
+
+static int check_sweep(CorsairLink_t *cl, int interface, unsigned short *temps, int ntemps)
+{
+	int before = failures;
+	int i, rpm;
+
+	for (i = 0; i < NUMFANS; i++) {
+		rpm = expected_rpm(interface, i);
+		CHECK(cl->fans[i].Mode == expected_mode(interface, i));
+		CHECK(cl->fans[i].RPM >= rpm * 0.85 && cl->fans[i].RPM <= rpm * 1.15);
+	}
+	for (i = 0; i < ntemps; i++) {
+		CHECK(temps[i] >= 15 * 256 && temps[i] <= 45 * 256);
+		if (i > 0)
+			CHECK(temps[i] - temps[i - 1] >= 2 * 256 && temps[i] - temps[i - 1] <= 4 * 256);
+	}
+	return failures == before;
+}
+
+static void run(int interface, int window)
+{
+	const char *name = interface == CLINK ? "clink" : "h80i";
+	CorsairLink_t cl;
+	unsigned short temps[NUMTEMPS];
+	int ntemps = interface == CLINK ? 4 : 1;
+	int sweep, good = 0;
+	int quiet;
+	char path[32];
+
+	/* Open it cleanly, then let the faults in */
+	CorsairSim_configure("h80i=1,clink=1,latency=200,jitter=0,drop=0,reorder=0,dup=0");
+	memset(&cl, 0, sizeof(cl));
+	cl.transport = &CorsairSimTransport;
+	snprintf(path, sizeof(path), "sim:%s:0", name);
+	strcpy(cl.path, path);
+	cl.max_ms_read_wait = 20;
+	cl.window = window;
+	if (!CorsairLink_init(&cl, interface)) {
+		fprintf(stderr, "unable to open %s\n", path);
+		failures++;
+		return;
+	}
+	CorsairSim_configure(FAULTS);
+
+	/* Every fault gets a line on stderr, keep them out of the way */
+	fflush(stderr);
+	quiet = open("/dev/null", O_WRONLY);
+	dup2(quiet, 2);
+
+	for (sweep = 0; sweep < SWEEPS; sweep++) {
+		memset(temps, 0, sizeof(temps));
+		if (ReadAllInfo(&cl, interface, temps, ntemps))
+			continue;
+		if (!check_sweep(&cl, interface, temps, ntemps)) {
+			fprintf(report, "%s window %d: sweep %d has values on the wrong channel\n",
+				name, window, sweep);
+			break;
+		}
+		good++;
+	}
+	fflush(stderr);
+	dup2(fileno(report), 2);
+	close(quiet);
+
+	printf("pipetest: %-5s window %d: %3d of %d sweeps good, %lu timeouts, %lu stale, %lu dup\n",
+	       name, window, good, SWEEPS, cl.latency.timeouts, cl.stale_replies, cl.dup_replies);
+
+	/* The faults happened, and enough sweeps got through to mean something */
+	CHECK(cl.stale_replies > 0);
+	CHECK(cl.latency.timeouts > 0);
+	CHECK(good > SWEEPS / 4);
+	Close(&cl);
+}
+
+int main(void)
+{
+	static const int windows[] = { 1, 4 };
+	unsigned int i;
+
+	report = fdopen(dup(2), "w");
+	if (!report)
+		return 1;
+	setvbuf(report, NULL, _IONBF, 0);
+	for (i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+		run(H80I, windows[i]);
+		run(CLINK, windows[i]);
+	}
+
+	if (failures) {
+		fprintf(stderr, "pipetest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("pipetest: ok\n");
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Sustained input report rate and latency with one interrupt IN
+ * transfer queued against several, through hid-libusb.c and the fake
+ * bus in fakeusb.c. The device streams a report every frame and can
+ * only hold one, so a frame in which no transfer is queued costs a
+ * report. Latency runs from the device making a report to hid_read()
+ * returning it.
+ *
+ * Each setting runs once on a quiet host and once on one where every
+ * STALL_EVERY'th completion is held up STALL_US, as when the event
+ * thread is descheduled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "hidapi.h"
+#include "fakeusb.h"
+
+#define RUN_US		2000000
+#define REPORT		64
+#define STALL_EVERY	100
+#define STALL_US	3000
+
+static unsigned long long latency[2 * RUN_US / 1000];
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int run(int transfers, int stall)
+{
+	unsigned char in[REPORT];
+	unsigned long long start, now;
+	unsigned long streamed, lost, seq, next_seq = 0;
+	unsigned long missed = 0;
+	int n = 0, res;
+	hid_device *dev;
+
+	fakeusb.stall_every = stall? STALL_EVERY: 0;
+	if (hid_set_input_transfers(transfers) < 0)
+		return -1;
+	dev = hid_open(0x1b1c, 0x0c02, NULL);
+	if (!dev) {
+		fprintf(stderr, "no device on the fake bus\n");
+		return -1;
+	}
+
+	/* Let the transfers get queued, then count from here */
+	for (n = 0; n < 4; n++) {
+		if (hid_read_timeout(dev, in, sizeof(in), 100) > 0)
+			next_seq = FAKEUSB_SEQ(in) + 1;
+	}
+	n = 0;
+	streamed = fakeusb.streamed;
+	lost = fakeusb.lost;
+	start = fakeusb_now_us();
+	do {
+		res = hid_read_timeout(dev, in, sizeof(in), 100);
+		now = fakeusb_now_us();
+		if (res < 0) {
+			fprintf(stderr, "read failed\n");
+			hid_close(dev);
+			return -1;
+		}
+		if (res == 0)
+			continue;
+		seq = FAKEUSB_SEQ(in);
+		if (seq > next_seq)
+			missed += seq - next_seq;
+		next_seq = seq + 1;
+		if (n < (int)(sizeof(latency) / sizeof(latency[0])))
+			latency[n++] = now - FAKEUSB_STAMP(in);
+	} while (now - start < RUN_US);
+	streamed = fakeusb.streamed - streamed;
+	lost = fakeusb.lost - lost;
+	hid_close(dev);
+
+	qsort(latency, n, sizeof(latency[0]), cmp_ull);
+	printf("%d transfer%s %-8s %6.0f reports/s  missed %4lu of %5lu (%4lu in device)  "
+	       "latency p50 %5llu p99 %5llu p99.9 %5llu max %5llu us\n",
+	       transfers, transfers == 1? " ": "s", stall? "stalls": "quiet",
+	       n * 1e6 / RUN_US, missed, streamed, lost,
+	       latency[n / 2], latency[n * 99 / 100], latency[n * 999 / 1000],
+	       latency[n - 1]);
+	return 0;
+}
+
+int main(void)
+{
+	static const int transfers[] = { 1, 2, 4, 8 };
+	unsigned int i;
+
+	fakeusb.stream_us = fakeusb.frame_us = 1000;
+	fakeusb.host_us = 100;
+	fakeusb.stall_us = STALL_US;
+	if (hid_init() < 0)
+		return 1;
+
+	for (i = 0; i < sizeof(transfers) / sizeof(transfers[0]); i++) {
+		if (run(transfers[i], 0) < 0 || run(transfers[i], 1) < 0)
+			return 1;
+	}
+
+	hid_exit();
+	return 0;
+}
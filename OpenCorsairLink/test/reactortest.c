@@ -0,0 +1,262 @@
+/*
+ * The hidraw reactor, with socketpairs standing in for hidraw nodes.
+ * A SOCK_SEQPACKET socket hands back one message per read() the way a
+ * hidraw node hands back one report, and closing the other end looks
+ * like the device being unplugged.
+ *
+ * Checks that hid_reactor_run() wakes when a report arrives on a device
+ * it is blocked on, that reports from several devices go to their own
+ * callbacks, that a device closed while the reactor waits is reported
+ * once with an empty report and dropped, and that a device removed from
+ * inside a callback gets no callback for an event already taken.
+ */
+
+#include "../hidapi-0.7.0/linux/hid.c"
+#include <sys/socket.h>
+
+#define DEVICES		3
+
+struct fake {
+	hid_device	*dev;
+	int		peer;		/* Where the fake device writes, -1 once unplugged */
+	int		reports;	/* Callbacks with a report */
+	int		gone;		/* Callbacks with none */
+	unsigned char	last[8];
+};
+
+static struct fake fakes[DEVICES];
+static hid_reactor *reactor;
+static struct fake *remove_pair[2];	/* The first of these to get a report removes the other */
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static void fake_open(struct fake *f)
+{
+	int sv[2];
+
+	memset(f, 0, sizeof(*f));
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	f->dev = new_hid_device();
+	f->dev->device_handle = sv[0];
+	f->peer = sv[1];
+}
+
+static void fake_unplug(struct fake *f)
+{
+	close(f->peer);
+	f->peer = -1;
+}
+
+static void fake_close(struct fake *f)
+{
+	if (f->peer >= 0)
+		fake_unplug(f);
+	hid_close(f->dev);
+}
+
+static void fake_send(struct fake *f, unsigned char tag)
+{
+	unsigned char report[8];
+
+	memset(report, tag, sizeof(report));
+	if (write(f->peer, report, sizeof(report)) != sizeof(report)) {
+		perror("write");
+		exit(1);
+	}
+}
+
+static void on_report(hid_device *dev, const unsigned char *data, size_t length, void *user_data)
+{
+	struct fake *f = user_data;
+
+	CHECK(f->dev == dev);
+	if (!data) {
+		CHECK(length == 0);
+		f->gone++;
+		return;
+	}
+	CHECK(length == sizeof(f->last));
+	memcpy(f->last, data, sizeof(f->last));
+	f->reports++;
+	if (f == remove_pair[0] || f == remove_pair[1]) {
+		CHECK(hid_reactor_remove(reactor, remove_pair[f == remove_pair[0]]->dev) == 0);
+		remove_pair[0] = remove_pair[1] = NULL;
+	}
+}
+
+struct later {
+	void		(*fn)(struct fake *, int);
+	struct fake	*f;
+	int		arg;
+};
+
+static void *run_later(void *arg)
+{
+	struct later *l = arg;
+
+	usleep(50000);
+	l->fn(l->f, l->arg);
+	return NULL;
+}
+
+/* Do fn(f, arg) from another thread while this one is in the reactor */
+static pthread_t later(struct later *l)
+{
+	pthread_t thread;
+
+	pthread_create(&thread, NULL, run_later, l);
+	return thread;
+}
+
+static void send_later(struct fake *f, int tag)
+{
+	fake_send(f, tag);
+}
+
+static void unplug_later(struct fake *f, int unused)
+{
+	fake_unplug(f);
+}
+
+static void test_wakeup(void)
+{
+	struct later l = { send_later, &fakes[1], 0x5a };
+	struct pollfd pfd;
+	pthread_t thread;
+
+	/* Nothing to read: times out */
+	CHECK(hid_reactor_run(reactor, 20) == 0);
+	pfd.fd = hid_reactor_get_fd(reactor);
+	pfd.events = POLLIN;
+	CHECK(poll(&pfd, 1, 0) == 0);
+
+	/* Blocked with no timeout, a report wakes it */
+	thread = later(&l);
+	CHECK(hid_reactor_run(reactor, -1) == 1);
+	pthread_join(thread, NULL);
+	CHECK(fakes[1].reports == 1 && fakes[1].last[0] == 0x5a);
+	CHECK(fakes[0].reports == 0 && fakes[2].reports == 0);
+
+	/* The reactor's fd says when there is work, for nesting it */
+	fake_send(&fakes[2], 0x11);
+	CHECK(poll(&pfd, 1, 1000) == 1);
+	CHECK(hid_reactor_run(reactor, 0) == 1);
+	CHECK(fakes[2].reports == 1 && fakes[2].last[0] == 0x11);
+}
+
+static void test_several(void)
+{
+	int i, round, total;
+
+	for (i = 0; i < DEVICES; i++)
+		fakes[i].reports = 0;
+
+	/* One report each per wakeup, all devices in one wait */
+	for (i = 0; i < DEVICES; i++)
+		fake_send(&fakes[i], 0x20 + i);
+	CHECK(hid_reactor_run(reactor, 1000) == DEVICES);
+	for (i = 0; i < DEVICES; i++)
+		CHECK(fakes[i].reports == 1 && fakes[i].last[0] == 0x20 + i);
+
+	/* Several queued on one device come out over several calls,
+	   in order, without holding the others up */
+	for (round = 0; round < 3; round++)
+		fake_send(&fakes[0], 0x30 + round);
+	fake_send(&fakes[2], 0x40);
+	total = 0;
+	for (round = 0; round < 3; round++) {
+		total += hid_reactor_run(reactor, 1000);
+		CHECK(fakes[0].last[0] == 0x30 + round);
+	}
+	CHECK(total == 4);
+	CHECK(fakes[0].reports == 4 && fakes[1].reports == 1 && fakes[2].reports == 2);
+	CHECK(fakes[2].last[0] == 0x40);
+	CHECK(hid_reactor_run(reactor, 0) == 0);
+}
+
+static void test_close_during_wait(void)
+{
+	struct later l = { unplug_later, &fakes[1], 0 };
+	pthread_t thread;
+
+	/* Unplugged while the reactor waits on it */
+	thread = later(&l);
+	CHECK(hid_reactor_run(reactor, 1000) == 0);
+	pthread_join(thread, NULL);
+	CHECK(fakes[1].gone == 1);
+
+	/* It is no longer watched, and the others still are */
+	CHECK(hid_reactor_remove(reactor, fakes[1].dev) == -1);
+	CHECK(hid_reactor_run(reactor, 20) == 0);
+	CHECK(fakes[1].gone == 1);
+	fake_send(&fakes[0], 0x50);
+	CHECK(hid_reactor_run(reactor, 1000) == 1);
+	CHECK(fakes[0].last[0] == 0x50);
+}
+
+static void test_remove_in_callback(void)
+{
+	struct fake *ran, *removed;
+	int before0 = fakes[0].reports, before2 = fakes[2].reports;
+
+	/* Both are ready in the same wait. Whichever callback runs first
+	   removes the other device, whose event is already taken. */
+	fake_send(&fakes[0], 0x60);
+	fake_send(&fakes[2], 0x61);
+	remove_pair[0] = &fakes[0];
+	remove_pair[1] = &fakes[2];
+	CHECK(hid_reactor_run(reactor, 1000) == 1);
+	CHECK((fakes[0].reports - before0) + (fakes[2].reports - before2) == 1);
+	ran = (fakes[0].reports != before0)? &fakes[0]: &fakes[2];
+	removed = (ran == &fakes[0])? &fakes[2]: &fakes[0];
+	CHECK(hid_reactor_remove(reactor, removed->dev) == -1);
+
+	/* Its report is still there once it is watched again */
+	CHECK(hid_reactor_add(reactor, removed->dev, on_report, removed) == 0);
+	CHECK(hid_reactor_run(reactor, 1000) == 1);
+	CHECK(fakes[0].last[0] == 0x60 && fakes[2].last[0] == 0x61);
+}
+
+int main(void)
+{
+	int i;
+
+	reactor = hid_reactor_new();
+	if (!reactor) {
+		perror("hid_reactor_new");
+		return 1;
+	}
+	for (i = 0; i < DEVICES; i++) {
+		fake_open(&fakes[i]);
+		if (hid_reactor_add(reactor, fakes[i].dev, on_report, &fakes[i]) < 0) {
+			perror("hid_reactor_add");
+			return 1;
+		}
+	}
+
+	test_wakeup();
+	test_several();
+	test_close_during_wait();
+	test_remove_in_callback();
+
+	hid_reactor_free(reactor);
+	for (i = 0; i < DEVICES; i++)
+		fake_close(&fakes[i]);
+
+	if (failures) {
+		fprintf(stderr, "reactortest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("reactortest: ok\n");
+	return 0;
+}
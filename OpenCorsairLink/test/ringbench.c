@@ -0,0 +1,80 @@
+/*
+ * Cost of taking a report out of the hid-libusb input ring with
+ * hid_read_timeout(), which copies it, against hid_read_borrow(),
+ * which lends out the ring's own copy. Both touch the first and last
+ * byte of the report, as a caller would.
+ */
+
+#include "../hidapi-0.7.0/linux/hid-libusb.c"
+#include "ringdev.h"
+#include "bench.h"
+
+#define ROUNDS		200000
+
+static void report(const char *what, size_t len, unsigned long long ns)
+{
+	printf("%-16s %4zu bytes %7.2f ns/report\n", what, len,
+	       (double)ns / ((double)ROUNDS * INPUT_RING_SLOTS));
+}
+
+/* Queue a full ring of reports */
+static void fill(hid_device *dev, unsigned char *r, size_t len)
+{
+	int i;
+
+	for (i = 0; i < INPUT_RING_SLOTS; i++) {
+		r[0] = i;
+		ring_feed(dev, r, len);
+	}
+}
+
+static int run(size_t len)
+{
+	unsigned char r[1024], buf[1024];
+	const unsigned char *p;
+	unsigned long long t0, copy_ns = 0, borrow_ns = 0;
+	hid_device *dev;
+	int i, j;
+
+	dev = ring_device(len);
+	if (!dev) {
+		fprintf(stderr, "ringbench: no memory\n");
+		return -1;
+	}
+	memset(r, 0x5a, sizeof(r));
+
+	for (i = 0; i < ROUNDS; i++) {
+		fill(dev, r, len);
+		t0 = bench_now_ns();
+		for (j = 0; j < INPUT_RING_SLOTS; j++) {
+			hid_read_timeout(dev, buf, len, 0);
+			bench_sink += buf[0] + buf[len - 1];
+		}
+		copy_ns += bench_now_ns() - t0;
+	}
+	report("copy", len, copy_ns);
+
+	for (i = 0; i < ROUNDS; i++) {
+		fill(dev, r, len);
+		t0 = bench_now_ns();
+		for (j = 0; j < INPUT_RING_SLOTS; j++) {
+			hid_read_borrow(dev, &p, 0);
+			bench_sink += p[0] + p[len - 1];
+		}
+		hid_read_release(dev);
+		borrow_ns += bench_now_ns() - t0;
+	}
+	report("borrow", len, borrow_ns);
+
+	free_hid_device(dev);
+	return 0;
+}
+
+int main(void)
+{
+	/* The Corsair devices' reports, and the largest a HID
+	   interrupt endpoint can carry */
+	if (run(64) < 0 || run(1024) < 0)
+		return 1;
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * A hid-libusb device with nothing but its input report ring, fed by
+ * calling read_callback() the way libusb would when an interrupt IN
+ * transfer completes. Include after hid-libusb.c.
+ *
+ * read_callback() resubmits its transfer unless input is stopping, and
+ * there is no endpoint here to submit to, so the device is marked as
+ * stopping from the start. That makes a read of an empty ring return
+ * -1 at once instead of waiting.
+ */
+
+#include <limits.h>
+
+static hid_device *ring_device(size_t report_len)
+{
+	hid_device *dev = new_hid_device();
+
+	if (alloc_input_ring(&dev->input_reports, report_len) < 0) {
+		free_hid_device(dev);
+		return NULL;
+	}
+	dev->input_ep_max_packet_size = report_len;
+	dev->shutdown_thread = 1;
+	dev->active_transfers = INT_MAX;
+	return dev;
+}
+
+static void ring_feed(hid_device *dev, unsigned char *report, int len)
+{
+	struct libusb_transfer transfer;
+
+	memset(&transfer, 0, sizeof(transfer));
+	transfer.status = LIBUSB_TRANSFER_COMPLETED;
+	transfer.buffer = report;
+	transfer.length = len;
+	transfer.actual_length = len;
+	transfer.user_data = dev;
+	read_callback(&transfer);
+}
@@ -0,0 +1,150 @@
+/*
+ * Race the hid-libusb input ring: one thread fills it as fast as it
+ * can while another takes reports out, alternately borrowing and
+ * copying them. A borrowed report must not change until it is
+ * released, a copied one must not be torn, and every report must be
+ * either read or counted as dropped.
+ *
+ * The second run aims at dropping the oldest report: the reader only
+ * takes a report once the ring is full, so every read races
+ * read_callback() dropping that same report to make room.
+ */
+
+#include "../hidapi-0.7.0/linux/hid-libusb.c"
+#include "ringdev.h"
+#include <sched.h>
+
+#define REPORTS		2000000
+#define HOLD		50	/* Spins a borrowed report is held for */
+#define REPORT_LEN	64
+
+static hid_device *dev;
+static volatile int producing;
+
+/* Report seq: its number, then the number's low byte over and over */
+static void make_report(unsigned char *r, unsigned int seq)
+{
+	memset(r, seq & 0xff, REPORT_LEN);
+	memcpy(r, &seq, sizeof(seq));
+}
+
+static int check_report(const unsigned char *r, int len, unsigned int *seq)
+{
+	int i;
+
+	if (len != REPORT_LEN)
+		return -1;
+	memcpy(seq, r, sizeof(*seq));
+	for (i = sizeof(*seq); i < REPORT_LEN; i++) {
+		if (r[i] != (*seq & 0xff))
+			return -1;
+	}
+	return 0;
+}
+
+static void *producer(void *arg)
+{
+	unsigned char r[REPORT_LEN];
+	unsigned int seq;
+
+	for (seq = 0; seq < REPORTS; seq++) {
+		make_report(r, seq);
+		ring_feed(dev, r, REPORT_LEN);
+	}
+	producing = 0;
+	return arg;
+}
+
+static int run(int when_full)
+{
+	unsigned char copy[REPORT_LEN];
+	const unsigned char *p;
+	struct hid_input_stats st;
+	unsigned int seq, last = 0;
+	unsigned long got = 0;
+	int n, i, spin, bad = 0;
+	pthread_t t;
+
+	dev = ring_device(REPORT_LEN);
+	if (!dev) {
+		fprintf(stderr, "ringtest: no memory\n");
+		return 1;
+	}
+	/* The producer's and the readers' fields don't share a cache line */
+	if ((uintptr_t)&dev->input_reports.head % INPUT_RING_ALIGN != 0 ||
+	    (uintptr_t)&dev->input_reports.tail % INPUT_RING_ALIGN != 0 ||
+	    &dev->input_reports.tail - &dev->input_reports.head < INPUT_RING_ALIGN / sizeof(unsigned int)) {
+		fprintf(stderr, "head and tail share a cache line\n");
+		bad++;
+	}
+	producing = 1;
+	pthread_create(&t, NULL, producer, NULL);
+
+	for (i = 0; ; i++) {
+		if (when_full && producing &&
+		    input_ring_count(&dev->input_reports) < INPUT_RING_SLOTS) {
+			sched_yield();
+			continue;
+		}
+		if (i & 1) {
+			n = hid_read_borrow(dev, &p, 0);
+			if (n > 0) {
+				memcpy(copy, p, n);
+				/* Hold on to it while the ring fills up behind */
+				for (spin = 0; spin < HOLD; spin++)
+					__atomic_thread_fence(__ATOMIC_SEQ_CST);
+				if (memcmp(copy, p, n) != 0) {
+					if (bad++ < 10)
+						fprintf(stderr, "borrowed report changed under the reader\n");
+				}
+			}
+			hid_read_release(dev);
+		}
+		else
+			n = hid_read_timeout(dev, copy, sizeof(copy), 0);
+
+		if (n <= 0) {
+			if (!producing && input_ring_count(&dev->input_reports) == 0)
+				break;
+			continue;
+		}
+		if (check_report(copy, n, &seq) < 0) {
+			if (bad++ < 10)
+				fprintf(stderr, "torn report\n");
+			continue;
+		}
+		if (got && seq <= last) {
+			if (bad++ < 10)
+				fprintf(stderr, "report %u after %u\n", seq, last);
+		}
+		last = seq;
+		got++;
+	}
+	pthread_join(t, NULL);
+
+	hid_get_input_stats(dev, &st);
+	if (st.received != REPORTS || got + st.dropped != REPORTS) {
+		fprintf(stderr, "received %lu, read %lu, dropped %lu of %d\n",
+			st.received, got, st.dropped, REPORTS);
+		bad++;
+	}
+	free_hid_device(dev);
+
+	printf("ringtest: %-9s %lu reports read, %lu dropped\n",
+	       when_full ? "when full" : "at once", got, st.dropped);
+	return bad;
+}
+
+int main(void)
+{
+	int bad;
+
+	bad = run(0);
+	bad += run(1);
+	if (bad) {
+		fprintf(stderr, "ringtest: %d failures\n", bad);
+		return 1;
+	}
+	printf("ringtest: ok\n");
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * CorsairSampler_run() against the simulator: the sampling loop fills
+ * the ring, the writer thread drains it to a CSV file and keeps the
+ * statistics it prints at the end.
+ *
+ * Checks that every sweep the statistics count is in the file, in the
+ * order it was taken, that a fixed rate is kept to, that the values
+ * land in their columns, and that sweeps missing replies are written
+ * with their status and counted as failed rather than averaged in.
+ * With the file behind a FIFO nobody reads for a while, the ring fills:
+ * the sweeps that do not fit are counted as dropped, the loop does not
+ * wait for the writer, and what was queued still comes out in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "hidapi.h"
+#include "CorsairFanInfo.h"
+#include "CorsairLink.h"
+#include "CorsairTransport.h"
+#include "CorsairSampler.h"
+#include "CorsairSim.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+/* What the sampler wrote and printed */
+struct result {
+	int		rows;
+	int		failed_rows;
+	int		misplaced;	/* Good rows with a value out of its column's range */
+	int		out_of_order;
+	int		sweeps;		/* From "Sweeps: N ..." */
+	int		failed;
+	int		dropped;
+};
+
+static void read_csv(const char *path, struct result *r)
+{
+	char line[256];
+	unsigned long long t, last = 0;
+	double temp;
+	int status, rpm[NUMFANS];
+	FILE *f = fopen(path, "r");
+
+	CHECK(f != NULL);
+	if (!f)
+		return;
+	CHECK(fgets(line, sizeof(line), f) &&
+	      !strcmp(line, "t_us,status,temp1,fan1_rpm,fan2_rpm,fan3_rpm,fan4_rpm,fan5_rpm\n"));
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%llu,%d,%lf,%d,%d,%d,%d,%d", &t, &status, &temp,
+			   &rpm[0], &rpm[1], &rpm[2], &rpm[3], &rpm[4]) != 8) {
+			r->misplaced++;
+			continue;
+		}
+		if (r->rows > 0 && t < last)
+			r->out_of_order++;
+		last = t;
+		r->rows++;
+		if (status) {
+			r->failed_rows++;
+			continue;
+		}
+		/* The simulated H80i: two fans near 700, two absent, the pump near 980 */
+		if (temp < 15.0 || temp > 45.0 ||
+		    rpm[0] < 600 || rpm[0] > 800 || rpm[1] < 600 || rpm[1] > 800 ||
+		    rpm[2] != 0 || rpm[3] != 0 || rpm[4] < 850 || rpm[4] > 1100)
+			r->misplaced++;
+	}
+	fclose(f);
+}
+
+static void read_stats(const char *path, struct result *r)
+{
+	char line[256];
+	FILE *f = fopen(path, "r");
+
+	CHECK(f != NULL);
+	if (!f)
+		return;
+	r->sweeps = -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Sweeps:", 7))
+			sscanf(line, "Sweeps: %d in %*f s (%*f Hz) failed: %d dropped: %d",
+			       &r->sweeps, &r->failed, &r->dropped);
+	}
+	fclose(f);
+}
+
+/* The far end of the FIFO: nothing read for stall_ms, then copied to a file */
+struct slow_reader {
+	const char	*fifo;
+	int		out;
+	int		stall_ms;
+};
+
+static void *slow_read(void *arg)
+{
+	struct slow_reader *sr = arg;
+	char buf[4096];
+	ssize_t len;
+	int in = open(sr->fifo, O_RDONLY);
+
+	if (in < 0)
+		return NULL;
+	usleep(sr->stall_ms * 1000);
+	while ((len = read(in, buf, sizeof(buf))) > 0) {
+		if (write(sr->out, buf, len) != len)
+			break;
+	}
+	close(in);
+	return NULL;
+}
+
+static void run(const char *faults, int seconds, int rate, int stall_ms, struct result *r)
+{
+	char csv[] = "/tmp/samplertest.csv.XXXXXX";
+	char stats[] = "/tmp/samplertest.out.XXXXXX";
+	char fifo[sizeof(csv) + 5];
+	struct slow_reader sr;
+	pthread_t reader;
+	CorsairLink_t cl;
+	int csv_fd, stats_fd, saved, res;
+
+	memset(r, 0, sizeof(*r));
+	CorsairSim_configure("h80i=1,clink=0,latency=200,jitter=0,drop=0,reorder=0,dup=0");
+	memset(&cl, 0, sizeof(cl));
+	cl.transport = &CorsairSimTransport;
+	strcpy(cl.path, "sim:h80i:0");
+	cl.max_ms_read_wait = 20;
+	if (!CorsairLink_init(&cl, H80I)) {
+		fprintf(stderr, "unable to open the simulated H80i\n");
+		failures++;
+		return;
+	}
+	CorsairSim_configure(faults);
+
+	csv_fd = mkstemp(csv);
+	stats_fd = mkstemp(stats);
+	if (csv_fd < 0 || stats_fd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	if (stall_ms) {
+		snprintf(fifo, sizeof(fifo), "%s.fifo", csv);
+		if (mkfifo(fifo, 0600) < 0) {
+			perror("mkfifo");
+			exit(1);
+		}
+		sr.fifo = fifo;
+		sr.out = csv_fd;
+		sr.stall_ms = stall_ms;
+		pthread_create(&reader, NULL, slow_read, &sr);
+	}
+
+	/* The statistics go to stdout, and failed sweeps complain on stderr */
+	fflush(stdout);
+	fflush(stderr);
+	saved = dup(1);
+	dup2(stats_fd, 1);
+	dup2(stats_fd, 2);
+	res = CorsairSampler_run(&cl, H80I, seconds, rate, stall_ms ? fifo : csv);
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved, 1);
+	dup2(saved, 2);
+	close(saved);
+	Close(&cl);
+	CHECK(res == 0);
+	if (stall_ms) {
+		pthread_join(reader, NULL);
+		unlink(fifo);
+	}
+
+	read_csv(csv, r);
+	read_stats(stats, r);
+	close(csv_fd);
+	close(stats_fd);
+	unlink(csv);
+	unlink(stats);
+}
+
+int main(void)
+{
+	struct result r;
+
+	/* A fixed rate: about rate * seconds sweeps, all good, all written */
+	run("latency=200", 1, 100, 0, &r);
+	printf("samplertest: 100 Hz: %d sweeps, %d failed, %d dropped\n", r.sweeps, r.failed, r.dropped);
+	CHECK(r.rows >= 80 && r.rows <= 101);
+	CHECK(r.sweeps == r.rows);
+	CHECK(r.failed == 0 && r.failed_rows == 0 && r.dropped == 0);
+	CHECK(r.misplaced == 0 && r.out_of_order == 0);
+
+	/* As fast as it answers: however many there are, the file has them all */
+	run("latency=0", 1, 0, 0, &r);
+	printf("samplertest: flat out: %d sweeps, %d failed, %d dropped\n", r.sweeps, r.failed, r.dropped);
+	CHECK(r.rows > 100);
+	CHECK(r.sweeps == r.rows);
+	CHECK(r.failed == 0 && r.dropped == 0);
+	CHECK(r.misplaced == 0 && r.out_of_order == 0);
+
+	/* Lost replies: those sweeps are written with their status and
+	   counted as failed, and the good ones still read right */
+	run("latency=200,drop=10", 1, 100, 0, &r);
+	printf("samplertest: drops: %d sweeps, %d failed, %d dropped\n", r.sweeps, r.failed, r.dropped);
+	CHECK(r.sweeps == r.rows);
+	CHECK(r.failed > 0 && r.failed == r.failed_rows);
+	CHECK(r.failed < r.rows);
+	CHECK(r.misplaced == 0 && r.out_of_order == 0);
+
+	/* A writer stuck for half the run: the ring fills and the rest
+	   are dropped, but sampling goes on and nothing queued is lost */
+	run("latency=0", 1, 0, 500, &r);
+	printf("samplertest: stalled: %d sweeps, %d failed, %d dropped\n", r.sweeps, r.failed, r.dropped);
+	CHECK(r.dropped > 0);
+	CHECK(r.sweeps == r.rows);
+	CHECK(r.rows >= CL_SAMPLE_RING);
+	CHECK(r.failed == 0);
+	CHECK(r.misplaced == 0 && r.out_of_order == 0);
+
+	if (failures) {
+		fprintf(stderr, "samplertest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("samplertest: ok\n");
+	return 0;
+}
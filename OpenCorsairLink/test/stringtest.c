@@ -0,0 +1,129 @@
+/*
+ * The string descriptors of hid-libusb.c on the fake bus in fakeusb.c,
+ * whose Commander has "Corsair", "Commander" and "FAKE0001" at indexes
+ * 1 to 3.
+ *
+ * Checks that each device reads its strings once, when it is opened,
+ * and answers from its own copies after that, even once another handle
+ * on the same device has been closed; and that the converter shared by
+ * every device starts each string afresh, which is what keeps the first
+ * character of all but the first, and comes back working after
+ * hid_exit() has closed it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "hidapi.h"
+#include "fakeusb.h"
+
+#define STRING_MAX	64
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+/* All three strings of dev are the Commander's */
+static int strings_right(hid_device *dev)
+{
+	wchar_t str[STRING_MAX];
+
+	if (hid_get_manufacturer_string(dev, str, STRING_MAX) < 0 || wcscmp(str, L"Corsair"))
+		return 0;
+	if (hid_get_product_string(dev, str, STRING_MAX) < 0 || wcscmp(str, L"Commander"))
+		return 0;
+	if (hid_get_serial_number_string(dev, str, STRING_MAX) < 0 || wcscmp(str, L"FAKE0001"))
+		return 0;
+	return 1;
+}
+
+static void test_cache(void)
+{
+	wchar_t str[STRING_MAX];
+	unsigned long reads;
+	hid_device *a, *b;
+
+	a = hid_open(0x1b1c, 0x0c02, NULL);
+	CHECK(a != NULL);
+	if (!a)
+		return;
+
+	/* Opening read them, asking again goes nowhere */
+	reads = fakeusb.string_reads;
+	CHECK(strings_right(a));
+	CHECK(strings_right(a));
+	CHECK(hid_get_indexed_string(a, 2, str, STRING_MAX) == 0 && !wcscmp(str, L"Commander"));
+	CHECK(fakeusb.string_reads == reads);
+
+	/* Cut to fit, from the cached copy */
+	CHECK(hid_get_product_string(a, str, 4) == 0 && !wcscmp(str, L"Com"));
+	CHECK(fakeusb.string_reads == reads);
+
+	/* An index the device has no string for is an error */
+	CHECK(hid_get_indexed_string(a, 9, str, STRING_MAX) < 0);
+
+	/* A second handle reads its own, and keeps them when the first goes */
+	reads = fakeusb.string_reads;
+	b = hid_open(0x1b1c, 0x0c02, NULL);
+	CHECK(b != NULL);
+	if (!b) {
+		hid_close(a);
+		return;
+	}
+	CHECK(fakeusb.string_reads > reads);
+	hid_close(a);
+	reads = fakeusb.string_reads;
+	CHECK(strings_right(b));
+	CHECK(fakeusb.string_reads == reads);
+	hid_close(b);
+}
+
+static void test_exit(void)
+{
+	struct hid_device_info *devs;
+	hid_device *dev;
+	int round;
+
+	/* hid_exit() closes the converter, the next use opens it again */
+	for (round = 0; round < 3; round++) {
+		CHECK(hid_init() == 0);
+		dev = hid_open(0x1b1c, 0x0c02, NULL);
+		CHECK(dev != NULL);
+		if (dev) {
+			CHECK(strings_right(dev));
+			hid_close(dev);
+		}
+		devs = hid_enumerate(0x1b1c, 0x0c02);
+		CHECK(devs != NULL);
+		if (devs) {
+			CHECK(devs->manufacturer_string && !wcscmp(devs->manufacturer_string, L"Corsair"));
+			CHECK(devs->product_string && !wcscmp(devs->product_string, L"Commander"));
+			CHECK(devs->serial_number && !wcscmp(devs->serial_number, L"FAKE0001"));
+		}
+		hid_free_enumeration(devs);
+		CHECK(hid_exit() == 0);
+	}
+}
+
+int main(void)
+{
+	if (hid_init() < 0)
+		return 1;
+	test_cache();
+	hid_exit();
+
+	test_exit();
+
+	if (failures) {
+		fprintf(stderr, "stringtest: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("stringtest: ok\n");
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Cost of corsairlink_temp_milli() against the per-bit fraction sum
+ * the tool and the drivers used before it.
+ */
+
+#include <stdio.h>
+#include "corsairlink_temp.h"
+#include "bench.h"
+
+#define ROUNDS		1000
+
+/* The old conversion, kept here only to compare against */
+static unsigned int temp_milli_bits(unsigned short temp)
+{
+	unsigned char	frtemp = temp & 0xff;
+	unsigned int	trans = 0;
+
+	if (frtemp & 0x80)
+		trans += 500;
+	if (frtemp & 0x40)
+		trans += 250;
+	if (frtemp & 0x20)
+		trans += 125;
+	if (frtemp & 0x10)
+		trans += 62;
+	if (frtemp & 0x08)
+		trans += 31;
+	if (frtemp & 0x04)
+		trans += 16;
+	if (frtemp & 0x02)
+		trans += 8;
+	if (frtemp & 0x01)
+		trans += 4;
+	return ((temp >> 8) & 0xff) * 1000 + trans;
+}
+
+static void report(const char *what, unsigned long long ns)
+{
+	printf("%-28s %7.2f ns/reading\n", what, (double)ns / (ROUNDS * 65536.0));
+}
+
+int main(void)
+{
+	unsigned long long t0;
+	unsigned int raw;
+	volatile unsigned int step = 1;
+	int i;
+
+	t0 = bench_now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		for (raw = 0; raw <= 0xffff; raw += step)
+			bench_sink += corsairlink_temp_milli(raw);
+	report("corsairlink_temp_milli", bench_now_ns() - t0);
+
+	t0 = bench_now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		for (raw = 0; raw <= 0xffff; raw += step)
+			bench_sink += temp_milli_bits(raw);
+	report("per-bit fraction sum", bench_now_ns() - t0);
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Check corsairlink_temp_milli() against raw / 256 degrees worked out
+ * in floating point and rounded to the nearest millidegree, for every
+ * raw reading, and against values worked out by hand.
+ */
+
+#include <stdio.h>
+#include "corsairlink_temp.h"
+
+int main(void)
+{
+	static const struct {
+		unsigned int	raw;
+		unsigned int	milli;
+	} known[] = {
+		{ 0x0000, 0 },
+		{ 0x0001, 4 },		/* 3.906 */
+		{ 0x0002, 8 },		/* 7.8125 */
+		{ 0x0008, 31 },		/* 31.25 */
+		{ 0x0010, 63 },		/* 62.5, halves round up */
+		{ 0x0030, 188 },	/* 187.5 */
+		{ 0x0080, 500 },
+		{ 0x00ff, 996 },	/* 996.09, the largest fraction */
+		{ 0x0100, 1000 },
+		{ 0x1900, 25000 },
+		{ 0x19ff, 25996 },	/* 25996.09 */
+		{ 0x7fff, 127996 },	/* 127996.09, not negative */
+		{ 0x8000, 128000 },
+		{ 0xff00, 255000 },
+		{ 0xffff, 255996 },	/* raw * 1000 at its largest */
+		{ 0x11900, 25000 },	/* Only the low 16 bits are the reading */
+	};
+	unsigned int raw, want, got;
+	int i, bad = 0;
+
+	for (raw = 0; raw <= 0xffff; raw++) {
+		/* Exact in a double: at most 26 bits, divided by a power of two */
+		want = (unsigned int)(raw * 1000.0 / 256.0 + 0.5);
+		got = corsairlink_temp_milli(raw);
+		if (got != want || corsairlink_temp_milli2(raw >> 8, raw & 0xff) != want) {
+			if (bad++ < 10)
+				fprintf(stderr, "temp 0x%04x: got %u, want %u\n", raw, got, want);
+		}
+	}
+	for (i = 0; i < (int)(sizeof(known) / sizeof(known[0])); i++) {
+		got = corsairlink_temp_milli(known[i].raw);
+		if (got != known[i].milli) {
+			fprintf(stderr, "temp 0x%04x: got %u, want %u\n", known[i].raw, got, known[i].milli);
+			bad++;
+		}
+	}
+	if (corsairlink_temp_milli2(0x19, 0x80) != 25500) {
+		fprintf(stderr, "temp 19/80: got %u, want 25500\n", corsairlink_temp_milli2(0x19, 0x80));
+		bad++;
+	}
+	if (bad) {
+		fprintf(stderr, "temptest: %d failures\n", bad);
+		return 1;
+	}
+	printf("temptest: all 65536 readings ok\n");
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Requests sent with hid_write() against hid_write_async(), through
+ * hid-libusb.c and the fake bus in fakeusb.c, whose device answers
+ * each request by echoing it from the next frame.
+ *
+ * Requests are kept WINDOW at a time in flight, the way CorsairPipe.c
+ * does: send until the window is full, then read a reply and send the
+ * next. For each request this times from starting its write to reading
+ * its reply, and how long the caller was stuck inside the write call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "hidapi.h"
+#include "fakeusb.h"
+#include "bench.h"
+
+#define REQUESTS	400
+#define REPORT		64
+
+struct request {
+	unsigned long long	start_us;
+	int			token;
+};
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int run(hid_device *dev, int window, int async)
+{
+	static struct request reqs[REQUESTS];
+	static unsigned long long latency[REQUESTS];
+	unsigned char out[REPORT + 1], in[REPORT];
+	unsigned long long t0, t, blocked = 0;
+	int sent = 0, done = 0, res;
+
+	t0 = bench_now_ns();
+	while (done < REQUESTS) {
+		while (sent < REQUESTS && sent - done < window) {
+			memset(out, 0, sizeof(out));
+			out[1] = 0x81 + (sent & 0x3f);
+			out[2] = sent;
+			reqs[sent].start_us = fakeusb_now_us();
+			t = bench_now_ns();
+			if (async) {
+				reqs[sent].token = hid_write_async(dev, out, sizeof(out), 1000);
+				res = reqs[sent].token;
+			}
+			else
+				res = hid_write(dev, out, sizeof(out));
+			blocked += bench_now_ns() - t;
+			if (res <= 0) {
+				fprintf(stderr, "write %d failed\n", sent);
+				return -1;
+			}
+			sent++;
+		}
+
+		res = hid_read_timeout(dev, in, sizeof(in), 1000);
+		if (res <= 0 || in[0] != 0x81 + (done & 0x3f) || in[1] != (unsigned char)done) {
+			fprintf(stderr, "reply %d missing or out of order\n", done);
+			return -1;
+		}
+		latency[done] = fakeusb_now_us() - reqs[done].start_us;
+		if (async && hid_write_wait(dev, reqs[done].token, -1) != REPORT + 1) {
+			fprintf(stderr, "write %d not collected\n", done);
+			return -1;
+		}
+		done++;
+	}
+	t = bench_now_ns() - t0;
+
+	qsort(latency, REQUESTS, sizeof(latency[0]), cmp_ull);
+	printf("%-6s window %d  %7.0f req/s  latency p50 %5llu us p99 %5llu us  in write %6.1f us/req\n",
+	       async? "async": "sync", window, REQUESTS * 1e9 / t,
+	       latency[REQUESTS / 2], latency[REQUESTS * 99 / 100],
+	       (double)blocked / 1000 / REQUESTS);
+	return 0;
+}
+
+int main(void)
+{
+	static const int windows[] = { 1, 4, 8 };
+	hid_device *dev;
+	unsigned int i;
+
+	fakeusb.host_us = 50;
+	if (hid_init() < 0)
+		return 1;
+	dev = hid_open(0x1b1c, 0x0c02, NULL);
+	if (!dev) {
+		fprintf(stderr, "no device on the fake bus\n");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+		if (run(dev, windows[i], 0) < 0 || run(dev, windows[i], 1) < 0)
+			return 1;
+	}
+
+	hid_close(dev);
+	hid_exit();
+	return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * CorsairLink kernel core, shared by the h80i and clink drivers.
+ *
+ * Copyright (C) 2014 Barry Harding (barryha@earthlink.net)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ */
+
+/*
+ * The core does everything that does not depend on which CorsairLink
+ * device is on the other end: finding out what the device is, getting
+ * requests to it and replies back, keeping the readings cached and
+ * registering with hwmon. A device driver supplies two tables, how its
+ * requests travel (a CorsairTransport, the core has both kinds) and
+ * where its registers are (a CorsairProtocol), then hands its probe and
+ * disconnect to corsairlink_probe() and corsairlink_disconnect().
+ */
+
+#ifndef CORSAIRLINK_H
+#define CORSAIRLINK_H
+
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/usb.h>
+
+/***************************************************************/
+/* Definitions of Corsair LINK interface                       */
+/***************************************************************/
+
+/*
+ * Valid Corsair LINK commands, common to both interface versions
+ */
+enum _CorsairLinkOpCodes{
+	/*
+	 * 06 AA BB - Write BB into one-byte register AA
+	 * */
+	WriteOneByte = 0x06,
+	/*
+	 * 07 AA - Read from one-byte register AA
+	 * */
+	ReadOneByte = 0x07,
+	/*
+	 * 08 AA BB CC - Write BB CC into two-byte register AA
+	 * */
+	WriteTwoBytes = 0x08,
+	/*
+	 * 09 AA - Read from two-byte register AA
+	 * */
+	ReadTwoBytes = 0x09,
+
+	/* Note that following two do not seem to be supported on "cooling node" */
+	/*
+	 * 0A AA 03 00 11 22 - Write 3-byte sequence (00 11 22) into 3-byte register AA
+	 * */
+	WriteThreeBytes = 0x0A,
+	/*
+	 * 0B AA 03 - Read from 3-byte register AA
+	 * */
+	ReadThreeBytes = 0x0B
+};
+
+/* Fan mode bits with the same meaning in both register layouts */
+#define FAN_PRSNT		0x80 /* Fan detected */
+#define FAN_TACH		0x01 /* Fan is 4 pin and has a tach */
+
+
+/***************************************************************/
+/* Definitions of/for driver state/mode                        */
+/***************************************************************/
+
+#define NUMFANS			6 /* Number of "fans" the device/driver supports */
+
+#define FAN0			0
+#define FAN1			1
+#define FAN2			2
+#define FAN3			3
+#define FAN4			4
+#define PUMP			FAN4 /* This fan is really the pump on h80i/h100i */
+#define FAN5			5    /* Only on a "Cooling Node" and not pumps */
+
+#define NUMTEMPS		4    /* Only on a "cooling node", pumps have one */
+
+/*
+ * Per Fan/pump state.
+ */
+struct CorsairFanInfo {
+                char		Name[25]; /* Driver derived */
+                unsigned int	RPM;	  /* derived from device */
+		unsigned int	maxRPM;	  /* Max RPM since powerup */
+                unsigned int	Mode;	  /* derived from device */
+		int		present;  /* Seen at probe time */
+#define FANPRESENT(__mode) (__mode & 0x80)
+};
+typedef struct CorsairFanInfo CorsairFanInfo_t;
+
+/*
+ * Per temp state.
+ */
+struct CorsairTempInfo {
+                char		Name[25]; /* Driver derived */
+                unsigned char	wholDeg;  /* derived from device */
+                unsigned char	partDeg;  /* derived from device */
+		int		present;  /* Seen at probe time */
+};
+typedef struct CorsairTempInfo CorsairTempInfo_t;
+
+/*
+ * There are two versions of CorsairLink interface that are currently
+ * known about. The one for the older h80/h100 and the one for the
+ * newer h80i/h100i. Unfortanatly there is no self identifying version
+ * field of any sort. Also the two interfaces are different enough
+ * and NOT backward compatable. So we need to do this funny busness
+ * so we can support both of these interfaces.
+ */
+#define DEVINTF_NONE		0 /* Not supported type */
+#define DEVINTF_TYP1		1 /* Older h80/h100 type */
+#define DEVINTF_TYP2		2 /* Newer h80i/h100i type */
+
+struct deviceID_spec {
+	unsigned char		id; /* Device ID as read from the "DeviceIP reg */
+	int			supported; /* Does this driver support it */
+	int			intfType;  /* Type of interface it uses */
+	int			maxtempcnt; /* Max temp sensors device supports */
+	int			maxfancnt;  /* Max fans device supports */
+	int			maxpumpcnt; /* Number of pump device has */
+	char			*name;	    /* Device name */
+};
+typedef struct deviceID_spec devID_t;
+
+/*
+ * One register operation. Reads put what they read in *result.
+ */
+struct CorsairOp {
+	unsigned char	opcode;		/* WriteOneByte, WriteTwoBytes, ReadOneByte, ReadTwoBytes */
+	unsigned char	reg;		/* Register address */
+	unsigned short	data;		/* Value to write */
+	unsigned int	*result;	/* Where a read's value goes, or NULL */
+};
+typedef struct CorsairOp CorsairOp_t;
+
+struct CorsairLink;
+struct CorsairCmd;
+
+/*
+ * How requests get to the device. Replies always come back on the
+ * interrupt in endpoint. A request is a run of operations:
+ *	id, opcode, register[, data lo[, data hi]]
+ * and its reply answers them in order:
+ *	id, opcode[, data lo[, data hi]]
+ */
+struct CorsairTransport {
+	const char	*name;
+	int		maxdata;	/* Operation bytes in one request or reply */
+	int		maxops;		/* Operations in one request */
+	int		window;		/* Requests in flight at once, 0 for cmd_window */
+	int		irq_out;	/* Requests go out the interrupt out endpoint */
+	/* Send len bytes of operations in req as cmd's request */
+	int		(*send)(struct CorsairLink *, struct CorsairCmd *,
+				const unsigned char *req, int len);
+};
+
+/* HID SET_REPORT on the control pipe, h80i/h100i */
+extern const struct CorsairTransport corsairlink_ctrl_transport;
+/* Interrupt out endpoint, Commander */
+extern const struct CorsairTransport corsairlink_intr_transport;
+
+/*
+ * Where an interface type keeps its readings. With a select register
+ * the per channel registers are the same for every channel and the
+ * channel is picked by writing its number to the select register
+ * first. Without one (select of 0) each channel has its own registers.
+ */
+struct CorsairProtocol {
+	int		intfType;		/* DEVINTF_TYP1 or DEVINTF_TYP2 */
+	unsigned char	fan_select;		/* Fan select register, or 0 */
+	unsigned char	temp_select;		/* Temp sensor select register, or 0 */
+	unsigned char	mode_op;		/* How to read a fan mode */
+	unsigned char	fan_mode[NUMFANS];
+	unsigned char	fan_rpm[NUMFANS];
+	unsigned char	fan_max[NUMFANS];
+	unsigned char	temp_read[NUMTEMPS];
+	/* Decide from what probe read whether a channel is there */
+	int		(*fan_present)(const CorsairFanInfo_t *);
+	int		(*temp_present)(const CorsairTempInfo_t *);
+};
+
+/*
+ * A request in flight. Each has its own request buffer and, for the
+ * interrupt out transport, its own URB. It is matched to its reply by
+ * the command ID of its first operation.
+ */
+#define CL_MAXCMDS		8 /* Most requests in flight at once */
+#define CL_PKT_DATA		16 /* Most operation bytes any transport takes */
+#define CL_MAXOPS		(CL_PKT_DATA / 3)
+#define CL_BUFSIZE		64 /* Size of the buffers the device DMAs */
+
+struct CorsairCmd {
+	struct CorsairLink	*cl;		/* Device this goes to */
+	struct urb		*urb;		/* URB to control interrupt out pipe */
+	unsigned char		*out;		/* USB/device outgoing cmd request, CL_BUFSIZE */
+	unsigned char		id;		/* Command ID (message #), 0 if slot free */
+	unsigned char		ids[CL_MAXOPS];	/* ID of each operation */
+	int			status;		/* -EINPROGRESS until the reply is in data */
+	unsigned char		data[16];	/* irq copy of the reply */
+	struct completion	done;		/* Reply (or failure) arrived */
+};
+
+struct CorsairLink {
+	struct usb_device	*udev;		/* Linux USB device handle */
+	struct usb_interface	*interface;	/* Interface we are bound to */
+	struct device		*hwmon_dev;	/* sysfs hwmon support */
+	const struct CorsairTransport *transport; /* How requests get there */
+	const struct CorsairProtocol *proto;	/* Where the registers are */
+	/* Interrupt support */
+	struct urb		*irq_in;    	/* URB to control interrupt in pipe */
+	/*
+	 * Note the following buffer gets dma'd into by devices.
+	 * So we must minimize access to it to the interrupt routine
+	 * Any other accesses may be unsafe. So we make a copy during
+	 * the interrupt routine (to the command's data) and then only
+	 * use that at other times. It and each command's out buffer
+	 * are allocated on their own, so no field the interrupt
+	 * routine writes shares a cache line with them.
+	 */
+	unsigned char		*irq_buf; 	/* USB/device uses to save recv'd data, CL_BUFSIZE */
+	struct CorsairCmd	cmds[CL_MAXCMDS]; /* Requests in flight */
+	int			window;		/* How many of cmds[] may be used */
+	spinlock_t		cmd_lock;	/* Protects cmds[] state and CommandId */
+	wait_queue_head_t	irq_wait;     	/* Waiting for a free cmds[] slot */
+	unsigned int		CommandId; 	/* Current message number */
+	int			rw_ms_timeo;	/* Timeout amount in MS */
+	/* CorsairLink Device state */
+	devID_t			*devid; 	/* What the device is */
+	unsigned int		FirmwareID;
+	CorsairFanInfo_t	fans[NUMFANS]; 	/* Fans and pump current state */
+	CorsairTempInfo_t	temps[NUMTEMPS];/* Temp current state */
+	/* Reading cache, fans[] RPM/maxRPM and temps[] degrees */
+	struct mutex		sweep_lock;	/* One sweep of the device at a time */
+	spinlock_t		cache_lock;	/* Protects the readings and the two below */
+	int			cache_valid;	/* A sweep has worked */
+	unsigned long		cache_time;	/* jiffies of the last good sweep */
+	unsigned int		update_interval; /* MS between background sweeps, 0 for none */
+	struct delayed_work	poll_work;	/* Background sweep */
+};
+typedef struct CorsairLink CorsairLink_t;
+
+int corsairlink_probe(struct usb_interface *interface,
+		      const struct CorsairTransport *transport,
+		      const struct CorsairProtocol *proto);
+void corsairlink_disconnect(struct usb_interface *interface);
+
+#endif /* CORSAIRLINK_H */
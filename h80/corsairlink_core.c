@@ -0,0 +1,1276 @@
+/*
+ * USB CorsairLink core
+ *
+ * Copyright (C) 2014 Barry Harding (barryha@earthlink.net)
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ *
+ */
+
+/*
+ * This is the part of the CorsairLink hwmon support that the h80i
+ * (H80i/H100i) and clink (Commander) drivers share. See corsairlink.h
+ * for how a driver plugs into it.
+ *
+ * Requests are sent through the driver's transport and their replies
+ * picked off the interrupt in endpoint, which is kept polled from probe
+ * to disconnect. Each request in flight has a slot in cl->cmds[] and
+ * the reply is matched to it by command ID, so up to cl->window of
+ * them can be outstanding.
+ *
+ * Register operations are put together in a batch, which packs them
+ * into as few requests as the transport takes and keeps as many of
+ * those in flight as the window allows. Readings come from a cache
+ * that a delayed work item refreshes with one such batch.
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/usb.h>
+#include <linux/hwmon.h>
+#include <linux/hwmon-sysfs.h>
+#include <linux/hid.h>
+
+#include "corsairlink.h"
+#include "corsairlink_temp.h"
+
+#define DRIVER_AUTHOR "Barry Harding, barryha@earthlink.net"
+#define DRIVER_DESC "USB CorsairLink core"
+
+/*
+ * Readings are kept in a cache that a background sweep refreshes, so
+ * several sensor programs reading at once cost one set of USB
+ * transactions between them instead of one each.
+ */
+static unsigned int poll_interval = 1000;
+module_param(poll_interval, uint, S_IRUGO);
+MODULE_PARM_DESC(poll_interval,
+		 "ms between background refreshes, 0 to only refresh when read (default 1000)");
+
+static unsigned int max_age = 2000;
+module_param(max_age, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(max_age,
+		 "Oldest reading in ms handed out before a read forces a refresh (default 2000)");
+
+/*
+ * Devices without select registers take requests that do not depend
+ * on each other, so several can be in flight at once.
+ */
+static unsigned int cmd_window = 4;
+module_param(cmd_window, uint, S_IRUGO);
+MODULE_PARM_DESC(cmd_window, "Requests kept in flight at once, 1-8 (default 4)");
+
+/*
+ * Registers every CorsairLink device has at the same place
+ */
+enum CorsairLinkCmdsCommon {
+	/*
+	 * R - 1 byte
+	 * Which device it is, see CorsairID[]
+	 */
+	DeviceID = 0x00,
+	/*
+	 * R - 2 bytes
+	 * Firmware Version in BCD (for example 1.0.5 is 0x1005, or 0x05, 0x10 in little
+	 * endianess)
+	 */
+	FirmwareID = 0x01
+};
+
+/*
+ * Now the hit list of what we are supporting and how. The h80 and
+ * h100 use the V1 register layout too, but nobody has tried them,
+ * and their pump does not sit at the PUMP channel the scan expects,
+ * so they stay off until someone with one can map it.
+ */
+static struct deviceID_spec CorsairID[] = {
+	/*  D  s  i             t  f  p   n   */
+	/*  e  u  n             e  a  u   a   */
+	/*  v  p  t             m  n  m   m   */
+	/*  I  R  f             p     p   e   */
+	/*  D  D                              */
+	{0x37, 0, DEVINTF_TYP1, 1, 2, 1, "h80"},
+	{0x38, 1, DEVINTF_TYP1, 4, 5, 0, "clink"},
+	{0x39, 0, DEVINTF_TYP1, 0, 0, 0, "lightNode"},
+	{0x3a, 0, DEVINTF_TYP1, 1, 4, 1, "h100"},
+	{0x3b, 1, DEVINTF_TYP2, 1, 4, 1, "h80i"},
+	{0x3c, 1, DEVINTF_TYP2, 1, 4, 1, "h100i"},
+	{0x3d, 0, DEVINTF_TYP2, 4, 6, 0, "extNode"},
+	{0x00, 0, DEVINTF_NONE, 0, 0, 0, "unknown"}
+};
+
+
+/***************************************************************/
+/* Transports                                                  */
+/***************************************************************/
+
+/*
+ * h80i/h100i: the request goes as a HID SET_REPORT on the control
+ * pipe, behind a length byte, in an 11 or 17 byte report.
+ */
+static int corsairlink_ctrl_send(CorsairLink_t *cl, struct CorsairCmd *cmd,
+				 const unsigned char *req, int len)
+{
+	int size = len < 11 ? 11 : 17;
+	int retval;
+
+	memset(cmd->out, 0, CL_BUFSIZE);
+	cmd->out[0] = len;		/* length */
+	memcpy(&cmd->out[1], req, len);
+	retval = usb_control_msg(cl->udev, 		     /* dev */
+				 usb_sndctrlpipe(cl->udev, 0), /* pipe */
+				 HID_REQ_SET_REPORT, 	     /* 0x09 - request */
+				 USB_TYPE_CLASS|USB_RECIP_INTERFACE|USB_DIR_OUT,
+				                             /* 0x21 - requesttype */
+				 0x200|cmd->out[0], 	     /* value */
+				 0,     		     /* index */
+				 cmd->out,  		     /* payload data */
+				 size,    		     /* payload size */
+				 cl->rw_ms_timeo); 	     /* timeout */
+	if (retval != size) {
+		dev_err(&cl->interface->dev, "send: Failed to send cmd %d 0x%x\n",
+			retval, retval);
+		return -EIO;
+	}
+	return 0;
+}
+
+const struct CorsairTransport corsairlink_ctrl_transport = {
+	.name		= "control",
+	.maxdata	= CL_PKT_DATA,
+	.maxops		= CL_MAXOPS,
+	.window		= 1,	/* Select registers, one request at a time */
+	.send		= corsairlink_ctrl_send,
+};
+EXPORT_SYMBOL_GPL(corsairlink_ctrl_transport);
+
+/*
+ * Commander: the request goes out the interrupt out endpoint in the
+ * command's own URB, one operation at a time.
+ */
+static int corsairlink_intr_send(CorsairLink_t *cl, struct CorsairCmd *cmd,
+				 const unsigned char *req, int len)
+{
+	int retval;
+
+	memset(cmd->out, 0, CL_BUFSIZE);
+	memcpy(cmd->out, req, len);
+	/* Note the below operation will actually send the request to the device */
+	retval = usb_submit_urb(cmd->urb, GFP_KERNEL);
+	if (retval) {
+		dev_err(&cl->interface->dev, "send: Failed to submit cmd %d\n", retval);
+		return -EIO;
+	}
+	return 0;
+}
+
+const struct CorsairTransport corsairlink_intr_transport = {
+	.name		= "interrupt",
+	.maxdata	= CL_PKT_DATA,
+	.maxops		= 1,
+	.window		= 0,	/* cmd_window */
+	.irq_out	= 1,
+	.send		= corsairlink_intr_send,
+};
+EXPORT_SYMBOL_GPL(corsairlink_intr_transport);
+
+
+/***************************************************************/
+/* Requests and replies                                        */
+/***************************************************************/
+
+/* Data bytes an operation carries in the request */
+static int corsairlink_op_wlen(unsigned char opcode)
+{
+	return opcode == WriteOneByte ? 1 : opcode == WriteTwoBytes ? 2 : 0;
+}
+
+/* Data bytes an operation gets back in the reply */
+static int corsairlink_op_rlen(unsigned char opcode)
+{
+	return opcode == ReadOneByte ? 1 : opcode == ReadTwoBytes ? 2 : 0;
+}
+
+/*
+ * Claim a free request slot and give its nops operations the next
+ * command IDs. Returns NULL if the window is full.
+ */
+static struct CorsairCmd *corsairlink_cmd_get(CorsairLink_t *cl, int nops)
+{
+	struct CorsairCmd *cmd = NULL;
+	unsigned long flags;
+	int indx;
+
+	spin_lock_irqsave(&cl->cmd_lock, flags);
+	for (indx = 0; indx < cl->window; indx++) {
+		if (cl->cmds[indx].id == 0) {
+			cmd = &cl->cmds[indx];
+			break;
+		}
+	}
+	if (cmd) {
+		for (indx = 0; indx < nops; indx++) {
+			/*
+			 * So next message is not badly formed, this can not be 0.
+			 * But also just in case of an error, we pick a range that will
+			 * not look like a valid operation or register address.
+			 */
+			if (cl->CommandId >= 0xff || cl->CommandId < 0x81)
+				cl->CommandId = 0x81;
+			cmd->ids[indx] = cl->CommandId++;
+		}
+		cmd->id = cmd->ids[0];
+		cmd->status = -EINPROGRESS;
+	}
+	spin_unlock_irqrestore(&cl->cmd_lock, flags);
+	return cmd;
+}
+
+/*
+ * Give a request slot back. A late reply for it is then dropped.
+ */
+static void corsairlink_cmd_put(CorsairLink_t *cl, struct CorsairCmd *cmd)
+{
+	unsigned long flags;
+
+	/* The request must be off the bus before its buffer is reused */
+	if (cmd->urb)
+		usb_kill_urb(cmd->urb);
+	spin_lock_irqsave(&cl->cmd_lock, flags);
+	cmd->id = 0;
+	spin_unlock_irqrestore(&cl->cmd_lock, flags);
+	wake_up(&cl->irq_wait);
+}
+
+/*
+ * Send nops operations as one request without waiting for the reply.
+ * If the window is full this sleeps for a free slot, or returns -EBUSY
+ * when wait is 0.
+ */
+static struct CorsairCmd *corsairlink_cmd_start(CorsairLink_t *cl, const CorsairOp_t *ops,
+						int nops, int wait)
+{
+	struct CorsairCmd *cmd = NULL;
+	unsigned char req[CL_PKT_DATA];
+	unsigned char *p;
+	int indx, len, wlen;
+	int retval;
+
+	for (indx = 0, len = 0; indx < nops; indx++)
+		len += 3 + corsairlink_op_wlen(ops[indx].opcode);
+	if (nops > CL_MAXOPS || len > sizeof(req))
+		return ERR_PTR(-EINVAL);
+
+	if (wait) {
+		retval = wait_event_interruptible(cl->irq_wait,
+						  (cmd = corsairlink_cmd_get(cl, nops)) != NULL);
+		if (retval)
+			return ERR_PTR(retval);
+	} else {
+		cmd = corsairlink_cmd_get(cl, nops);
+		if (!cmd)
+			return ERR_PTR(-EBUSY);
+	}
+
+	/*
+	 * The command IDs are returned on the reply to match it to this
+	 * request. Note this is needed since the nature of USB might
+	 * allow stale replies to get sent to us multiple times.
+	 */
+	for (indx = 0, len = 0; indx < nops; indx++) {
+		wlen = corsairlink_op_wlen(ops[indx].opcode);
+		p = &req[len];
+		p[0] = cmd->ids[indx];		/* Command ID */
+		p[1] = ops[indx].opcode;	/* Corsair Operation */
+		p[2] = ops[indx].reg;		/* address of operation */
+		if (wlen > 0)
+			p[3] = ops[indx].data & 0xff;
+		if (wlen > 1)
+			p[4] = ops[indx].data >> 8;
+		len += 3 + wlen;
+	}
+
+	reinit_completion(&cmd->done);
+	retval = cl->transport->send(cl, cmd, req, len);
+	if (retval) {
+		corsairlink_cmd_put(cl, cmd);
+		return ERR_PTR(retval);
+	}
+	return cmd;
+}
+
+/*
+ * Wait for the reply to a started request and hand out what its
+ * operations read. If the reply does not account for every operation
+ * nothing is handed out. The slot is given back either way. Note that
+ * this routine can and most likely will sleep, awaiting an USB
+ * interrupt from the device.
+ */
+static int corsairlink_cmd_finish(CorsairLink_t *cl, struct CorsairCmd *cmd,
+				  const CorsairOp_t *ops, int nops)
+{
+	unsigned char reply[sizeof(cmd->data)];
+	unsigned char ids[CL_MAXOPS];
+	unsigned int val[CL_MAXOPS];
+	unsigned long flags;
+	int indx, pos, rlen;
+	long left;
+	int retval;
+
+	left = wait_for_completion_interruptible_timeout(&cmd->done,
+							 msecs_to_jiffies(cl->rw_ms_timeo));
+	spin_lock_irqsave(&cl->cmd_lock, flags);
+	retval = cmd->status;
+	if (retval == 0)
+		memcpy(reply, cmd->data, sizeof(reply));
+	memcpy(ids, cmd->ids, sizeof(ids));
+	spin_unlock_irqrestore(&cl->cmd_lock, flags);
+	corsairlink_cmd_put(cl, cmd);
+
+	if (retval == -EINPROGRESS)
+		return left < 0 ? left : -ETIMEDOUT;
+	if (retval)
+		return retval;
+
+	for (indx = 0, pos = 0; indx < nops; indx++) {
+		rlen = corsairlink_op_rlen(ops[indx].opcode);
+		if (pos + 2 + rlen > sizeof(reply) || reply[pos] != ids[indx]) {
+			dev_err(&cl->interface->dev, "reply %d is for 0x%x not 0x%x\n",
+				indx, reply[pos], ids[indx]);
+			return -EIO;
+		}
+		pos += 2;
+		if (rlen == 2)
+			val[indx] = reply[pos + 1] << 8 | reply[pos];
+		else
+			val[indx] = reply[pos];
+		pos += rlen;
+	}
+	for (indx = 0; indx < nops; indx++)
+		if (ops[indx].result && corsairlink_op_rlen(ops[indx].opcode))
+			*ops[indx].result = val[indx];
+	return 0;
+}
+
+/*
+ * Interrupt handler - Used to indicate device got our requests.
+ */
+static void corsairlink_irq_out(struct urb *urb)
+{
+	struct CorsairCmd *cmd = urb->context;
+	CorsairLink_t *cl = cmd->cl;
+
+        switch (urb->status) {
+        case 0:                 /* success, the reply comes on the in pipe */
+        case -ECONNRESET:       /* unlink */
+        case -ENOENT:
+        case -ESHUTDOWN:
+                return;
+        default:                /* error, the request never made it */
+                break;
+        }
+
+	spin_lock(&cl->cmd_lock);
+	if (cmd->id && cmd->status == -EINPROGRESS) {
+		cmd->status = -EIO;
+		complete(&cmd->done);
+	}
+	spin_unlock(&cl->cmd_lock);
+}
+
+/*
+ * Interrupt handler - Used to read data from the device.
+ */
+static void corsairlink_irq_in(struct urb *urb)
+{
+	CorsairLink_t *cl = urb->context;
+	unsigned char *irq_buf = urb->transfer_buffer;
+	struct CorsairCmd *cmd;
+	int indx;
+
+        switch (urb->status) {
+        case 0:                 /* success */
+	case -EOVERFLOW:	/* we ask for less bytes then whole USB xfer  */
+                break;
+        case -ECONNRESET:       /* unlink */
+        case -ENOENT:
+        case -ESHUTDOWN:
+                return;
+        /* -EPIPE:  should clear the halt */
+        default:                /* error */
+                goto resubmit;
+        }
+
+	/* Hand the reply to the request with its ID, drop it if there is none */
+	spin_lock(&cl->cmd_lock);
+	for (indx = 0; indx < CL_MAXCMDS; indx++) {
+		cmd = &cl->cmds[indx];
+		if (irq_buf[0] && cmd->id == irq_buf[0] && cmd->status == -EINPROGRESS) {
+			memcpy(cmd->data, irq_buf, sizeof(cmd->data));
+			cmd->status = 0;
+			complete(&cmd->done);
+			break;
+		}
+	}
+	spin_unlock(&cl->cmd_lock);
+resubmit:
+        usb_submit_urb(urb, GFP_ATOMIC);
+}
+
+
+/***************************************************************/
+/* Batched requests                                            */
+/***************************************************************/
+
+/*
+ * Operations are added in groups, a select and the reads that go with
+ * it, and a group never straddles two requests. The batch is big
+ * enough for a full probe of the largest device.
+ */
+#define CL_BATCH_OPS		48
+
+struct CorsairBatch {
+	CorsairLink_t	*cl;
+	int		nops;
+	CorsairOp_t	op[CL_BATCH_OPS];
+	unsigned char	report[CL_BATCH_OPS];	/* Which request each op goes in */
+	int		nreports;
+	int		reqlen;			/* Fill of the last request */
+	int		replen;
+	int		inreport;
+	int		errors;			/* Requests that got no usable reply */
+};
+typedef struct CorsairBatch CorsairBatch_t;
+
+static CorsairBatch_t *corsairlink_batch_alloc(CorsairLink_t *cl)
+{
+	CorsairBatch_t *b;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (b)
+		b->cl = cl;
+	return b;
+}
+
+/*
+ * Queue a group of operations, starting a new request if the group
+ * does not fit in the last one.
+ */
+static int corsairlink_batch_add(CorsairBatch_t *b, const CorsairOp_t *ops, int nops)
+{
+	const struct CorsairTransport *t = b->cl->transport;
+	int reqlen = 0, replen = 0;
+	int indx;
+
+	for (indx = 0; indx < nops; indx++) {
+		reqlen += 3 + corsairlink_op_wlen(ops[indx].opcode);
+		replen += 2 + corsairlink_op_rlen(ops[indx].opcode);
+	}
+	if (nops > t->maxops || reqlen > t->maxdata || replen > t->maxdata)
+		return -EINVAL;
+	if (b->nops + nops > CL_BATCH_OPS)
+		return -ENOSPC;
+
+	if (b->nreports == 0 ||
+	    b->inreport + nops > t->maxops ||
+	    b->reqlen + reqlen > t->maxdata ||
+	    b->replen + replen > t->maxdata) {
+		b->nreports++;
+		b->reqlen = 0;
+		b->replen = 0;
+		b->inreport = 0;
+	}
+	for (indx = 0; indx < nops; indx++) {
+		b->op[b->nops] = ops[indx];
+		b->report[b->nops++] = b->nreports - 1;
+	}
+	b->reqlen += reqlen;
+	b->replen += replen;
+	b->inreport += nops;
+	return 0;
+}
+
+/*
+ * Queue reads of one channel. With a select register they go behind a
+ * select of the channel, all in one request. Without one each read
+ * stands on its own.
+ */
+static int corsairlink_batch_channel(CorsairBatch_t *b, unsigned char select, int indx,
+				     const CorsairOp_t *ops, int nops)
+{
+	CorsairOp_t group[CL_MAXOPS];
+	int retval;
+
+	if (!select) {
+		for (; nops; ops++, nops--) {
+			retval = corsairlink_batch_add(b, ops, 1);
+			if (retval)
+				return retval;
+		}
+		return 0;
+	}
+	if (nops + 1 > CL_MAXOPS)
+		return -EINVAL;
+	group[0].opcode = WriteOneByte;
+	group[0].reg = select;
+	group[0].data = indx;		/* Channel number */
+	group[0].result = NULL;
+	memcpy(&group[1], ops, nops * sizeof(*ops));
+	return corsairlink_batch_add(b, group, nops + 1);
+}
+
+/* Queue a fan's mode (if mode isn't NULL), RPM and max RPM */
+static int corsairlink_batch_fan(CorsairBatch_t *b, int indx, unsigned int *mode,
+				 unsigned int *rpm, unsigned int *maxrpm)
+{
+	const struct CorsairProtocol *p = b->cl->proto;
+	CorsairOp_t ops[3];
+	int nops = 0;
+
+	if (mode) {
+		ops[nops].opcode = p->mode_op;
+		ops[nops].reg = p->fan_mode[indx];
+		ops[nops].data = 0;
+		ops[nops++].result = mode;
+	}
+	ops[nops].opcode = ReadTwoBytes;
+	ops[nops].reg = p->fan_rpm[indx];
+	ops[nops].data = 0;
+	ops[nops++].result = rpm;
+	ops[nops].opcode = ReadTwoBytes;
+	ops[nops].reg = p->fan_max[indx];
+	ops[nops].data = 0;
+	ops[nops++].result = maxrpm;
+	return corsairlink_batch_channel(b, p->fan_select, indx, ops, nops);
+}
+
+/* Queue a temp sensor's reading */
+static int corsairlink_batch_temp(CorsairBatch_t *b, int indx, unsigned int *temp)
+{
+	const struct CorsairProtocol *p = b->cl->proto;
+	CorsairOp_t op;
+
+	op.opcode = ReadTwoBytes;
+	op.reg = p->temp_read[indx];
+	op.data = 0;
+	op.result = temp;
+	return corsairlink_batch_channel(b, p->temp_select, indx, &op, 1);
+}
+
+/* Operations in the request that starts at b->op[first] */
+static int corsairlink_batch_count(CorsairBatch_t *b, int first)
+{
+	int indx = first;
+
+	while (indx < b->nops && b->report[indx] == b->report[first])
+		indx++;
+	return indx - first;
+}
+
+/*
+ * Send the queued requests, keeping as many in flight as the window
+ * allows, and hand out what they read. With stop set no more requests
+ * are sent after one fails. Returns the number that failed and
+ * empties the batch.
+ */
+static int corsairlink_batch_run(CorsairBatch_t *b, int stop)
+{
+	CorsairLink_t *cl = b->cl;
+	struct CorsairCmd *inflight[CL_MAXCMDS];
+	struct CorsairCmd *cmd;
+	int first = 0, next = 0;	/* Requests finished, started */
+	int fop = 0, nop = 0;		/* Their first operations */
+	int errors;
+	int n;
+
+	while (first < b->nreports) {
+		if (stop && b->errors && first == next)
+			break;
+		if (next < b->nreports && !(stop && b->errors) &&
+		    next - first < CL_MAXCMDS) {
+			n = corsairlink_batch_count(b, nop);
+			/*
+			 * Only sleep for a slot when none of ours are in
+			 * flight, otherwise two callers could each hold
+			 * slots while waiting for the other's.
+			 */
+			cmd = corsairlink_cmd_start(cl, &b->op[nop], n, first == next);
+			if (cmd != ERR_PTR(-EBUSY)) {
+				inflight[next % CL_MAXCMDS] = cmd;
+				nop += n;
+				next++;
+				continue;
+			}
+		}
+		n = corsairlink_batch_count(b, fop);
+		cmd = inflight[first % CL_MAXCMDS];
+		if (IS_ERR(cmd) || corsairlink_cmd_finish(cl, cmd, &b->op[fop], n))
+			b->errors++;
+		fop += n;
+		first++;
+	}
+
+	errors = b->errors + (b->nreports - first);
+	b->nops = 0;
+	b->nreports = 0;
+	b->errors = 0;
+	return errors;
+}
+
+
+/***************************************************************/
+/* Reading cache                                               */
+/***************************************************************/
+
+/*
+ * Read every fan and temp sensor found at probe time and put the
+ * results in the cache in one go. Nothing is cached unless the whole
+ * sweep worked. Called with sweep_lock held.
+ */
+static int corsairlink_sweep(CorsairLink_t *cl)
+{
+	unsigned int rpm[NUMFANS], maxrpm[NUMFANS], temp[NUMTEMPS];
+	CorsairBatch_t *b;
+	int indx;
+	int retval = 0;
+
+	b = corsairlink_batch_alloc(cl);
+	if (!b)
+		return -ENOMEM;
+
+	for (indx = 0; indx < NUMFANS && !retval; indx++)
+		if (cl->fans[indx].present)
+			retval = corsairlink_batch_fan(b, indx, NULL, &rpm[indx], &maxrpm[indx]);
+	for (indx = 0; indx < NUMTEMPS && !retval; indx++)
+		if (cl->temps[indx].present)
+			retval = corsairlink_batch_temp(b, indx, &temp[indx]);
+	if (!retval && corsairlink_batch_run(b, 1))
+		retval = -EIO;
+	kfree(b);
+	if (retval) {
+		dev_err(&cl->interface->dev, "Sweep: failed %d\n", retval);
+		return retval;
+	}
+
+	spin_lock(&cl->cache_lock);
+	for (indx = 0; indx < NUMFANS; indx++) {
+		if (!cl->fans[indx].present)
+			continue;
+		cl->fans[indx].RPM = rpm[indx];
+		cl->fans[indx].maxRPM = maxrpm[indx];
+	}
+	for (indx = 0; indx < NUMTEMPS; indx++) {
+		if (!cl->temps[indx].present)
+			continue;
+		cl->temps[indx].wholDeg = temp[indx] >> 8;	/* whole degree's */
+		cl->temps[indx].partDeg = temp[indx] & 0xff;	/* 1/256's of degree */
+	}
+	cl->cache_valid = 1;
+	cl->cache_time = jiffies;
+	spin_unlock(&cl->cache_lock);
+	return 0;
+}
+
+/* Called with cache_lock held */
+static int corsairlink_cache_fresh(CorsairLink_t *cl)
+{
+	return cl->cache_valid &&
+	       time_before(jiffies, cl->cache_time + msecs_to_jiffies(max_age));
+}
+
+/*
+ * Make sure the cache is no older than max_age, sweeping the device
+ * now if the background sweep has fallen behind or is turned off.
+ * Returns 1 if the cache can be used.
+ */
+static int corsairlink_refresh(CorsairLink_t *cl)
+{
+	int fresh;
+
+	spin_lock(&cl->cache_lock);
+	fresh = corsairlink_cache_fresh(cl);
+	spin_unlock(&cl->cache_lock);
+	if (fresh)
+		return 1;
+
+	mutex_lock(&cl->sweep_lock);
+	/* Whoever had the lock before us may just have swept */
+	spin_lock(&cl->cache_lock);
+	fresh = corsairlink_cache_fresh(cl);
+	spin_unlock(&cl->cache_lock);
+	if (!fresh)
+		fresh = corsairlink_sweep(cl) == 0;
+	mutex_unlock(&cl->sweep_lock);
+	return fresh;
+}
+
+/*
+ * Background sweep, runs every update_interval ms
+ */
+static void corsairlink_poll(struct work_struct *work)
+{
+	CorsairLink_t *cl = container_of(to_delayed_work(work), CorsairLink_t, poll_work);
+	unsigned int interval;
+
+	mutex_lock(&cl->sweep_lock);
+	corsairlink_sweep(cl);
+	mutex_unlock(&cl->sweep_lock);
+
+	interval = READ_ONCE(cl->update_interval);
+	if (interval)
+		schedule_delayed_work(&cl->poll_work, msecs_to_jiffies(interval));
+}
+
+
+/***************************************************************/
+/* High level device objects interface routines                */
+/***************************************************************/
+
+
+/*
+ * Read the RPM of a selcted fan - sysfs interfacde routine
+ */
+static ssize_t fan_in(struct device *dev, struct device_attribute *devattr, char *buffer)
+{
+	struct usb_interface *interface = to_usb_interface(dev);
+        struct sensor_device_attribute *attr = to_sensor_dev_attr(devattr);
+	CorsairLink_t *cl = usb_get_intfdata(interface);
+	int indx = attr->index;
+	unsigned int rpm;
+
+	if (!corsairlink_refresh(cl)) {
+		dev_err(&interface->dev, "FanIn: failed\n");
+		return sprintf(buffer, "ERROR\n");
+	}
+	spin_lock(&cl->cache_lock);
+	rpm = cl->fans[indx].RPM;
+	spin_unlock(&cl->cache_lock);
+
+        return sprintf(buffer, "%u\n", rpm);
+}
+static SENSOR_DEVICE_ATTR(fan1_input, S_IRUGO, fan_in, NULL, FAN0);
+static SENSOR_DEVICE_ATTR(fan2_input, S_IRUGO, fan_in, NULL, FAN1);
+static SENSOR_DEVICE_ATTR(fan3_input, S_IRUGO, fan_in, NULL, FAN2);
+static SENSOR_DEVICE_ATTR(fan4_input, S_IRUGO, fan_in, NULL, FAN3);
+static SENSOR_DEVICE_ATTR(fan5_input, S_IRUGO, fan_in, NULL, FAN4);
+static SENSOR_DEVICE_ATTR(fan6_input, S_IRUGO, fan_in, NULL, FAN5);
+
+/*
+ * Read the max RPM of a selcted fan - sysfs interfacde routine
+ */
+static ssize_t fan_max(struct device *dev, struct device_attribute *devattr, char *buffer)
+{
+	struct usb_interface *interface = to_usb_interface(dev);
+        struct sensor_device_attribute *attr = to_sensor_dev_attr(devattr);
+	CorsairLink_t *cl = usb_get_intfdata(interface);
+	int indx = attr->index;
+	unsigned int rpm;
+
+	if (!corsairlink_refresh(cl)) {
+		dev_err(&interface->dev, "FanIn: failed\n");
+		return sprintf(buffer, "ERROR\n");
+	}
+	spin_lock(&cl->cache_lock);
+	rpm = cl->fans[indx].maxRPM;
+	spin_unlock(&cl->cache_lock);
+
+        return sprintf(buffer, "%u\n", rpm);
+}
+static SENSOR_DEVICE_ATTR(fan1_max, S_IRUGO, fan_max, NULL, FAN0);
+static SENSOR_DEVICE_ATTR(fan2_max, S_IRUGO, fan_max, NULL, FAN1);
+static SENSOR_DEVICE_ATTR(fan3_max, S_IRUGO, fan_max, NULL, FAN2);
+static SENSOR_DEVICE_ATTR(fan4_max, S_IRUGO, fan_max, NULL, FAN3);
+static SENSOR_DEVICE_ATTR(fan5_max, S_IRUGO, fan_max, NULL, FAN4);
+static SENSOR_DEVICE_ATTR(fan6_max, S_IRUGO, fan_max, NULL, FAN5);
+
+/*
+ * Read the Temp of a selcted sensor - sysfs interfacde routine
+ */
+static ssize_t temp_in(struct device *dev, struct device_attribute *devattr, char *buffer)
+{
+	struct usb_interface *interface = to_usb_interface(dev);
+        struct sensor_device_attribute *attr = to_sensor_dev_attr(devattr);
+	CorsairLink_t *cl = usb_get_intfdata(interface);
+	int sensor = attr->index;
+	unsigned int Temp = 0;
+
+	if (!corsairlink_refresh(cl)) {
+		dev_err(&interface->dev, "TempIn: failed\n");
+		return sprintf(buffer, "ERROR\n");
+	}
+	spin_lock(&cl->cache_lock);
+	Temp = corsairlink_temp_milli2(cl->temps[sensor].wholDeg,
+				       cl->temps[sensor].partDeg);
+	spin_unlock(&cl->cache_lock);
+
+        return sprintf(buffer, "%u\n", Temp);
+}
+static SENSOR_DEVICE_ATTR(temp1_input, S_IRUGO, temp_in, NULL, 0);
+static SENSOR_DEVICE_ATTR(temp2_input, S_IRUGO, temp_in, NULL, 1);
+static SENSOR_DEVICE_ATTR(temp3_input, S_IRUGO, temp_in, NULL, 2);
+static SENSOR_DEVICE_ATTR(temp4_input, S_IRUGO, temp_in, NULL, 3);
+
+/*
+ * sysfs and lm-sensors require a name entry and this is it
+ */
+static ssize_t show_name(struct device *dev, struct device_attribute *devattr, char *buf)
+{
+	struct usb_interface *interface = to_usb_interface(dev);
+	CorsairLink_t *cl = usb_get_intfdata(interface);
+
+	if (cl && cl->devid) {
+		return sprintf(buf, "%s\n", cl->devid->name);
+	} else {
+		return sprintf(buf, "CorsairLink\n");
+	}
+}
+static DEVICE_ATTR(name, S_IRUGO, show_name, NULL);
+
+/*
+ * hwmon update_interval: ms between background sweeps, 0 turns them
+ * off and readings are then only refreshed by reads.
+ */
+static ssize_t show_update_interval(struct device *dev, struct device_attribute *devattr,
+				    char *buf)
+{
+	struct usb_interface *interface = to_usb_interface(dev);
+	CorsairLink_t *cl = usb_get_intfdata(interface);
+
+	return sprintf(buf, "%u\n", READ_ONCE(cl->update_interval));
+}
+
+static ssize_t set_update_interval(struct device *dev, struct device_attribute *devattr,
+				   const char *buf, size_t count)
+{
+	struct usb_interface *interface = to_usb_interface(dev);
+	CorsairLink_t *cl = usb_get_intfdata(interface);
+	unsigned int interval;
+
+	if (kstrtouint(buf, 10, &interval))
+		return -EINVAL;
+
+	cancel_delayed_work_sync(&cl->poll_work);
+	WRITE_ONCE(cl->update_interval, interval);
+	if (interval)
+		schedule_delayed_work(&cl->poll_work, msecs_to_jiffies(interval));
+	return count;
+}
+static DEVICE_ATTR(update_interval, S_IRUGO | S_IWUSR, show_update_interval,
+		   set_update_interval);
+
+
+static struct attribute *corsairlink_attributes[] = {
+        &dev_attr_name.attr,
+        &dev_attr_update_interval.attr,
+        NULL
+};
+
+static const struct attribute_group corsairlink_group = {
+        .attrs = corsairlink_attributes,
+};
+
+static struct device_attribute *fanIndxToAttr[NUMFANS] = {
+	&sensor_dev_attr_fan1_input.dev_attr,
+	&sensor_dev_attr_fan2_input.dev_attr,
+	&sensor_dev_attr_fan3_input.dev_attr,
+	&sensor_dev_attr_fan4_input.dev_attr,
+	&sensor_dev_attr_fan5_input.dev_attr,
+	&sensor_dev_attr_fan6_input.dev_attr,
+};
+
+static struct device_attribute *fanmaxIndxToAttr[NUMFANS] = {
+	&sensor_dev_attr_fan1_max.dev_attr,
+	&sensor_dev_attr_fan2_max.dev_attr,
+	&sensor_dev_attr_fan3_max.dev_attr,
+	&sensor_dev_attr_fan4_max.dev_attr,
+	&sensor_dev_attr_fan5_max.dev_attr,
+	&sensor_dev_attr_fan6_max.dev_attr,
+};
+
+static struct device_attribute *tempIndxToAttr[NUMTEMPS] = {
+	&sensor_dev_attr_temp1_input.dev_attr,
+	&sensor_dev_attr_temp2_input.dev_attr,
+	&sensor_dev_attr_temp3_input.dev_attr,
+	&sensor_dev_attr_temp4_input.dev_attr,
+};
+
+
+/***************************************************************/
+/* High level driver interface routines                        */
+/***************************************************************/
+
+/*
+ * Get the CorsairLink device ID so we know what we can and cannot do.
+ */
+static int corsairlink_devid_in(CorsairLink_t *cl)
+{
+	struct usb_interface *interface = cl->interface;
+	unsigned int devid = 0, firmware = 0;
+	CorsairBatch_t *b;
+	CorsairOp_t op;
+	int indx;
+
+	b = corsairlink_batch_alloc(cl);
+	if (!b)
+		return -ENOMEM;
+	op.opcode = ReadOneByte;
+	op.reg = DeviceID;
+	op.data = 0;
+	op.result = &devid;
+	corsairlink_batch_add(b, &op, 1);
+	op.opcode = ReadTwoBytes;
+	op.reg = FirmwareID;
+	op.result = &firmware;
+	corsairlink_batch_add(b, &op, 1);
+	if (corsairlink_batch_run(b, 1)) {
+		kfree(b);
+		dev_err(&interface->dev, "devID: failed\n");
+		return -EIO;
+	}
+	kfree(b);
+
+	for (indx = 0; CorsairID[indx].id != 0; indx++)
+		if (devid == CorsairID[indx].id)
+			break;
+	cl->devid = &CorsairID[indx];
+	cl->FirmwareID = firmware;
+	return CorsairID[indx].id ? 0 : -ENOENT;
+}
+
+/*
+ * Find out which fans and temp sensors are there, read them all for the
+ * first cache contents and make their sysfs files.
+ */
+static int corsairlink_scan(CorsairLink_t *cl)
+{
+	struct usb_interface *interface = cl->interface;
+	const struct CorsairProtocol *p = cl->proto;
+	unsigned int mode[NUMFANS], rpm[NUMFANS], maxrpm[NUMFANS], temp[NUMTEMPS];
+	int nfans = min(cl->devid->maxfancnt + cl->devid->maxpumpcnt, NUMFANS);
+	int ntemps = min(cl->devid->maxtempcnt, NUMTEMPS);
+	CorsairBatch_t *b;
+	unsigned int Temp;
+	int indx, errors;
+	int retval = 0;
+
+	b = corsairlink_batch_alloc(cl);
+	if (!b)
+		return -ENOMEM;
+	memset(mode, 0, sizeof(mode));
+	memset(rpm, 0, sizeof(rpm));
+	memset(maxrpm, 0, sizeof(maxrpm));
+	memset(temp, 0, sizeof(temp));
+	for (indx = 0; indx < nfans && !retval; indx++)
+		retval = corsairlink_batch_fan(b, indx, &mode[indx], &rpm[indx], &maxrpm[indx]);
+	for (indx = 0; indx < ntemps && !retval; indx++)
+		retval = corsairlink_batch_temp(b, indx, &temp[indx]);
+	errors = retval ? 0 : corsairlink_batch_run(b, 0);
+	kfree(b);
+	if (retval)
+		return retval;
+	if (errors)
+		dev_err(&interface->dev, "Probe: %d request(s) failed\n", errors);
+
+	/* Probe the fans */
+	for (indx = 0; indx < nfans; indx++) {
+		CorsairFanInfo_t *fan = &cl->fans[indx];
+
+		if (indx == PUMP && cl->devid->maxpumpcnt)
+			snprintf(fan->Name, sizeof(fan->Name), "Pump");
+		else
+			snprintf(fan->Name, sizeof(fan->Name), "Fan %d", indx + 1);
+		fan->Mode = mode[indx] & 0xff;
+		fan->RPM = rpm[indx];
+		fan->maxRPM = maxrpm[indx];
+
+		if (!p->fan_present(fan)) {
+			dev_info(&interface->dev, "%s %s Mode %x RPM %d Max %d NOT PRESENT\n",
+				 cl->devid->name, fan->Name, fan->Mode, fan->RPM, fan->maxRPM);
+			continue;
+		}
+		fan->present = 1;
+		retval = device_create_file(&interface->dev, fanIndxToAttr[indx]);
+		if (retval)
+			return retval;
+		retval = device_create_file(&interface->dev, fanmaxIndxToAttr[indx]);
+		if (retval)
+			return retval;
+		dev_info(&interface->dev, "%s %s Mode %x RPM %d Max %d\n",
+			 cl->devid->name, fan->Name, fan->Mode, fan->RPM, fan->maxRPM);
+	}
+
+	/* Probe the temp sensors */
+	for (indx = 0; indx < ntemps; indx++) {
+		CorsairTempInfo_t *sensor = &cl->temps[indx];
+
+		snprintf(sensor->Name, sizeof(sensor->Name), "Temp %d", indx + 1);
+		sensor->wholDeg = temp[indx] >> 8;	/* whole degree's */
+		sensor->partDeg = temp[indx] & 0xff;	/* 1/256's of degree */
+
+		if (!p->temp_present(sensor)) {
+			dev_info(&interface->dev, "%s %s NOT PRESENT\n",
+				 cl->devid->name, sensor->Name);
+			continue;
+		}
+		sensor->present = 1;
+		retval = device_create_file(&interface->dev, tempIndxToAttr[indx]);
+		if (retval)
+			return retval;
+		Temp = corsairlink_temp_milli2(sensor->wholDeg, sensor->partDeg);
+		dev_info(&interface->dev, "%s %s %u.%03u Deg C\n",
+			 cl->devid->name, sensor->Name, Temp / 1000, Temp % 1000);
+	}
+
+	/* What the probe read is the first cache content */
+	cl->cache_valid = 1;
+	cl->cache_time = jiffies;
+	return 0;
+}
+
+static void corsairlink_remove_files(struct usb_interface *interface)
+{
+	int indx;
+
+        sysfs_remove_group(&interface->dev.kobj, &corsairlink_group);
+	for (indx = 0; indx < NUMFANS; indx++) {
+		device_remove_file(&interface->dev, fanIndxToAttr[indx]);
+		device_remove_file(&interface->dev, fanmaxIndxToAttr[indx]);
+	}
+	for (indx = 0; indx < NUMTEMPS; indx++)
+		device_remove_file(&interface->dev, tempIndxToAttr[indx]);
+}
+
+/*
+ * Stop and free every URB, the in URB first so no reply lands in a
+ * request that is being torn down, then the buffers they used.
+ */
+static void corsairlink_free_urbs(CorsairLink_t *cl)
+{
+	int indx;
+
+	if (cl->irq_in) {
+		usb_kill_urb(cl->irq_in);
+		usb_free_urb(cl->irq_in);
+	}
+	for (indx = 0; indx < CL_MAXCMDS; indx++) {
+		if (cl->cmds[indx].urb) {
+			usb_kill_urb(cl->cmds[indx].urb);
+			usb_free_urb(cl->cmds[indx].urb);
+		}
+	}
+	for (indx = 0; indx < CL_MAXCMDS; indx++)
+		kfree(cl->cmds[indx].out);
+	kfree(cl->irq_buf);
+}
+
+/*
+ * Main driver interface that probes and gets everything going. Called
+ * from a device driver's probe with how to reach the device and where
+ * its registers are.
+ */
+int corsairlink_probe(struct usb_interface *interface,
+		      const struct CorsairTransport *transport,
+		      const struct CorsairProtocol *proto)
+{
+	struct usb_device *udev = interface_to_usbdev(interface);
+	struct usb_host_interface *hiface = interface->cur_altsetting;
+	struct usb_endpoint_descriptor *ep_in = NULL, *ep_out = NULL;
+	struct usb_endpoint_descriptor *endpoint;
+	CorsairLink_t *cl;
+	int pipe_in, pipe_out;
+	int maxp_in, maxp_out;
+	int retval = -ENOMEM;
+	int indx;
+
+	/*
+	 * Make sure right device. h80i/h100i have an interrupt in
+	 * endpoint, the Commander an interrupt out one as well.
+	 */
+	for (indx = 0; indx < hiface->desc.bNumEndpoints; indx++) {
+		endpoint = &hiface->endpoint[indx].desc;
+		if (usb_endpoint_is_int_in(endpoint))
+			ep_in = endpoint;
+		if (usb_endpoint_is_int_out(endpoint))
+			ep_out = endpoint;
+	}
+	if (ep_in == NULL || (transport->irq_out && ep_out == NULL)) {
+		dev_err(&interface->dev, "endpoints missing\n");
+		return -ENODEV;
+	}
+
+	/*
+	 * Allocate a per instance state structure
+	 */
+	cl = kzalloc(sizeof(CorsairLink_t), GFP_KERNEL);
+	if (cl == NULL) {
+		dev_err(&interface->dev, "cl out of memory\n");
+		return -ENOMEM;
+	}
+	cl->CommandId = 0x81;	/* Starting command message number */
+	cl->rw_ms_timeo = 5000; /* Give the request/response up to 5 seconds */
+	cl->interface = interface;
+	cl->transport = transport;
+	cl->proto = proto;
+	cl->window = transport->window ? transport->window : cmd_window;
+	cl->window = clamp_val(cl->window, 1, CL_MAXCMDS);
+	cl->update_interval = poll_interval;
+	spin_lock_init(&cl->cmd_lock);
+	init_waitqueue_head(&cl->irq_wait);
+	mutex_init(&cl->sweep_lock);
+	spin_lock_init(&cl->cache_lock);
+	INIT_DELAYED_WORK(&cl->poll_work, corsairlink_poll);
+
+	cl->irq_in = usb_alloc_urb(0, GFP_KERNEL);
+	cl->irq_buf = kmalloc(CL_BUFSIZE, GFP_KERNEL);
+	if (cl->irq_in == NULL || cl->irq_buf == NULL) {
+		dev_err(&interface->dev, "interrupt urb alloc - out of memory\n");
+		goto error_mem;
+	}
+	for (indx = 0; indx < CL_MAXCMDS; indx++) {
+		cl->cmds[indx].cl = cl;
+		init_completion(&cl->cmds[indx].done);
+		cl->cmds[indx].out = kmalloc(CL_BUFSIZE, GFP_KERNEL);
+		if (cl->cmds[indx].out == NULL) {
+			dev_err(&interface->dev, "cmd buffer alloc - out of memory\n");
+			goto error_mem;
+		}
+		if (!transport->irq_out)
+			continue;
+		cl->cmds[indx].urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (cl->cmds[indx].urb == NULL) {
+			dev_err(&interface->dev, "interrupt urb alloc - out of memory\n");
+			goto error_mem;
+		}
+	}
+
+	cl->udev = usb_get_dev(udev);
+	usb_set_intfdata(interface, cl);
+
+	/*
+	 * Setup interrupt handlers
+	 */
+	pipe_in = usb_rcvintpipe(udev, ep_in->bEndpointAddress);
+	maxp_in = usb_maxpacket(udev, pipe_in, usb_pipeout(pipe_in));
+	usb_fill_int_urb(cl->irq_in, udev, pipe_in,
+                         cl->irq_buf,
+			 (maxp_in > CL_BUFSIZE ? CL_BUFSIZE : maxp_in),
+                         corsairlink_irq_in, cl,
+			 ep_in->bInterval);
+	if (transport->irq_out) {
+		pipe_out = usb_sndintpipe(udev, ep_out->bEndpointAddress);
+		maxp_out = usb_maxpacket(udev, pipe_out, usb_pipeout(pipe_out));
+		for (indx = 0; indx < CL_MAXCMDS; indx++)
+			usb_fill_int_urb(cl->cmds[indx].urb, udev, pipe_out,
+					 cl->cmds[indx].out,
+					 (maxp_out > CL_BUFSIZE ? CL_BUFSIZE : maxp_out),
+					 corsairlink_irq_out, &cl->cmds[indx],
+					 ep_out->bInterval);
+	}
+
+	/* The in pipe stays polled from here to disconnect */
+	retval = usb_submit_urb(cl->irq_in, GFP_KERNEL);
+	if (retval) {
+		dev_err(&interface->dev, "interrupt urb submit failed %d\n", retval);
+		goto error1;
+	}
+
+	/*
+	 * Find out the device type found
+	 */
+	retval = corsairlink_devid_in(cl);
+	if (retval == -ENOENT) {
+		dev_info(&interface->dev, "device NOT found\n");
+		goto error1;
+	} else if (retval) {
+		dev_err(&interface->dev, "Failed to get device ID - NOT attached\n");
+		goto error1;
+	}
+	if (cl->devid->supported == 0 || cl->devid->intfType != proto->intfType) {
+		dev_info(&interface->dev, "%s device found but not yet supported\n",
+			 cl->devid->name);
+		dev_err(&interface->dev, "%s device NOT attached\n", cl->devid->name);
+		retval = -ENODEV;
+		goto error1;
+	}
+
+	retval = corsairlink_scan(cl);
+	if (retval)
+		goto error;
+
+	retval = sysfs_create_group(&interface->dev.kobj, &corsairlink_group);
+	if (retval) {
+		dev_err(&interface->dev, "%s sysfs group name crate failed\n",
+			cl->devid->name);
+		goto error;
+	}
+	cl->hwmon_dev = hwmon_device_register(&interface->dev);
+	if (IS_ERR(cl->hwmon_dev)) {
+		dev_err(&interface->dev, "hwmon reg failed\n");
+		retval = PTR_ERR(cl->hwmon_dev);
+		cl->hwmon_dev = NULL;
+		goto error;
+	}
+
+	if (cl->update_interval)
+		schedule_delayed_work(&cl->poll_work, msecs_to_jiffies(cl->update_interval));
+
+	dev_info(&interface->dev, "%s cooler device V %x now attached\n",
+		 cl->devid->name, cl->FirmwareID);
+	return 0;
+
+error:
+	corsairlink_remove_files(interface);
+	/* update_interval may have armed the poll while the files were up */
+	cancel_delayed_work_sync(&cl->poll_work);
+error1:
+	usb_set_intfdata(interface, NULL);
+	corsairlink_free_urbs(cl);
+	usb_put_dev(cl->udev);
+	kfree(cl);
+	return retval;
+error_mem:
+	corsairlink_free_urbs(cl);
+	kfree(cl);
+	return retval;
+}
+EXPORT_SYMBOL_GPL(corsairlink_probe);
+
+void corsairlink_disconnect(struct usb_interface *interface)
+{
+	CorsairLink_t *cl = usb_get_intfdata(interface);
+
+	if (cl && cl->hwmon_dev) {
+		hwmon_device_unregister(cl->hwmon_dev);
+		cl->hwmon_dev = NULL;
+	}
+	corsairlink_remove_files(interface);
+	/*
+	 * Removing the files waits out any update_interval write, which
+	 * may have rearmed the poll, so only stop the poll after that.
+	 */
+	if (cl)
+		cancel_delayed_work_sync(&cl->poll_work);
+	/* first remove the files, then set the pointer to NULL */
+	usb_set_intfdata(interface, NULL);
+	if (cl) {
+		dev_info(&interface->dev, "%s now disconnected\n", cl->devid->name);
+		corsairlink_free_urbs(cl);
+		usb_put_dev(cl->udev);
+		kfree(cl);
+	}
+}
+EXPORT_SYMBOL_GPL(corsairlink_disconnect);
+
+MODULE_AUTHOR(DRIVER_AUTHOR);
+MODULE_DESCRIPTION(DRIVER_DESC);
+MODULE_LICENSE("GPL");
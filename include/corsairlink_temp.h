@@ -0,0 +1,33 @@
+/*
+ * CorsairLink temperature decoding, shared by the h80i and clink
+ * drivers in h80/ and by the OpenCorsairLink userland tool, so it
+ * lives outside both trees.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License as
+ *	published by the Free Software Foundation, version 2.
+ */
+
+#ifndef CORSAIRLINK_TEMP_H
+#define CORSAIRLINK_TEMP_H
+
+/*
+ * The devices report temperature as a 16 bit value in 1/256's of a
+ * degree C: high byte whole degrees, low byte the fraction. Turn
+ * that into millidegrees, rounded to nearest, with integer math only
+ * (no floating point in a kernel module). 0xffff * 1000 still fits
+ * in 32 bits.
+ */
+static inline unsigned int corsairlink_temp_milli(unsigned int raw)
+{
+	return ((raw & 0xffff) * 1000 + 128) >> 8;
+}
+
+/* Same, from the two bytes as the drivers keep them */
+static inline unsigned int corsairlink_temp_milli2(unsigned char whole,
+						   unsigned char frac)
+{
+	return corsairlink_temp_milli(((unsigned int)whole << 8) | frac);
+}
+
+#endif /* CORSAIRLINK_TEMP_H */